@@ -13,7 +13,7 @@ default_config = """# Configuration file for the traversal benchmark
 
 # Tools
 ref_intr = ''                                        # Reference intersection program
-bvh_io = ''                                          # BVH file generator
+bvh_io = 'build/src/build_bvh'                      # BVH file generator
 gen_prim = 'build/src/gen_primary'                   # Primary rays generator
 gen_shadow = 'build/src/gen_shadow'                  # Shadow rays generator
 gen_random = 'build/src/gen_random'                  # Random rays generator
@@ -203,32 +203,37 @@ def benchmark():
         if not os.path.exists(resdir):
             os.makedirs(resdir)
 
+        # Run all the scenes and distributions in one process, so that each scene is loaded only once
+        manifest = resdir + "/batch.txt"
+        images = []
+        with open(manifest, "w") as f:
+            for s, rays in config['scenes'].items():
+                for r in rays:
+                    name = remove_suffix(s, ".bvh") + "-" + remove_suffix(r, ".rays")
+                    print("   scene: " + s + ", distrib: " + r)
+                    resname = resdir + "/" + name + ".fbuf"
+                    f.write(" ".join([config['bvh_dir'] + "/" + s,
+                                      config['rays_dir'] + "/" + r,
+                                      resname,
+                                      str(config['rays'][r]['tmin']),
+                                      str(config['rays'][r]['tmax'])]) + "\n")
+                    images.append((resname, config['rays'][r]['width'], config['rays'][r]['height']))
+
         # Call the benchmark program
+        errname = resdir + "/batch.err"
+        outname = resdir + "/batch.out"
+        subprocess.call([bench,
+            "-b", manifest,
+            "-n", str(config['runs']),
+            "-d", str(config['dryruns'])], stdout=open(outname, "w"), stderr=open(errname, "w"))
+
+        remove_if_empty(errname)
+        remove_if_empty(outname)
+
         to_convert = []
-        for s, rays in config['scenes'].items():
-            for r in rays:
-                name = remove_suffix(s, ".bvh") + "-" + remove_suffix(r, ".rays")
-                print("   scene: " + s + ", distrib: " + r)
-                errname = resdir + "/" + name + ".err"
-                outname = resdir + "/" + name + ".out"
-                resname = resdir + "/" + name + ".fbuf"
-                tmin = config['rays'][r]['tmin']
-                tmax = config['rays'][r]['tmax']
-                width = config['rays'][r]['width']
-                height = config['rays'][r]['height']
-                subprocess.call([bench,
-                    "-a", config['bvh_dir'] + "/" + s,
-                    "-r", config['rays_dir'] + "/" + r,
-                    "-tmin", str(tmin),
-                    "-tmax", str(tmax),
-                    "-n", str(config['runs']),
-                    "-d", str(config['dryruns']),
-                    "-o", resname], stdout=open(outname, "w"), stderr=open(errname, "w"))
-
-                remove_if_empty(errname)
-                remove_if_empty(outname)
-                if os.path.isfile(resname):
-                    to_convert.append(spawn_silent("", [config['fbuf2png'], resname, resname[:-5] + ".png", "-w", str(width), "-h", str(height)]))
+        for resname, width, height in images:
+            if os.path.isfile(resname):
+                to_convert.append(spawn_silent("", [config['fbuf2png'], resname, resname[:-5] + ".png", "-w", str(width), "-h", str(height)]))
 
         # Convert .fbuf files to .png
         run_parallel(to_convert)
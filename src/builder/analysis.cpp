@@ -0,0 +1,222 @@
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <unordered_map>
+#include <algorithm>
+
+#include "analysis.h"
+#include "../frontend/parallel.h"
+
+namespace {
+
+class Analyzer {
+public:
+    Analyzer(const Mbvh& mbvh, const AnalysisOptions& options, BvhStats& stats)
+        : mbvh_(mbvh), options_(options), stats_(stats)
+    {}
+
+    bool analyze() {
+        stats_.node_count = mbvh_.nodes.size();
+        stats_.leaf_count = 0;
+        stats_.tri_refs = 0;
+        stats_.block_count = 0;
+        stats_.empty_slots = 0;
+        stats_.wasted_lanes = 0;
+        stats_.depth_histogram.clear();
+        stats_.leaf_histogram.clear();
+        if (mbvh_.nodes.empty()) return false;
+
+        elements_.emplace_back();
+        elements_[0].cost = 0.0f;
+        elements_[0].node = 0;
+        visited_.assign(mbvh_.nodes.size(), false);
+        if (!visit_node(0, 0, 0)) return false;
+
+        stats_.tri_count = tris_.size();
+        stats_.min_depth = stats_.max_depth = 0;
+        stats_.avg_depth = 0.0;
+        size_t depth_sum = 0;
+        for (size_t d = 0; d < stats_.depth_histogram.size(); d++) {
+            if (stats_.depth_histogram[d] == 0) continue;
+            if (stats_.min_depth == 0) stats_.min_depth = d;
+            stats_.max_depth = d;
+            depth_sum += d * stats_.depth_histogram[d];
+        }
+        if (stats_.leaf_count > 0) stats_.avg_depth = double(depth_sum) / stats_.leaf_count;
+
+        stats_.sah_cost = sah_cost(mbvh_, options_.costs);
+        stats_.epo = estimate_epo();
+        return true;
+    }
+
+private:
+    /// Inner node or leaf, numbered in depth-first order so that the elements of a subtree form a range
+    struct Element {
+        BBox bbox;
+        float cost;             // Cost of intersecting the element (not relative to the root)
+        int node;               // MBVH node of inner elements, -1 for leaves
+        int end;                // End of the range of the subtree
+    };
+
+    struct Triangle {
+        float3 v0, v1, v2;
+        float area;
+        std::vector<int> leaves;    // Elements of the leaves that contain the triangle
+    };
+
+    static BBox to_bbox(const mbvh::BBox& bb) {
+        return BBox(float3(bb.lx, bb.ly, bb.lz), float3(bb.ux, bb.uy, bb.uz));
+    }
+
+    bool visit_node(int index, int element, int depth) {
+        if (index < 0 || index >= (int)mbvh_.nodes.size() || visited_[index]) return false;
+        visited_[index] = true;
+
+        const mbvh::Node& node = mbvh_.nodes[index];
+        for (int j = 0; j < 4; j++) {
+            if (node.prim_count[j] == 0) {
+                stats_.empty_slots++;
+                continue;
+            }
+
+            const int child = elements_.size();
+            elements_.emplace_back();
+            elements_[child].bbox = to_bbox(node.bb[j]);
+            if (node.prim_count[j] < 0) {
+                elements_[child].cost = options_.costs.traversal;
+                elements_[child].node = node.children[j];
+                if (!visit_node(node.children[j], child, depth + 1)) return false;
+            } else {
+                elements_[child].node = -1;
+                elements_[child].end = child + 1;
+                if (!visit_leaf(node.children[j], node.prim_count[j], child, depth + 1)) return false;
+            }
+        }
+        elements_[element].end = elements_.size();
+        return true;
+    }
+
+    bool visit_leaf(int offset, int block_count, int element, int depth) {
+        if (offset < 0 || offset + 13 * (size_t)block_count > mbvh_.tris.size()) return false;
+
+        int count = 0;
+        for (int k = 0; k < block_count; k++) {
+            const float* data = (const float*)&mbvh_.tris[offset + 13 * k];
+            for (int i = 0; i < 4; i++) {
+                int32_t id;
+                memcpy(&id, data + 48 + i, sizeof(int32_t));
+                if (id < 0) {
+                    stats_.wasted_lanes++;
+                    continue;
+                }
+
+                auto it = tri_index_.find(id);
+                if (it == tri_index_.end()) {
+                    Triangle tri;
+                    const float3 v0(data[0 * 4 + i], data[1 * 4 + i], data[2 * 4 + i]);
+                    const float3 e1(data[3 * 4 + i], data[4 * 4 + i], data[5 * 4 + i]);
+                    const float3 e2(data[6 * 4 + i], data[7 * 4 + i], data[8 * 4 + i]);
+                    const float3 n(data[9 * 4 + i], data[10 * 4 + i], data[11 * 4 + i]);
+                    tri.v0 = v0;
+                    tri.v1 = v0 - e1;
+                    tri.v2 = v0 + e2;
+                    tri.area = 0.5f * std::sqrt(dot(n, n));
+                    it = tri_index_.emplace(id, tris_.size()).first;
+                    tris_.push_back(tri);
+                }
+                tris_[it->second].leaves.push_back(element);
+                count++;
+            }
+        }
+
+        elements_[element].cost = options_.costs.leaf_cost(block_count * options_.costs.leaf_block);
+        stats_.leaf_count++;
+        stats_.block_count += block_count;
+        stats_.tri_refs += count;
+        if (stats_.depth_histogram.size() <= (size_t)depth) stats_.depth_histogram.resize(depth + 1);
+        stats_.depth_histogram[depth]++;
+        if (stats_.leaf_histogram.size() <= (size_t)count) stats_.leaf_histogram.resize(count + 1);
+        stats_.leaf_histogram[count]++;
+        return true;
+    }
+
+    static bool contains(const BBox& bbox, const float3& p) {
+        return p.x >= bbox.min.x && p.y >= bbox.min.y && p.z >= bbox.min.z &&
+               p.x <= bbox.max.x && p.y <= bbox.max.y && p.z <= bbox.max.z;
+    }
+
+    /// Sum of the costs of the elements that contain the point, but not the triangle it lies on
+    double overlap_cost(const Triangle& tri, const float3& p) const {
+        double cost = 0.0;
+        std::vector<int> stack(1, 0);
+        while (!stack.empty()) {
+            const int parent = stack.back();
+            stack.pop_back();
+            for (int child = parent + 1; child < elements_[parent].end; child = elements_[child].end) {
+                const Element& element = elements_[child];
+                if (!contains(element.bbox, p)) continue;
+                const bool owns = std::any_of(tri.leaves.begin(), tri.leaves.end(), [&] (int leaf) {
+                    return leaf >= child && leaf < element.end;
+                });
+                if (!owns) cost += element.cost;
+                if (element.node >= 0) stack.push_back(child);
+            }
+        }
+        return cost;
+    }
+
+    float estimate_epo() const {
+        if (tris_.empty() || options_.epo_samples <= 0) return 0.0f;
+
+        // Triangles are sampled according to their area
+        std::vector<double> cdf(tris_.size());
+        double total_area = 0.0;
+        for (size_t i = 0; i < tris_.size(); i++) {
+            total_area += tris_[i].area;
+            cdf[i] = total_area;
+        }
+        if (total_area <= 0.0) return 0.0f;
+
+        const float root_area = to_bbox(mbvh_.header.scene_bb).half_area();
+        const int chunk_size = 4096;
+        const int chunk_count = (options_.epo_samples + chunk_size - 1) / chunk_size;
+        std::vector<double> sums(chunk_count, 0.0);
+        parallel_for(0, chunk_count, [&] (int chunk) {
+            std::mt19937 rng(options_.seed + chunk);
+            std::uniform_real_distribution<double> uniform(0.0, 1.0);
+            const int samples = std::min(chunk_size, options_.epo_samples - chunk * chunk_size);
+            for (int i = 0; i < samples; i++) {
+                const size_t t = std::min<size_t>(std::lower_bound(cdf.begin(), cdf.end(), uniform(rng) * total_area) - cdf.begin(), tris_.size() - 1);
+                const Triangle& tri = tris_[t];
+                float u = uniform(rng), v = uniform(rng);
+                if (u + v > 1.0f) {
+                    u = 1.0f - u;
+                    v = 1.0f - v;
+                }
+                const float3 p = tri.v0 + (tri.v1 - tri.v0) * u + (tri.v2 - tri.v0) * v;
+                sums[chunk] += overlap_cost(tri, p);
+            }
+        });
+
+        // Same normalization as the SAH cost: the costs of the nodes are weighted by the area of the
+        // triangles they overlap, relative to the area of the scene instead of the area of their own box
+        double sum = 0.0;
+        for (double s : sums) sum += s;
+        return root_area > 0.0f ? float(sum / options_.epo_samples * total_area / root_area) : 0.0f;
+    }
+
+    const Mbvh& mbvh_;
+    const AnalysisOptions& options_;
+    BvhStats& stats_;
+    std::vector<Element> elements_;
+    std::vector<bool> visited_;
+    std::vector<Triangle> tris_;
+    std::unordered_map<int32_t, int> tri_index_;
+};
+
+} // namespace
+
+bool analyze_mbvh(const Mbvh& mbvh, const AnalysisOptions& options, BvhStats& stats) {
+    Analyzer analyzer(mbvh, options, stats);
+    return analyzer.analyze();
+}
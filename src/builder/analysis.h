@@ -0,0 +1,39 @@
+#ifndef BUILDER_ANALYSIS_H
+#define BUILDER_ANALYSIS_H
+
+#include <vector>
+#include "mbvh.h"
+
+struct AnalysisOptions {
+    SahCosts costs;
+    int epo_samples;        // Number of points sampled on the triangles to estimate the EPO
+    unsigned seed;
+
+    AnalysisOptions()
+        : epo_samples(1 << 18), seed(1)
+    {}
+};
+
+/// Quality statistics of a 4-wide BVH
+struct BvhStats {
+    size_t node_count;
+    size_t leaf_count;
+    size_t tri_refs;                        // Triangles in the leaves, duplicates included
+    size_t tri_count;                       // Distinct triangles
+    size_t block_count;                     // Blocks of 4 triangles
+    size_t empty_slots;                     // Child slots of the nodes without child
+    size_t wasted_lanes;                    // Lanes of the triangle blocks without triangle
+    float sah_cost;                         // SAH cost, relative to the area of the scene
+    float epo;                              // End-point overlap: cost of the nodes that overlap triangles which are
+                                            // not in their subtree, relative to the area of the triangles
+    int min_depth, max_depth;               // Depth of the leaves (the children of the root are at depth 1)
+    double avg_depth;
+    std::vector<size_t> depth_histogram;    // Number of leaves at every depth
+    std::vector<size_t> leaf_histogram;     // Number of leaves for every number of triangles
+};
+
+/// Computes the statistics of an MBVH. The EPO is estimated by sampling points on the triangles.
+/// Returns false if the MBVH is invalid.
+bool analyze_mbvh(const Mbvh& mbvh, const AnalysisOptions& options, BvhStats& stats);
+
+#endif // BUILDER_ANALYSIS_H
@@ -0,0 +1,73 @@
+#ifndef BUILDER_BBOX_H
+#define BUILDER_BBOX_H
+
+#include <algorithm>
+#include <limits>
+#include <string>
+#include "../tools/linear.h"
+
+inline float3 min(const float3& a, const float3& b) {
+    return float3(std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z));
+}
+
+inline float3 max(const float3& a, const float3& b) {
+    return float3(std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z));
+}
+
+inline float component(const float3& v, int axis) {
+    return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+inline float& component(float3& v, int axis) {
+    return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+struct BBox {
+    float3 min, max;
+
+    BBox() {}
+    BBox(const float3& p) : min(p), max(p) {}
+    BBox(const float3& min, const float3& max) : min(min), max(max) {}
+
+    static BBox empty() {
+        const float inf = std::numeric_limits<float>::infinity();
+        return BBox(float3(inf, inf, inf), float3(-inf, -inf, -inf));
+    }
+
+    BBox& extend(const float3& p) {
+        min = ::min(min, p);
+        max = ::max(max, p);
+        return *this;
+    }
+
+    BBox& extend(const BBox& bb) {
+        min = ::min(min, bb.min);
+        max = ::max(max, bb.max);
+        return *this;
+    }
+
+    BBox& overlap(const BBox& bb) {
+        min = ::max(min, bb.min);
+        max = ::min(max, bb.max);
+        return *this;
+    }
+
+    bool is_empty() const {
+        return min.x > max.x || min.y > max.y || min.z > max.z;
+    }
+
+    float3 center() const { return (min + max) * 0.5f; }
+
+    float half_area() const {
+        if (is_empty()) return 0.0f;
+        const float3 e = max - min;
+        return e.x * e.y + e.y * e.z + e.z * e.x;
+    }
+
+    int largest_axis() const {
+        const float3 e = max - min;
+        return e.x >= e.y && e.x >= e.z ? 0 : (e.y >= e.z ? 1 : 2);
+    }
+};
+
+#endif // BUILDER_BBOX_H
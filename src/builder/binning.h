@@ -0,0 +1,84 @@
+#ifndef BUILDER_BINNING_H
+#define BUILDER_BINNING_H
+
+#include <vector>
+#include <limits>
+#include "bvh2.h"
+
+/// Nodes with more references are built in a new thread
+static const int task_threshold = 4096;
+/// Nodes with more references are binned in parallel
+static const int parallel_bin_threshold = 1 << 16;
+
+/// Bin of references, used by the builders to evaluate the splits
+struct Bin {
+    BBox bbox;
+    int count;
+
+    Bin() : bbox(BBox::empty()), count(0) {}
+
+    void add(const Bin& other) {
+        bbox.extend(other.bbox);
+        count += other.count;
+    }
+};
+
+/// Candidate split: the references of the bins before the split bin go to the left child.
+/// The cost is the sum of the areas of the children multiplied by their cost.
+struct BinSplit {
+    int axis;
+    int bin;
+    float cost;
+    BBox left_bbox, right_bbox;
+
+    BinSplit() : axis(-1), bin(0), cost(std::numeric_limits<float>::max()) {}
+
+    bool is_valid() const { return axis >= 0; }
+};
+
+inline int bin_index(float x, float lo, float hi, int bin_count) {
+    const float k = bin_count * (x - lo) / (hi - lo);
+    return std::min(std::max(int(k), 0), bin_count - 1);
+}
+
+/// Sweeps the bins of one axis from both sides to find the best split. The left and right
+/// counts of the bins are given separately, since a reference can be in several bins with spatial splits.
+inline void sweep_bins(const std::vector<Bin>& bins, const std::vector<int>& left_counts, const std::vector<int>& right_counts,
+                       int axis, const SahCosts& costs, BinSplit& best) {
+    const int bin_count = bins.size();
+    std::vector<float> right_costs(bin_count);
+    std::vector<BBox> right_bboxes(bin_count);
+    BBox right = BBox::empty();
+    int right_count = 0;
+    for (int i = bin_count - 1; i > 0; i--) {
+        right.extend(bins[i].bbox);
+        right_count += right_counts[i];
+        right_bboxes[i] = right;
+        right_costs[i] = right_count > 0 ? right.half_area() * costs.leaf_cost(right_count) : -1.0f;
+    }
+
+    BBox left = BBox::empty();
+    int left_count = 0;
+    for (int i = 0; i < bin_count - 1; i++) {
+        left.extend(bins[i].bbox);
+        left_count += left_counts[i];
+        if (left_count == 0 || right_costs[i + 1] < 0.0f) continue;
+        const float cost = left.half_area() * costs.leaf_cost(left_count) + right_costs[i + 1];
+        if (cost < best.cost) {
+            best.cost = cost;
+            best.axis = axis;
+            best.bin = i + 1;
+            best.left_bbox = left;
+            best.right_bbox = right_bboxes[i + 1];
+        }
+    }
+}
+
+/// Sweeps the bins of an object split, in which every reference is in exactly one bin.
+inline void sweep_bins(const std::vector<Bin>& bins, int axis, const SahCosts& costs, BinSplit& best) {
+    std::vector<int> counts(bins.size());
+    for (size_t i = 0; i < bins.size(); i++) counts[i] = bins[i].count;
+    sweep_bins(bins, counts, counts, axis, costs, best);
+}
+
+#endif // BUILDER_BINNING_H
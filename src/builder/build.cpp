@@ -0,0 +1,59 @@
+#include <chrono>
+#include <cmath>
+
+#include "build.h"
+#include "../frontend/parallel.h"
+#include "../frontend/convert_mbvh.h"
+
+std::vector<PrimRef> make_refs(const TriMesh& mesh) {
+    const int tri_count = mesh.tri_count();
+    std::vector<PrimRef> refs(tri_count);
+    std::vector<char> valid(tri_count);
+    parallel_for(0, (tri_count + 4095) / 4096, [&] (int chunk) {
+        for (int i = chunk * 4096, n = std::min(i + 4096, tri_count); i < n; i++) {
+            refs[i].bbox = mesh.tri_bbox(i);
+            refs[i].id = i;
+            const float3 e = refs[i].bbox.max - refs[i].bbox.min;
+            valid[i] = std::isfinite(e.x) && std::isfinite(e.y) && std::isfinite(e.z);
+        }
+    });
+
+    size_t count = 0;
+    for (int i = 0; i < tri_count; i++) {
+        if (valid[i]) refs[count++] = refs[i];
+    }
+    refs.resize(count);
+    return refs;
+}
+
+bool build_mbvh(const TriMesh& mesh, const BuildOptions& options, Mbvh& mbvh, BuildStats& stats) {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    std::vector<PrimRef> refs = make_refs(mesh);
+    if (refs.empty()) return false;
+    if (options.presplit.enabled) refs = presplit_refs(mesh, refs, options.presplit);
+
+    Bvh2 bvh = options.spatial.enabled
+        ? build_sbvh(mesh, std::move(refs), options.sah, options.spatial)
+        : build_sah(refs, options.sah);
+    mbvh = collapse_bvh(bvh, mesh, options.sah.costs);
+
+    auto end = std::chrono::high_resolution_clock::now();
+    stats.build_time = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.0;
+    stats.bvh2_cost = sah_cost(bvh, options.sah.costs);
+    stats.mbvh_cost = sah_cost(mbvh, options.sah.costs);
+    stats.ref_count = bvh.prim_ids.size();
+    return true;
+}
+
+bool build_cpu_bvh(const TriMesh& mesh, const BuildOptions& options,
+                   std::vector<cpu::Node>& nodes, std::vector<cpu::Vec4>& tris,
+                   BuildStats& stats) {
+    Mbvh mbvh;
+    if (!build_mbvh(mesh, options, mbvh, stats)) return false;
+
+    nodes.resize(mbvh.nodes.size());
+    tris.resize(cpu_vert_count(mbvh.nodes.data(), mbvh.nodes.size()));
+    convert_mbvh(mbvh.nodes.data(), mbvh.nodes.size(), (const float*)mbvh.tris.data(), nodes.data(), tris.data());
+    return true;
+}
@@ -0,0 +1,35 @@
+#ifndef BUILDER_BUILD_H
+#define BUILDER_BUILD_H
+
+#include "mesh.h"
+#include "mbvh.h"
+#include "sah_builder.h"
+#include "sbvh_builder.h"
+#include "presplit.h"
+
+struct BuildOptions {
+    SahOptions sah;
+    SpatialSplitOptions spatial;
+    PresplitOptions presplit;
+};
+
+struct BuildStats {
+    double build_time;      // Time spent building the BVH, in milliseconds
+    float bvh2_cost;        // SAH cost of the binary BVH
+    float mbvh_cost;        // SAH cost of the 4-wide BVH
+    size_t ref_count;       // Number of triangle references in the leaves (larger than the number of triangles with splits)
+};
+
+/// Returns a reference for every valid triangle of the mesh (degenerate triangles are kept, but not triangles
+/// with infinite or NaN coordinates).
+std::vector<PrimRef> make_refs(const TriMesh& mesh);
+
+/// Builds a 4-wide BVH for the given mesh, in the layout of MBVH blocks. Returns false if the mesh is empty.
+bool build_mbvh(const TriMesh& mesh, const BuildOptions& options, Mbvh& mbvh, BuildStats& stats);
+
+/// Builds a BVH for the given mesh, directly in the layout of the CPU kernels. Returns false if the mesh is empty.
+bool build_cpu_bvh(const TriMesh& mesh, const BuildOptions& options,
+                   std::vector<cpu::Node>& nodes, std::vector<cpu::Vec4>& tris,
+                   BuildStats& stats);
+
+#endif // BUILDER_BUILD_H
@@ -0,0 +1,42 @@
+#ifndef BUILDER_BVH2_H
+#define BUILDER_BVH2_H
+
+#include <vector>
+#include <cstdint>
+#include "bbox.h"
+
+/// Binary BVH, as produced by the builders. The root is the first node, and the two
+/// children of an inner node are stored next to each other, after their parent.
+struct Bvh2 {
+    struct Node {
+        BBox bbox;
+        int32_t child;          // Index of the first child, or of the first primitive for leaves
+        int32_t prim_count;     // Number of primitives, 0 for inner nodes
+
+        bool is_leaf() const { return prim_count > 0; }
+    };
+
+    std::vector<Node> nodes;
+    std::vector<int32_t> prim_ids;  // Triangle of every primitive reference
+};
+
+/// Costs used to evaluate the surface area heuristic. The kernels intersect
+/// the triangles of a leaf in blocks, so that partial blocks cost as much as full ones.
+struct SahCosts {
+    float traversal;
+    float intersection;
+    int leaf_block;
+
+    SahCosts(float traversal = 1.0f, float intersection = 1.0f, int leaf_block = 4)
+        : traversal(traversal), intersection(intersection), leaf_block(leaf_block)
+    {}
+
+    float leaf_cost(int prim_count) const {
+        return intersection * ((prim_count + leaf_block - 1) / leaf_block * leaf_block);
+    }
+};
+
+/// Returns the SAH cost of a binary BVH, relative to the area of its root.
+float sah_cost(const Bvh2& bvh, const SahCosts& costs);
+
+#endif // BUILDER_BVH2_H
@@ -0,0 +1,62 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+
+#include "cost_profile.h"
+
+bool read_cost_profile(const std::string& filename, SahCosts& costs) {
+    std::ifstream in(filename);
+    if (!in) return false;
+
+    std::string line;
+    int line_no = 0;
+    while (std::getline(in, line)) {
+        line_no++;
+        std::istringstream is(line);
+        std::string key, extra;
+        if (!(is >> key) || key[0] == '#') continue;
+
+        float value;
+        if (!(is >> value) || is >> extra || value <= 0.0f) {
+            std::cerr << "Invalid value on line " << line_no << " of the cost profile." << std::endl;
+            return false;
+        }
+
+        if (key == "traversal-cost") {
+            costs.traversal = value;
+        } else if (key == "intersection-cost") {
+            costs.intersection = value;
+        } else {
+            std::cerr << "Unknown setting '" << key << "' on line " << line_no << " of the cost profile." << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool load_cost_profile(const std::string& filename, const ArgParser& parser, SahCosts& costs) {
+    if (filename.empty()) return true;
+
+    SahCosts profile = costs;
+    if (!read_cost_profile(filename, profile)) {
+        std::cerr << "Cannot read cost profile." << std::endl;
+        return false;
+    }
+
+    if (!parser.given("traversal-cost")) costs.traversal = profile.traversal;
+    if (!parser.given("intersection-cost")) costs.intersection = profile.intersection;
+    return true;
+}
+
+bool write_cost_profile(const std::string& filename, const SahCosts& costs, const std::string& comment) {
+    std::ofstream out(filename);
+    if (!out) return false;
+
+    std::istringstream lines(comment);
+    std::string line;
+    while (std::getline(lines, line))
+        out << "# " << line << std::endl;
+    out << "traversal-cost " << costs.traversal << std::endl;
+    out << "intersection-cost " << costs.intersection << std::endl;
+    return bool(out);
+}
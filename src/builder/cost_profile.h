@@ -0,0 +1,23 @@
+#ifndef BUILDER_COST_PROFILE_H
+#define BUILDER_COST_PROFILE_H
+
+#include <string>
+#include "bvh2.h"
+#include "../frontend/options.h"
+
+/// Reads the SAH costs from a cost profile, as written by the calibration tool. The file has one setting per line:
+///     traversal-cost 2.5
+///     intersection-cost 1
+/// Empty lines and lines starting with '#' are ignored. Settings that are absent keep their value.
+/// Returns false if the file cannot be read or has an invalid line.
+bool read_cost_profile(const std::string& filename, SahCosts& costs);
+
+/// Reads the cost profile given to a tool, if the file name is not empty. The costs that are given explicitly on the
+/// command line (with the traversal-cost and intersection-cost options) take precedence over the ones of the profile.
+/// Prints an error and returns false if the profile cannot be read.
+bool load_cost_profile(const std::string& filename, const ArgParser& parser, SahCosts& costs);
+
+/// Writes a cost profile, with the given comment as a header. Returns false if the file cannot be written.
+bool write_cost_profile(const std::string& filename, const SahCosts& costs, const std::string& comment);
+
+#endif // BUILDER_COST_PROFILE_H
@@ -0,0 +1,102 @@
+#include <cstring>
+#include <deque>
+
+#include "gpu_bvh.h"
+#include "../frontend/compression.h"
+#include "../frontend/convert_mbvh.h"
+
+static BBox to_bbox(const float* bb) {
+    return BBox(float3(bb[0], bb[2], bb[4]), float3(bb[1], bb[3], bb[5]));
+}
+
+static bool convert_gpu_bvh(const bvh::Header& h, const bvh::GpuNode* nodes, const cpu::Vec4* tris, GpuBvh& gpu_bvh) {
+    if (h.node_count == 0) return false;
+
+    Bvh2& bvh = gpu_bvh.bvh;
+    bvh.nodes.clear();
+    bvh.prim_ids.clear();
+    gpu_bvh.mesh.vertices.clear();
+    gpu_bvh.mesh.indices.clear();
+    gpu_bvh.tri_ids.clear();
+
+    // Breadth-first, so that the children of every node are stored next to each other, after their parent
+    std::deque<std::pair<int32_t, int>> queue;
+    bvh.nodes.emplace_back();
+    bvh.nodes[0].bbox = to_bbox(nodes[0].left_bb).extend(to_bbox(nodes[0].right_bb));
+    queue.emplace_back(0, 0);
+    size_t inner_count = 0;
+    while (!queue.empty()) {
+        const int32_t ref = queue.front().first;
+        const int index = queue.front().second;
+        queue.pop_front();
+
+        if (ref >= 0) {
+            // The nodes form a tree, so that every node is visited once
+            if (ref >= (int32_t)h.node_count || ++inner_count > h.node_count) return false;
+            const bvh::GpuNode& node = nodes[ref];
+            const int child = bvh.nodes.size();
+            bvh.nodes.resize(child + 2);
+            bvh.nodes[child + 0].bbox = to_bbox(node.left_bb);
+            bvh.nodes[child + 1].bbox = to_bbox(node.right_bb);
+            bvh.nodes[index].child = child;
+            bvh.nodes[index].prim_count = 0;
+            queue.emplace_back(node.left, child + 0);
+            queue.emplace_back(node.right, child + 1);
+            continue;
+        }
+
+        const int first = bvh.prim_ids.size();
+        for (uint32_t i = ~ref; ; i += 3) {
+            if (i + 3 > h.prim_count) return false;
+            const int tri = gpu_bvh.tri_ids.size();
+            for (int j = 0; j < 3; j++) {
+                gpu_bvh.mesh.vertices.emplace_back(tris[i + j].x, tris[i + j].y, tris[i + j].z);
+                gpu_bvh.mesh.indices.push_back(tri * 3 + j);
+            }
+            int32_t id;
+            memcpy(&id, &tris[i + 1].w, sizeof(int32_t));
+            gpu_bvh.tri_ids.push_back(id);
+            bvh.prim_ids.push_back(tri);
+            if (is_leaf_end(tris[i + 2].w)) break;
+        }
+        bvh.nodes[index].child = first;
+        bvh.nodes[index].prim_count = bvh.prim_ids.size() - first;
+    }
+    return true;
+}
+
+bool read_gpu_bvh(const MappedFile& file, GpuBvh& gpu_bvh) {
+    if (auto ch = locate_compressed_block(file.data(), file.size(), BlockType::BVH)) {
+        bvh::Header h;
+        memcpy(&h, original_header(ch), sizeof(bvh::Header));
+        std::vector<bvh::GpuNode> nodes(h.node_count);
+        std::vector<cpu::Vec4> tris(h.prim_count);
+        const uint64_t nodes_size = sizeof(bvh::GpuNode) * h.node_count;
+        return decompress_block(file, ch, {
+                BlockSegment { sizeof(bvh::Header), nodes_size, nodes.data() },
+                BlockSegment { sizeof(bvh::Header) + nodes_size, sizeof(cpu::Vec4) * h.prim_count, tris.data() }
+            }) && convert_gpu_bvh(h, nodes.data(), tris.data(), gpu_bvh);
+    }
+
+    size_t size;
+    const char* block = locate_block(file.data(), file.size(), BlockType::BVH, &size);
+    if (!block || size < sizeof(bvh::Header)) return false;
+
+    bvh::Header h;
+    memcpy(&h, block, sizeof(bvh::Header));
+    if (size < sizeof(bvh::Header) + sizeof(bvh::GpuNode) * h.node_count + sizeof(cpu::Vec4) * h.prim_count)
+        return false;
+
+    const bvh::GpuNode* nodes = (const bvh::GpuNode*)(block + sizeof(bvh::Header));
+    const cpu::Vec4* tris = (const cpu::Vec4*)(nodes + h.node_count);
+    return convert_gpu_bvh(h, nodes, tris, gpu_bvh);
+}
+
+Mbvh collapse_gpu_bvh(const GpuBvh& gpu_bvh, const SahCosts& costs) {
+    return collapse_bvh(gpu_bvh.bvh, [&] (const int32_t* ids, int count, cpu::Vec4* dst) {
+        write_tri_block(gpu_bvh.mesh, ids, count, dst);
+        // The ids of the mesh are the positions of the triangles in the block, not the ids of the hits
+        for (int i = 0; i < count; i++)
+            memcpy((float*)dst + 48 + i, &gpu_bvh.tri_ids[ids[i]], sizeof(int32_t));
+    }, costs);
+}
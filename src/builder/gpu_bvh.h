@@ -0,0 +1,22 @@
+#ifndef BUILDER_GPU_BVH_H
+#define BUILDER_GPU_BVH_H
+
+#include <vector>
+#include "../frontend/mapped_file.h"
+#include "mbvh.h"
+
+/// Binary BVH of a BVH block, in the layout of the GPU kernels
+struct GpuBvh {
+    Bvh2 bvh;                       // The primitives are the triangles of the mesh below
+    TriMesh mesh;                   // Three vertices per triangle, in the order of the leaves
+    std::vector<int32_t> tri_ids;   // Id of every triangle, as reported in the hits
+};
+
+/// Reads the BVH block of a scene file, which may be compressed. Returns false if there is none, or if it is invalid.
+bool read_gpu_bvh(const MappedFile& file, GpuBvh& gpu_bvh);
+
+/// Collapses the binary BVH of a BVH block into a 4-wide BVH, so that the scene can be traversed on the CPU.
+/// The triangles keep their ids.
+Mbvh collapse_gpu_bvh(const GpuBvh& gpu_bvh, const SahCosts& costs = SahCosts());
+
+#endif // BUILDER_GPU_BVH_H
@@ -0,0 +1,279 @@
+#include <cstring>
+#include <algorithm>
+
+#include "mbvh.h"
+#include "../frontend/convert_mbvh.h"
+#include "../frontend/compression.h"
+
+static mbvh::BBox to_mbvh_bbox(const BBox& bb) {
+    mbvh::BBox res;
+    res.lx = bb.min.x; res.ly = bb.min.y; res.lz = bb.min.z;
+    res.ux = bb.max.x; res.uy = bb.max.y; res.uz = bb.max.z;
+    return res;
+}
+
+static BBox from_mbvh_bbox(const mbvh::BBox& bb) {
+    return BBox(float3(bb.lx, bb.ly, bb.lz), float3(bb.ux, bb.uy, bb.uz));
+}
+
+void write_tri_block(const TriMesh& mesh, const int32_t* ids, int count, cpu::Vec4* dst) {
+    float* data = (float*)dst;
+    memset(data, 0, sizeof(cpu::Vec4) * 13);
+    for (int i = 0; i < 4; i++) {
+        int32_t id = -1;
+        if (i < count) {
+            id = ids[i];
+            const float3& v0 = mesh.vertex(id, 0);
+            const float3 e1 = v0 - mesh.vertex(id, 1);
+            const float3 e2 = mesh.vertex(id, 2) - v0;
+            const float3 n = cross(e1, e2);
+            const float3 vecs[4] = { v0, e1, e2, n };
+            for (int j = 0; j < 4; j++) {
+                data[(j * 3 + 0) * 4 + i] = vecs[j].x;
+                data[(j * 3 + 1) * 4 + i] = vecs[j].y;
+                data[(j * 3 + 2) * 4 + i] = vecs[j].z;
+            }
+        }
+        memcpy(data + 48 + i, &id, sizeof(int32_t));
+    }
+    cpu::normalize_block_start(data);
+}
+
+namespace {
+
+class Collapser {
+public:
+    Collapser(const Bvh2& bvh, const TriBlockWriter& write_block, const SahCosts& costs, Mbvh& mbvh)
+        : bvh_(bvh), write_block_(write_block), costs_(costs), mbvh_(mbvh)
+    {}
+
+    void collapse() {
+        mbvh_.nodes.clear();
+        mbvh_.tris.clear();
+        compute_cuts();
+        if (bvh_.nodes[0].is_leaf()) {
+            // The root of the kernels is always an inner node
+            mbvh_.nodes.emplace_back();
+            fill_node(0, std::vector<int>(1, 0));
+        } else {
+            emit_node(0);
+        }
+
+        mbvh_.header.node_count = mbvh_.nodes.size();
+        mbvh_.header.vert_count = mbvh_.tris.size();
+        mbvh_.header.scene_bb = to_mbvh_bbox(bvh_.nodes[0].bbox);
+    }
+
+private:
+    static const int width = 4;
+
+    /// Best way to turn the subtree of a binary node into at most k children of a wide node, for every k
+    struct Cut {
+        float cost[width + 1];      // SAH cost of the subtree (not relative to the root)
+        int split[width + 1];       // Number of children taken from the left child, or 0 if the node is kept as one child
+    };
+
+    /// Finds the collapse with the lowest SAH cost by dynamic programming, from the leaves to the root.
+    /// A node either becomes a child of the wide node, or gives its slots to its own children.
+    void compute_cuts() {
+        cuts_.resize(bvh_.nodes.size());
+        wide_splits_.resize(bvh_.nodes.size());
+        // Children are stored after their parents, so going backwards visits the children first
+        for (int id = bvh_.nodes.size() - 1; id >= 0; id--) {
+            const Bvh2::Node& node = bvh_.nodes[id];
+            const float area = node.bbox.half_area();
+            Cut& cut = cuts_[id];
+            if (node.is_leaf()) {
+                for (int k = 1; k <= width; k++) {
+                    cut.cost[k] = area * costs_.leaf_cost(node.prim_count);
+                    cut.split[k] = 0;
+                }
+                continue;
+            }
+
+            const Cut& left = cuts_[node.child];
+            const Cut& right = cuts_[node.child + 1];
+            // Cost of the node as a wide node of its own
+            float wide_cost = std::numeric_limits<float>::max();
+            for (int i = 1; i < width; i++) {
+                const float cost = left.cost[i] + right.cost[width - i];
+                if (cost < wide_cost) {
+                    wide_cost = cost;
+                    wide_splits_[id] = i;
+                }
+            }
+            cut.cost[1] = area * costs_.traversal + wide_cost;
+            cut.split[1] = 0;
+
+            for (int k = 2; k <= width; k++) {
+                cut.cost[k] = cut.cost[1];
+                cut.split[k] = 0;
+                for (int i = 1; i < k; i++) {
+                    const float cost = left.cost[i] + right.cost[k - i];
+                    if (cost < cut.cost[k]) {
+                        cut.cost[k] = cost;
+                        cut.split[k] = i;
+                    }
+                }
+            }
+        }
+    }
+
+    void gather_children(int id, int k, std::vector<int>& children) const {
+        const int split = cuts_[id].split[k];
+        if (split == 0) {
+            children.push_back(id);
+        } else {
+            gather_children(bvh_.nodes[id].child, split, children);
+            gather_children(bvh_.nodes[id].child + 1, k - split, children);
+        }
+    }
+
+    int emit_node(int id) {
+        const int index = mbvh_.nodes.size();
+        mbvh_.nodes.emplace_back();
+
+        std::vector<int> children;
+        gather_children(bvh_.nodes[id].child, wide_splits_[id], children);
+        gather_children(bvh_.nodes[id].child + 1, width - wide_splits_[id], children);
+
+        fill_node(index, children);
+        return index;
+    }
+
+    void fill_node(int index, const std::vector<int>& children) {
+        for (int j = 0; j < 4; j++) {
+            int32_t child = 0, prim_count = 0;
+            mbvh::BBox bb = to_mbvh_bbox(BBox::empty());
+            if (j < (int)children.size()) {
+                const Bvh2::Node& node = bvh_.nodes[children[j]];
+                bb = to_mbvh_bbox(node.bbox);
+                if (node.is_leaf()) {
+                    // Several parts of a split triangle may end up in the same leaf
+                    std::vector<int32_t> ids;
+                    for (int k = 0; k < node.prim_count; k++) {
+                        const int32_t id = bvh_.prim_ids[node.child + k];
+                        if (std::find(ids.begin(), ids.end(), id) == ids.end()) ids.push_back(id);
+                    }
+
+                    const int id_count = ids.size();
+                    child = mbvh_.tris.size();
+                    prim_count = (id_count + 3) / 4;
+                    mbvh_.tris.resize(mbvh_.tris.size() + 13 * prim_count);
+                    for (int k = 0; k < prim_count; k++) {
+                        write_block_(&ids[k * 4], std::min(4, id_count - k * 4), &mbvh_.tris[child + 13 * k]);
+                    }
+                } else {
+                    child = emit_node(children[j]);
+                    prim_count = -1;
+                }
+            }
+            // The vector of nodes may have grown in emit_node()
+            mbvh::Node& dst = mbvh_.nodes[index];
+            dst.bb[j] = bb;
+            dst.children[j] = child;
+            dst.prim_count[j] = prim_count;
+        }
+    }
+
+    const Bvh2& bvh_;
+    const TriBlockWriter& write_block_;
+    const SahCosts& costs_;
+    Mbvh& mbvh_;
+    std::vector<Cut> cuts_;
+    std::vector<int> wide_splits_;
+};
+
+} // namespace
+
+Mbvh collapse_bvh(const Bvh2& bvh, const TriBlockWriter& write_block, const SahCosts& costs) {
+    Mbvh mbvh;
+    memset(&mbvh.header, 0, sizeof(mbvh::Header));
+    if (bvh.nodes.empty()) return mbvh;
+    Collapser collapser(bvh, write_block, costs, mbvh);
+    collapser.collapse();
+    return mbvh;
+}
+
+Mbvh collapse_bvh(const Bvh2& bvh, const TriMesh& mesh, const SahCosts& costs) {
+    return collapse_bvh(bvh, [&] (const int32_t* ids, int count, cpu::Vec4* dst) {
+        write_tri_block(mesh, ids, count, dst);
+    }, costs);
+}
+
+float sah_cost(const Mbvh& mbvh, const SahCosts& costs) {
+    const float root_area = from_mbvh_bbox(mbvh.header.scene_bb).half_area();
+    if (root_area <= 0.0f) return 0.0f;
+
+    // Every node is as expensive to traverse, whatever the number of children it has
+    float cost = 0.0f;
+    for (auto& node : mbvh.nodes) {
+        BBox bbox = BBox::empty();
+        for (int j = 0; j < 4; j++) {
+            if (node.prim_count[j] == 0) continue;
+            const BBox child = from_mbvh_bbox(node.bb[j]);
+            bbox.extend(child);
+            if (node.prim_count[j] > 0)
+                cost += child.half_area() / root_area * costs.leaf_cost(node.prim_count[j] * costs.leaf_block);
+        }
+        cost += bbox.half_area() / root_area * costs.traversal;
+    }
+    return cost;
+}
+
+bool read_mbvh(const MappedFile& file, Mbvh& mbvh) {
+    if (auto ch = locate_compressed_block(file.data(), file.size(), BlockType::MBVH)) {
+        std::vector<char> block(ch->block_size);
+        memcpy(block.data(), original_header(ch), ch->header_size);
+        return decompress_block(file, ch, { BlockSegment { ch->header_size, ch->block_size - ch->header_size, block.data() + ch->header_size } }) &&
+               read_mbvh(block.data(), block.size(), mbvh);
+    }
+
+    size_t size;
+    const char* block = locate_block(file.data(), file.size(), BlockType::MBVH, &size);
+    return block && read_mbvh(block, size, mbvh);
+}
+
+bool read_mbvh(const char* block, size_t size, Mbvh& mbvh) {
+    if (size < sizeof(mbvh::Header)) return false;
+    memcpy(&mbvh.header, block, sizeof(mbvh::Header));
+    if (size < sizeof(mbvh::Header) + sizeof(mbvh::Node) * mbvh.header.node_count + sizeof(cpu::Vec4) * mbvh.header.vert_count)
+        return false;
+
+    const mbvh::Node* nodes = (const mbvh::Node*)(block + sizeof(mbvh::Header));
+    const cpu::Vec4* tris = (const cpu::Vec4*)(nodes + mbvh.header.node_count);
+    mbvh.nodes.assign(nodes, nodes + mbvh.header.node_count);
+    mbvh.tris.assign(tris, tris + mbvh.header.vert_count);
+    return true;
+}
+
+std::vector<char> mbvh_block(const Mbvh& mbvh) {
+    std::vector<char> block(sizeof(mbvh::Header) + sizeof(mbvh::Node) * mbvh.nodes.size() + sizeof(cpu::Vec4) * mbvh.tris.size());
+    char* ptr = block.data();
+    memcpy(ptr, &mbvh.header, sizeof(mbvh::Header));
+    ptr += sizeof(mbvh::Header);
+    memcpy(ptr, mbvh.nodes.data(), sizeof(mbvh::Node) * mbvh.nodes.size());
+    ptr += sizeof(mbvh::Node) * mbvh.nodes.size();
+    memcpy(ptr, mbvh.tris.data(), sizeof(cpu::Vec4) * mbvh.tris.size());
+    return block;
+}
+
+std::vector<char> cpu_mbvh_block(const Mbvh& mbvh) {
+    std::vector<cpu::Node> nodes(mbvh.nodes.size());
+    std::vector<cpu::Vec4> tris(cpu_vert_count(mbvh.nodes.data(), mbvh.nodes.size()));
+    convert_mbvh(mbvh.nodes.data(), mbvh.nodes.size(), (const float*)mbvh.tris.data(), nodes.data(), tris.data());
+    std::vector<cpu::Vec4> repacked_tris;
+    repack_leaves(nodes.data(), nodes.size(), tris.data(), repacked_tris);
+
+    cpu::Header h;
+    h.node_count = nodes.size();
+    h.vert_count = repacked_tris.size();
+    h.pad[0] = h.pad[1] = 0;
+
+    std::vector<char> block(sizeof(cpu::Header) + sizeof(cpu::Node) * h.node_count + sizeof(cpu::Vec4) * h.vert_count);
+    char* ptr = block.data();
+    memcpy(ptr, &h, sizeof(cpu::Header));
+    memcpy(ptr + sizeof(cpu::Header), nodes.data(), sizeof(cpu::Node) * h.node_count);
+    memcpy(ptr + sizeof(cpu::Header) + sizeof(cpu::Node) * h.node_count, repacked_tris.data(), sizeof(cpu::Vec4) * h.vert_count);
+    return block;
+}
@@ -0,0 +1,48 @@
+#ifndef BUILDER_MBVH_H
+#define BUILDER_MBVH_H
+
+#include <vector>
+#include <functional>
+#include "../frontend/bvh_format.h"
+#include "../frontend/mapped_file.h"
+#include "bvh2.h"
+#include "mesh.h"
+
+/// 4-wide BVH, as stored in MBVH blocks. The leaves are made of blocks of 4 triangles
+/// in the layout of the CPU kernels (13 Vec4 per block, see mapping_cpu.impala).
+struct Mbvh {
+    mbvh::Header header;
+    std::vector<mbvh::Node> nodes;
+    std::vector<cpu::Vec4> tris;
+};
+
+/// Writes a block of up to 4 triangles of the mesh, with the given triangle ids, in the layout of the CPU kernels.
+void write_tri_block(const TriMesh& mesh, const int32_t* ids, int count, cpu::Vec4* dst);
+
+/// Writes a block of up to 4 triangles, given the primitive ids of a leaf, in the layout of the CPU kernels.
+typedef std::function<void (const int32_t* ids, int count, cpu::Vec4* dst)> TriBlockWriter;
+
+/// Collapses a binary BVH into a 4-wide BVH. The inner nodes of the binary BVH that are kept are chosen
+/// by dynamic programming, so that the SAH cost of the result is minimal for the leaves of the binary BVH.
+Mbvh collapse_bvh(const Bvh2& bvh, const TriBlockWriter& write_block, const SahCosts& costs = SahCosts());
+
+/// Collapses a binary BVH whose primitives are the triangles of the mesh.
+Mbvh collapse_bvh(const Bvh2& bvh, const TriMesh& mesh, const SahCosts& costs = SahCosts());
+
+/// Returns the SAH cost of an MBVH, relative to the area of the scene.
+float sah_cost(const Mbvh& mbvh, const SahCosts& costs);
+
+/// Reads the contents of an MBVH block. Returns false if the block is truncated.
+bool read_mbvh(const char* block, size_t size, Mbvh& mbvh);
+
+/// Reads the MBVH block of a scene file, which may be compressed. Returns false if there is none.
+bool read_mbvh(const MappedFile& file, Mbvh& mbvh);
+
+/// Returns the contents of an MBVH block.
+std::vector<char> mbvh_block(const Mbvh& mbvh);
+
+/// Converts an MBVH to the layout of the CPU kernels, as stored in CPU_MBVH blocks. Sibling leaves are re-packed
+/// (see repack_leaves).
+std::vector<char> cpu_mbvh_block(const Mbvh& mbvh);
+
+#endif // BUILDER_MBVH_H
@@ -0,0 +1,114 @@
+#include <fstream>
+#include <sstream>
+#include <cstring>
+
+#include "mesh.h"
+#include "../frontend/bvh_format.h"
+#include "../frontend/compression.h"
+#include "../frontend/mapped_file.h"
+
+static bool read_mesh_block(const MappedFile& file, TriMesh& mesh) {
+    std::vector<char> block;
+    if (auto ch = locate_compressed_block(file.data(), file.size(), BlockType::MESH)) {
+        block.resize(ch->block_size);
+        memcpy(block.data(), original_header(ch), ch->header_size);
+        if (!decompress_block(file, ch, { BlockSegment { ch->header_size, ch->block_size - ch->header_size, block.data() + ch->header_size } }))
+            return false;
+    } else {
+        size_t size;
+        const char* data = locate_block(file.data(), file.size(), BlockType::MESH, &size);
+        if (!data) return false;
+        block.assign(data, data + size);
+    }
+
+    mesh::Header h;
+    if (block.size() < sizeof(mesh::Header)) return false;
+    memcpy(&h, block.data(), sizeof(mesh::Header));
+    if (block.size() < sizeof(mesh::Header) + sizeof(float) * 4 * h.vert_count + sizeof(int32_t) * 3 * h.tri_count)
+        return false;
+
+    const float* vertices = (const float*)(block.data() + sizeof(mesh::Header));
+    const int32_t* indices = (const int32_t*)(vertices + 4 * h.vert_count);
+    mesh.vertices.resize(h.vert_count);
+    for (uint32_t i = 0; i < h.vert_count; i++)
+        mesh.vertices[i] = float3(vertices[i * 4 + 0], vertices[i * 4 + 1], vertices[i * 4 + 2]);
+    mesh.indices.assign(indices, indices + 3 * h.tri_count);
+    return true;
+}
+
+static bool read_obj(std::istream& in, TriMesh& mesh) {
+    std::string line;
+    std::vector<int32_t> face;
+    while (std::getline(in, line)) {
+        std::istringstream is(line);
+        std::string cmd;
+        if (!(is >> cmd)) continue;
+
+        if (cmd == "v") {
+            float3 v;
+            if (!(is >> v.x >> v.y >> v.z)) return false;
+            mesh.vertices.push_back(v);
+        } else if (cmd == "f") {
+            // Faces are triangulated as fans, texture coordinates and normals are ignored
+            face.clear();
+            std::string vert;
+            while (is >> vert) {
+                int32_t index = std::strtol(vert.c_str(), nullptr, 10);
+                if (index < 0) index += mesh.vertices.size();
+                else index--;
+                if (index < 0 || index >= (int32_t)mesh.vertices.size()) return false;
+                face.push_back(index);
+            }
+            for (size_t i = 2; i < face.size(); i++) {
+                mesh.indices.push_back(face[0]);
+                mesh.indices.push_back(face[i - 1]);
+                mesh.indices.push_back(face[i]);
+            }
+        }
+    }
+    return true;
+}
+
+bool read_mesh(const std::string& filename, TriMesh& mesh) {
+    mesh.vertices.clear();
+    mesh.indices.clear();
+
+    MappedFile file;
+    if (!file.open(filename)) return false;
+    if (check_header(file.data(), file.size()))
+        return read_mesh_block(file, mesh);
+
+    const std::string ext = filename.substr(filename.find_last_of('.') + 1);
+    if (ext == "obj") {
+        std::istringstream in(std::string(file.data(), file.size()));
+        return read_obj(in, mesh);
+    }
+
+    // Raw triangles, without any sharing of vertices
+    if (file.size() % (sizeof(float) * 9) != 0) return false;
+    const size_t tri_count = file.size() / (sizeof(float) * 9);
+    mesh.vertices.resize(tri_count * 3);
+    memcpy(mesh.vertices.data(), file.data(), file.size());
+    mesh.indices.resize(tri_count * 3);
+    for (size_t i = 0; i < tri_count * 3; i++) mesh.indices[i] = i;
+    return true;
+}
+
+std::vector<char> mesh_block(const TriMesh& mesh) {
+    mesh::Header h;
+    h.vert_count = mesh.vertices.size();
+    h.index_count = mesh.indices.size();
+    h.tri_count = mesh.tri_count();
+
+    std::vector<char> block(sizeof(mesh::Header) + sizeof(float) * 4 * h.vert_count + sizeof(int32_t) * mesh.indices.size());
+    memcpy(block.data(), &h, sizeof(mesh::Header));
+    float* vertices = (float*)(block.data() + sizeof(mesh::Header));
+    for (size_t i = 0; i < mesh.vertices.size(); i++) {
+        vertices[i * 4 + 0] = mesh.vertices[i].x;
+        vertices[i * 4 + 1] = mesh.vertices[i].y;
+        vertices[i * 4 + 2] = mesh.vertices[i].z;
+        vertices[i * 4 + 3] = 1.0f;
+    }
+    memcpy(vertices + 4 * h.vert_count, mesh.indices.data(), sizeof(int32_t) * mesh.indices.size());
+    return block;
+}
@@ -0,0 +1,30 @@
+#ifndef BUILDER_MESH_H
+#define BUILDER_MESH_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "bbox.h"
+
+/// Indexed triangle mesh, as stored in the MESH block of scene files
+struct TriMesh {
+    std::vector<float3> vertices;
+    std::vector<int32_t> indices;
+
+    size_t tri_count() const { return indices.size() / 3; }
+
+    const float3& vertex(size_t tri, int i) const { return vertices[indices[tri * 3 + i]]; }
+
+    BBox tri_bbox(size_t tri) const {
+        return BBox(vertex(tri, 0)).extend(vertex(tri, 1)).extend(vertex(tri, 2));
+    }
+};
+
+/// Reads a mesh from a scene file (MESH block), a Wavefront OBJ file, or a raw list of
+/// triangles (9 floats per triangle). Returns false if the file cannot be read.
+bool read_mesh(const std::string& filename, TriMesh& mesh);
+
+/// Returns the contents of a MESH block for the given mesh.
+std::vector<char> mesh_block(const TriMesh& mesh);
+
+#endif // BUILDER_MESH_H
@@ -0,0 +1,354 @@
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+
+#include "optimizer.h"
+#include "../frontend/parallel.h"
+
+namespace {
+
+/// Triangle of an MBVH leaf, as stored in one lane of a block (vertex, edges and normal)
+struct TriRecord {
+    float data[12];
+    int32_t id;
+};
+
+class Optimizer {
+public:
+    Optimizer(const OptimizerOptions& options)
+        : options_(options), start_(std::chrono::steady_clock::now()), treelets_(0)
+    {}
+
+    bool load(const Mbvh& mbvh) {
+        mbvh_ = &mbvh;
+        if (mbvh.nodes.empty()) return false;
+        root_ = load_node(0, 0);
+        return root_ >= 0;
+    }
+
+    /// Runs passes over the tree until the cost does not improve anymore, or the time is up
+    int optimize() {
+        int passes = 0;
+        float cost = update_costs(root_);
+        // The first pass only rotates nodes, which is much faster than restructuring large treelets
+        for (int size = std::min(3, options_.treelet_size); !time_is_up(); size = options_.treelet_size) {
+            restructure_tree(size);
+            passes++;
+            const float new_cost = update_costs(root_);
+            if (size == options_.treelet_size && new_cost > cost * (1.0f - 1e-4f)) break;
+            cost = new_cost;
+        }
+        return passes;
+    }
+
+    Mbvh collapse() const {
+        Bvh2 bvh;
+        bvh.nodes.emplace_back();
+        emit_node(root_, 0, bvh);
+        return collapse_bvh(bvh, [&] (const int32_t* ids, int count, cpu::Vec4* dst) {
+            float* data = (float*)dst;
+            memset(data, 0, sizeof(cpu::Vec4) * 13);
+            for (int i = 0; i < 4; i++) {
+                int32_t id = -1;
+                if (i < count) {
+                    const TriRecord& tri = tris_[ids[i]];
+                    for (int j = 0; j < 12; j++) data[j * 4 + i] = tri.data[j];
+                    id = tri.id;
+                }
+                memcpy(data + 48 + i, &id, sizeof(int32_t));
+            }
+            cpu::normalize_block_start(data);
+        }, options_.costs);
+    }
+
+    int treelets() const { return treelets_; }
+
+private:
+    struct Node {
+        BBox bbox;
+        int left, right;        // Children of inner nodes
+        int first, count;       // Triangles of leaves (count > 0)
+        float cost;             // SAH cost of the subtree (not relative to the root)
+
+        bool is_leaf() const { return count > 0; }
+    };
+
+    static BBox to_bbox(const mbvh::BBox& bb) {
+        return BBox(float3(bb.lx, bb.ly, bb.lz), float3(bb.ux, bb.uy, bb.uz));
+    }
+
+    bool time_is_up() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count() >= options_.time_budget;
+    }
+
+    /// Turns an MBVH node into a binary subtree, by merging the pair of children with the smallest box first
+    int load_node(int index, int depth) {
+        if (index < 0 || index >= (int)mbvh_->nodes.size() || depth > 256) return -1;
+        const mbvh::Node& src = mbvh_->nodes[index];
+
+        std::vector<int> children;
+        for (int j = 0; j < 4; j++) {
+            int child = -1;
+            if (src.prim_count[j] < 0) {
+                child = load_node(src.children[j], depth + 1);
+                if (child < 0) return -1;
+            } else if (src.prim_count[j] > 0) {
+                child = load_leaf(src.children[j], src.prim_count[j], to_bbox(src.bb[j]));
+                if (child < 0) return -1;
+            }
+            if (child >= 0) children.push_back(child);
+        }
+        if (children.empty()) return -1;
+
+        while (children.size() > 1) {
+            int best_i = 0, best_j = 1;
+            float best_area = std::numeric_limits<float>::max();
+            for (size_t i = 0; i < children.size(); i++) {
+                for (size_t j = i + 1; j < children.size(); j++) {
+                    const float area = BBox(nodes_[children[i]].bbox).extend(nodes_[children[j]].bbox).half_area();
+                    if (area < best_area) {
+                        best_area = area;
+                        best_i = i;
+                        best_j = j;
+                    }
+                }
+            }
+
+            Node node;
+            node.left = children[best_i];
+            node.right = children[best_j];
+            node.bbox = BBox(nodes_[node.left].bbox).extend(nodes_[node.right].bbox);
+            node.count = 0;
+            nodes_.push_back(node);
+            children.erase(children.begin() + best_j);
+            children[best_i] = nodes_.size() - 1;
+        }
+        return children[0];
+    }
+
+    int load_leaf(int offset, int block_count, const BBox& bbox) {
+        if (offset < 0 || offset + 13 * (size_t)block_count > mbvh_->tris.size()) return -1;
+
+        Node node;
+        node.bbox = bbox;
+        node.first = tris_.size();
+        for (int k = 0; k < block_count; k++) {
+            const float* data = (const float*)&mbvh_->tris[offset + 13 * k];
+            for (int i = 0; i < 4; i++) {
+                TriRecord tri;
+                memcpy(&tri.id, data + 48 + i, sizeof(int32_t));
+                // Lanes without triangle have an id of -1
+                if (tri.id < 0) continue;
+                for (int j = 0; j < 12; j++) tri.data[j] = data[j * 4 + i];
+                tris_.push_back(tri);
+            }
+        }
+        node.count = tris_.size() - node.first;
+        if (node.count == 0) return -1;
+        nodes_.push_back(node);
+        return nodes_.size() - 1;
+    }
+
+    float update_costs(int root) {
+        for (int id : post_order(root)) update_cost(id);
+        return nodes_[root].cost;
+    }
+
+    void update_cost(int id) {
+        Node& node = nodes_[id];
+        const float area = node.bbox.half_area();
+        node.cost = node.is_leaf()
+            ? area * options_.costs.leaf_cost(node.count)
+            : area * options_.costs.traversal + nodes_[node.left].cost + nodes_[node.right].cost;
+    }
+
+    std::vector<int> post_order(int root) const {
+        std::vector<int> order, stack(1, root);
+        while (!stack.empty()) {
+            const int id = stack.back();
+            stack.pop_back();
+            order.push_back(id);
+            if (!nodes_[id].is_leaf()) {
+                stack.push_back(nodes_[id].left);
+                stack.push_back(nodes_[id].right);
+            }
+        }
+        // Parents come after their children
+        std::reverse(order.begin(), order.end());
+        return order;
+    }
+
+    /// Restructures the treelets of every node, from the bottom of the tree to the top. The subtrees
+    /// below the top of the tree are independent, and are processed in parallel.
+    void restructure_tree(int size) {
+        std::vector<int> subtree_sizes(nodes_.size(), 1);
+        for (int id : post_order(root_)) {
+            if (!nodes_[id].is_leaf())
+                subtree_sizes[id] += subtree_sizes[nodes_[id].left] + subtree_sizes[nodes_[id].right];
+        }
+
+        const int task_size = std::max(subtree_sizes[root_] / (16 * std::max<int>(std::thread::hardware_concurrency(), 1)), 1024);
+        std::vector<int> tasks, top, stack(1, root_);
+        while (!stack.empty()) {
+            const int id = stack.back();
+            stack.pop_back();
+            if (nodes_[id].is_leaf() || subtree_sizes[id] <= task_size) {
+                tasks.push_back(id);
+            } else {
+                top.push_back(id);
+                stack.push_back(nodes_[id].left);
+                stack.push_back(nodes_[id].right);
+            }
+        }
+
+        parallel_for(0, tasks.size(), [&] (int i) {
+            for (int id : post_order(tasks[i])) {
+                if (time_is_up()) return;
+                restructure_node(id, size);
+            }
+        });
+
+        std::reverse(top.begin(), top.end());
+        for (int id : top) {
+            if (time_is_up()) return;
+            restructure_node(id, size);
+        }
+    }
+
+    /// Replaces the treelet below the node by the topology with the lowest SAH cost, found by dynamic programming
+    /// over the subsets of its leaves. The inner nodes of the treelet are reused for the new topology.
+    void restructure_node(int root, int size) {
+        Node& node = nodes_[root];
+        if (node.is_leaf()) return;
+        update_cost(root);
+
+        // Grow the treelet by opening the inner leaf with the largest area
+        int leaves[8] = { node.left, node.right };
+        int inner[8] = { root };
+        int leaf_count = 2, inner_count = 1;
+        while (leaf_count < size) {
+            int best = -1;
+            float best_area = -1.0f;
+            for (int i = 0; i < leaf_count; i++) {
+                const Node& leaf = nodes_[leaves[i]];
+                if (!leaf.is_leaf() && leaf.bbox.half_area() > best_area) {
+                    best = i;
+                    best_area = leaf.bbox.half_area();
+                }
+            }
+            if (best < 0) break;
+
+            const Node& opened = nodes_[leaves[best]];
+            inner[inner_count++] = leaves[best];
+            leaves[best] = opened.left;
+            leaves[leaf_count++] = opened.right;
+        }
+        if (leaf_count < 3) return;
+
+        const int set_count = 1 << leaf_count;
+        float areas[256], costs[256];
+        int splits[256];
+        for (int s = 1; s < set_count; s++) {
+            BBox bbox = BBox::empty();
+            for (int i = 0; i < leaf_count; i++) {
+                if (s & (1 << i)) bbox.extend(nodes_[leaves[i]].bbox);
+            }
+            areas[s] = bbox.half_area();
+        }
+        for (int i = 0; i < leaf_count; i++) costs[1 << i] = nodes_[leaves[i]].cost;
+
+        // Sets are processed by increasing size, so that the costs of their subsets are known
+        for (int bits = 2; bits <= leaf_count; bits++) {
+            for (int s = 1; s < set_count; s++) {
+                if (__builtin_popcount(s) != bits) continue;
+                // Every partition is evaluated once, with the lowest leaf on the left
+                const int lowest = s & -s;
+                float best_cost = std::numeric_limits<float>::max();
+                int best_split = 0;
+                for (int p = (s - 1) & s; p > 0; p = (p - 1) & s) {
+                    if (!(p & lowest)) continue;
+                    const float cost = costs[p] + costs[s ^ p];
+                    if (cost < best_cost) {
+                        best_cost = cost;
+                        best_split = p;
+                    }
+                }
+                costs[s] = areas[s] * options_.costs.traversal + best_cost;
+                splits[s] = best_split;
+            }
+        }
+
+        const int all = set_count - 1;
+        if (costs[all] >= node.cost * (1.0f - 1e-5f)) return;
+
+        int next_inner = 0;
+        rebuild(all, leaves, inner, next_inner, areas, costs, splits);
+        treelets_++;
+    }
+
+    int rebuild(int s, const int* leaves, const int* inner, int& next_inner,
+                const float* areas, const float* costs, const int* splits) {
+        if ((s & (s - 1)) == 0) return leaves[__builtin_ctz(s)];
+
+        const int id = inner[next_inner++];
+        const int left = rebuild(splits[s], leaves, inner, next_inner, areas, costs, splits);
+        const int right = rebuild(s ^ splits[s], leaves, inner, next_inner, areas, costs, splits);
+        Node& node = nodes_[id];
+        node.left = left;
+        node.right = right;
+        node.bbox = BBox(nodes_[left].bbox).extend(nodes_[right].bbox);
+        node.cost = costs[s];
+        return id;
+    }
+
+    void emit_node(int id, int index, Bvh2& bvh) const {
+        const Node& node = nodes_[id];
+        bvh.nodes[index].bbox = node.bbox;
+        if (node.is_leaf()) {
+            bvh.nodes[index].child = bvh.prim_ids.size();
+            bvh.nodes[index].prim_count = node.count;
+            for (int i = 0; i < node.count; i++) bvh.prim_ids.push_back(node.first + i);
+            return;
+        }
+
+        const int child = bvh.nodes.size();
+        bvh.nodes.resize(child + 2);
+        bvh.nodes[index].child = child;
+        bvh.nodes[index].prim_count = 0;
+        emit_node(node.left, child, bvh);
+        emit_node(node.right, child + 1, bvh);
+    }
+
+    const OptimizerOptions& options_;
+    const Mbvh* mbvh_;
+    std::chrono::steady_clock::time_point start_;
+    std::vector<Node> nodes_;
+    std::vector<TriRecord> tris_;
+    int root_;
+    std::atomic<int> treelets_;
+};
+
+} // namespace
+
+bool optimize_mbvh(Mbvh& mbvh, const OptimizerOptions& options, OptimizerStats& stats) {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    Optimizer optimizer(options);
+    if (!optimizer.load(mbvh)) return false;
+    stats.passes = optimizer.optimize();
+    stats.treelets = optimizer.treelets();
+
+    Mbvh result = optimizer.collapse();
+    result.header.scene_bb = mbvh.header.scene_bb;
+    stats.cost_before = sah_cost(mbvh, options.costs);
+    stats.cost_after = sah_cost(result, options.costs);
+    if (stats.cost_after < stats.cost_before)
+        mbvh = std::move(result);
+    else
+        stats.cost_after = stats.cost_before;
+
+    auto end = std::chrono::high_resolution_clock::now();
+    stats.time = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.0;
+    return true;
+}
@@ -0,0 +1,30 @@
+#ifndef BUILDER_OPTIMIZER_H
+#define BUILDER_OPTIMIZER_H
+
+#include "mbvh.h"
+
+struct OptimizerOptions {
+    SahCosts costs;
+    int treelet_size;       // Number of leaves of the restructured treelets (3 to 8)
+    double time_budget;     // Maximum time spent optimizing, in seconds
+
+    OptimizerOptions()
+        : treelet_size(7), time_budget(10.0)
+    {}
+};
+
+struct OptimizerStats {
+    double time;            // Time spent optimizing, in milliseconds
+    float cost_before;      // SAH cost of the MBVH before and after the optimization
+    float cost_after;
+    int passes;             // Number of passes over the tree
+    int treelets;           // Number of treelets that have been restructured
+};
+
+/// Improves the SAH cost of an existing MBVH, without the original mesh. The MBVH is turned into a binary BVH whose leaves
+/// are the leaves of the MBVH, which is optimized with rotations and treelet restructuring on all the cores, and collapsed
+/// again. The triangle data is copied as is, so that the hits do not change. The MBVH is left untouched if the SAH cost
+/// does not improve. Returns false if the MBVH is invalid.
+bool optimize_mbvh(Mbvh& mbvh, const OptimizerOptions& options, OptimizerStats& stats);
+
+#endif // BUILDER_OPTIMIZER_H
@@ -0,0 +1,112 @@
+#include <cmath>
+#include <algorithm>
+
+#include "presplit.h"
+#include "../frontend/parallel.h"
+
+void split_ref(const TriMesh& mesh, const PrimRef& ref, int axis, float plane, BBox& left, BBox& right) {
+    left = BBox::empty();
+    right = BBox::empty();
+    for (int i = 0; i < 3; i++) {
+        const float3& a = mesh.vertex(ref.id, i);
+        const float3& b = mesh.vertex(ref.id, (i + 1) % 3);
+        const float pa = component(a, axis);
+        const float pb = component(b, axis);
+        if (pa <= plane) left.extend(a);
+        if (pa >= plane) right.extend(a);
+        if ((pa < plane && pb > plane) || (pa > plane && pb < plane)) {
+            float3 p = a + (b - a) * ((plane - pa) / (pb - pa));
+            component(p, axis) = plane;
+            left.extend(p);
+            right.extend(p);
+        }
+    }
+
+    // The reference may already be a part of the triangle
+    left.overlap(ref.bbox);
+    right.overlap(ref.bbox);
+    component(left.max, axis) = std::min(component(left.max, axis), plane);
+    component(right.min, axis) = std::max(component(right.min, axis), plane);
+}
+
+/// Area of the box of a reference that is not covered by its triangle. A triangle covers at most half
+/// of a face of its box, which is why its area counts twice (the length of the normal is twice the area).
+static float wasted_area(const TriMesh& mesh, const PrimRef& ref) {
+    const float3& v0 = mesh.vertex(ref.id, 0);
+    const float3 n = cross(mesh.vertex(ref.id, 1) - v0, mesh.vertex(ref.id, 2) - v0);
+    return std::max(ref.bbox.half_area() - std::sqrt(dot(n, n)), 0.0f);
+}
+
+/// Splits a reference recursively in the middle of the largest axis of its box. Returns the number of parts.
+static int split_recursive(const TriMesh& mesh, const PrimRef& ref, int splits, PrimRef* out) {
+    if (splits == 0) {
+        out[0] = ref;
+        return 1;
+    }
+
+    const int axis = ref.bbox.largest_axis();
+    PrimRef left = ref, right = ref;
+    split_ref(mesh, ref, axis, component(ref.bbox.center(), axis), left.bbox, right.bbox);
+    if (left.bbox.is_empty() || right.bbox.is_empty()) {
+        out[0] = ref;
+        return 1;
+    }
+
+    // The remaining splits go to the parts in proportion to their area
+    const float left_area = left.bbox.half_area();
+    const float right_area = right.bbox.half_area();
+    const float total_area = left_area + right_area;
+    const int left_splits = total_area > 0.0f ? std::lround((splits - 1) * left_area / total_area) : (splits - 1) / 2;
+    const int count = split_recursive(mesh, left, left_splits, out);
+    return count + split_recursive(mesh, right, splits - 1 - left_splits, out + count);
+}
+
+std::vector<PrimRef> presplit_refs(const TriMesh& mesh, const std::vector<PrimRef>& refs, const PresplitOptions& options) {
+    const int count = refs.size();
+    const int max_splits = options.budget * count;
+    if (count == 0 || max_splits <= 0) return refs;
+
+    // The cube root of the wasted area spreads the splits over more triangles than the area itself
+    std::vector<float> priorities(count);
+    parallel_for(0, (count + 4095) / 4096, [&] (int chunk) {
+        for (int i = chunk * 4096, n = std::min(i + 4096, count); i < n; i++)
+            priorities[i] = std::cbrt(wasted_area(mesh, refs[i]));
+    });
+
+    // Find the scale of the priorities that uses as much of the budget as possible
+    auto total_splits = [&] (double scale) {
+        int64_t total = 0;
+        for (float p : priorities) total += int64_t(scale * p);
+        return total;
+    };
+    double max_priority = *std::max_element(priorities.begin(), priorities.end());
+    if (max_priority <= 0.0) return refs;
+    // At the upper bound, the triangle with the highest priority alone exceeds the budget
+    double lo = 0.0, hi = (max_splits + 1) / max_priority;
+    for (int i = 0; i < 32; i++) {
+        const double mid = (lo + hi) * 0.5;
+        if (total_splits(mid) <= max_splits) lo = mid; else hi = mid;
+    }
+
+    std::vector<int> splits(count), offsets(count + 1);
+    offsets[0] = 0;
+    for (int i = 0; i < count; i++) {
+        splits[i] = int(lo * priorities[i]);
+        offsets[i + 1] = offsets[i] + splits[i] + 1;
+    }
+
+    std::vector<PrimRef> parts(offsets[count]);
+    std::vector<int> part_counts(count);
+    parallel_for(0, (count + 4095) / 4096, [&] (int chunk) {
+        for (int i = chunk * 4096, n = std::min(i + 4096, count); i < n; i++)
+            part_counts[i] = split_recursive(mesh, refs[i], splits[i], &parts[offsets[i]]);
+    });
+
+    // Splits can fail when a part only touches the plane, which leaves holes in the array
+    size_t size = 0;
+    for (int i = 0; i < count; i++) {
+        for (int j = 0; j < part_counts[i]; j++) parts[size++] = parts[offsets[i] + j];
+    }
+    parts.resize(size);
+    return parts;
+}
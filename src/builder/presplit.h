@@ -0,0 +1,26 @@
+#ifndef BUILDER_PRESPLIT_H
+#define BUILDER_PRESPLIT_H
+
+#include <vector>
+#include "mesh.h"
+#include "sah_builder.h"
+
+struct PresplitOptions {
+    bool enabled;
+    float budget;           // Maximum number of additional references, relative to the number of triangles
+
+    PresplitOptions()
+        : enabled(false), budget(0.3f)
+    {}
+};
+
+/// Splits a reference with an axis-aligned plane, by clipping its triangle on both sides of the plane.
+/// The resulting boxes are empty when the reference lies entirely on the other side.
+void split_ref(const TriMesh& mesh, const PrimRef& ref, int axis, float plane, BBox& left, BBox& right);
+
+/// Splits the references whose box is much larger than their triangle before the BVH is built, so that any builder
+/// gets tighter boxes. The budget is distributed among the triangles according to the area wasted by their box, and
+/// every triangle is then split recursively in the middle of its box. All the parts keep the id of their triangle.
+std::vector<PrimRef> presplit_refs(const TriMesh& mesh, const std::vector<PrimRef>& refs, const PresplitOptions& options);
+
+#endif // BUILDER_PRESPLIT_H
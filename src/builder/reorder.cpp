@@ -0,0 +1,317 @@
+#include <cstring>
+#include <mutex>
+#include <queue>
+#include <algorithm>
+
+#include "reorder.h"
+#include "../frontend/convert_mbvh.h"
+#include "../frontend/parallel.h"
+
+// Nodes visited by less than this fraction of the rays that visit the root are not part of the hot layout
+static const uint64_t hot_ratio = 64;
+
+bool parse_node_layout(const std::string& name, NodeLayout& layout) {
+    if (name == "depth-first") layout = NodeLayout::DEPTH_FIRST;
+    else if (name == "veb")    layout = NodeLayout::VAN_EMDE_BOAS;
+    else if (name == "hot")    layout = NodeLayout::HOT_FIRST;
+    else return false;
+    return true;
+}
+
+namespace {
+
+class Reorderer {
+public:
+    Reorderer(const Mbvh& mbvh, const std::vector<uint64_t>& visits)
+        : mbvh_(mbvh), visits_(visits)
+    {}
+
+    /// Checks that the nodes form a tree whose leaves are in the triangle array, and computes the height of every subtree
+    bool check() {
+        const size_t node_count = mbvh_.nodes.size();
+        if (node_count == 0) return false;
+
+        // Parents come before their children in this order, whatever the layout of the tree
+        std::vector<bool> visited(node_count, false);
+        std::vector<int> preorder, stack(1, 0);
+        visited[0] = true;
+        while (!stack.empty()) {
+            const int index = stack.back();
+            stack.pop_back();
+            preorder.push_back(index);
+            const mbvh::Node& node = mbvh_.nodes[index];
+            for (int j = 0; j < 4; j++) {
+                const int32_t child = node.children[j];
+                if (node.prim_count[j] < 0) {
+                    if (child <= 0 || (size_t)child >= node_count || visited[child]) return false;
+                    visited[child] = true;
+                    stack.push_back(child);
+                } else if (node.prim_count[j] > 0) {
+                    if (child < 0 || (size_t)child + 13 * node.prim_count[j] > mbvh_.tris.size()) return false;
+                }
+            }
+        }
+        if (preorder.size() != node_count) return false;
+
+        heights_.assign(node_count, 1);
+        for (auto it = preorder.rbegin(); it != preorder.rend(); ++it) {
+            const mbvh::Node& node = mbvh_.nodes[*it];
+            for (int j = 0; j < 4; j++) {
+                if (node.prim_count[j] < 0)
+                    heights_[*it] = std::max(heights_[*it], heights_[node.children[j]] + 1);
+            }
+        }
+        return true;
+    }
+
+    /// Returns the current indices of the nodes, in their new order
+    std::vector<int> order(NodeLayout layout) const {
+        std::vector<int> order;
+        order.reserve(mbvh_.nodes.size());
+        switch (layout) {
+            case NodeLayout::DEPTH_FIRST:
+                depth_first(0, order);
+                break;
+            case NodeLayout::VAN_EMDE_BOAS: {
+                std::vector<int> frontier;
+                van_emde_boas(0, heights_[0], order, frontier);
+                break;
+            }
+            case NodeLayout::HOT_FIRST:
+                hot_first(order);
+                break;
+        }
+        return order;
+    }
+
+    /// Builds the MBVH with the nodes in the given order, and the leaves in the order of the nodes
+    Mbvh apply(const std::vector<int>& order) const {
+        std::vector<int> new_index(mbvh_.nodes.size());
+        for (size_t i = 0; i < order.size(); i++) new_index[order[i]] = i;
+
+        Mbvh res;
+        res.header = mbvh_.header;
+        res.nodes.reserve(order.size());
+        res.tris.reserve(mbvh_.tris.size());
+        for (int index : order) {
+            mbvh::Node node = mbvh_.nodes[index];
+            for (int j = 0; j < 4; j++) {
+                if (node.prim_count[j] < 0) {
+                    node.children[j] = new_index[node.children[j]];
+                } else if (node.prim_count[j] > 0) {
+                    const auto first = mbvh_.tris.begin() + node.children[j];
+                    node.children[j] = res.tris.size();
+                    res.tris.insert(res.tris.end(), first, first + 13 * node.prim_count[j]);
+                }
+            }
+            res.nodes.push_back(node);
+        }
+        res.header.node_count = res.nodes.size();
+        res.header.vert_count = res.tris.size();
+        return res;
+    }
+
+private:
+    void depth_first(int root, std::vector<int>& order) const {
+        std::vector<int> stack(1, root);
+        while (!stack.empty()) {
+            const int index = stack.back();
+            stack.pop_back();
+            order.push_back(index);
+            const mbvh::Node& node = mbvh_.nodes[index];
+            for (int j = 3; j >= 0; j--) {
+                if (node.prim_count[j] < 0) stack.push_back(node.children[j]);
+            }
+        }
+    }
+
+    /// Lays out the nodes of the given number of levels below a node. The inner nodes right below
+    /// these levels are added to the frontier, in order, to be laid out by the caller.
+    void van_emde_boas(int index, int levels, std::vector<int>& order, std::vector<int>& frontier) const {
+        if (levels == 1) {
+            order.push_back(index);
+            const mbvh::Node& node = mbvh_.nodes[index];
+            for (int j = 0; j < 4; j++) {
+                if (node.prim_count[j] < 0) frontier.push_back(node.children[j]);
+            }
+            return;
+        }
+
+        const int top = levels / 2;
+        std::vector<int> roots;
+        van_emde_boas(index, top, order, roots);
+        for (int root : roots) van_emde_boas(root, levels - top, order, frontier);
+    }
+
+    void hot_first(std::vector<int>& order) const {
+        auto visit_count = [&] (int index) { return index < (int)visits_.size() ? visits_[index] : 0; };
+
+        // The hot nodes are placed from the most to the least visited, as long as a given share of the root visits
+        // reaches them. The other nodes are cold subtrees, which are laid out depth-first after the hot part.
+        const uint64_t threshold = std::max<uint64_t>(visit_count(0) / hot_ratio, 1);
+        auto colder = [&] (int a, int b) {
+            const uint64_t va = visit_count(a), vb = visit_count(b);
+            return va != vb ? va < vb : a > b;
+        };
+        std::priority_queue<int, std::vector<int>, decltype(colder)> queue(colder);
+        std::vector<int> cold;
+        queue.push(0);
+        while (!queue.empty()) {
+            const int index = queue.top();
+            queue.pop();
+            if (index != 0 && visit_count(index) < threshold) {
+                cold.push_back(index);
+                continue;
+            }
+            order.push_back(index);
+            const mbvh::Node& node = mbvh_.nodes[index];
+            for (int j = 0; j < 4; j++) {
+                if (node.prim_count[j] < 0) queue.push(node.children[j]);
+            }
+        }
+
+        for (int root : cold) depth_first(root, order);
+    }
+
+    const Mbvh& mbvh_;
+    const std::vector<uint64_t>& visits_;
+    std::vector<int> heights_;
+};
+
+/// Set-associative cache with LRU replacement, which counts the misses
+class CacheSim {
+public:
+    CacheSim(size_t size)
+        : sets_(std::max<size_t>(size / (line_size * ways), 1)), tags_(sets_ * ways, UINT64_MAX)
+    {}
+
+    void read(uint64_t addr, size_t size, AccessStats& stats) {
+        for (uint64_t line = addr / line_size; line <= (addr + size - 1) / line_size; line++) {
+            stats.lines++;
+            // The ways of a set are sorted from the most to the least recently used
+            uint64_t* set = &tags_[(line % sets_) * ways];
+            int way = 0;
+            while (way < ways - 1 && set[way] != line) way++;
+            if (set[way] != line) stats.misses++;
+            std::move_backward(set, set + way, set + way + 1);
+            set[0] = line;
+        }
+    }
+
+private:
+    static const int line_size = 64;
+    static const int ways = 8;
+
+    size_t sets_;
+    std::vector<uint64_t> tags_;
+};
+
+/// Traverses the CPU layout of an MBVH with one ray at a time, in the order of the kernels
+class Tracer {
+public:
+    Tracer(const cpu::Node* nodes, size_t node_count, const cpu::Vec4* tris, size_t cache_size)
+        : nodes_(nodes), tris_(tris), cache_(cache_size)
+    {
+        // The nodes and triangles are in separate arrays, both aligned on cache lines
+        tri_base_ = (sizeof(cpu::Node) * node_count + 63) & ~(uint64_t)63;
+    }
+
+    void trace(const float* ray, AccessStats& stats, std::vector<uint32_t>* visits) {
+        const float3 org(ray[0], ray[1], ray[2]);
+        const float3 dir(ray[4], ray[5], ray[6]);
+        const float3 idir = ray_inverse_dir(dir);
+        const float tmin = ray[3];
+        float tmax = ray[7];
+
+        stack_.clear();
+        stack_.emplace_back(0, tmin);
+        while (!stack_.empty()) {
+            const int32_t index = stack_.back().first;
+            const float t = stack_.back().second;
+            stack_.pop_back();
+            if (t >= tmax) continue;
+
+            if (index < 0) {
+                intersect_leaf(index, org, dir, tmin, tmax, stats);
+                continue;
+            }
+
+            const cpu::Node& node = nodes_[index];
+            cache_.read(sizeof(cpu::Node) * index, sizeof(cpu::Node), stats);
+            stats.nodes++;
+            if (visits) (*visits)[index]++;
+
+            // The closest children are traversed first
+            const size_t first = stack_.size();
+            for (int j = 0; j < 4 && node.children[j] != 0; j++) {
+                const float3 lo(node.min_x[j], node.min_y[j], node.min_z[j]);
+                const float3 hi(node.max_x[j], node.max_y[j], node.max_z[j]);
+                float t0;
+                if (intersect_ray_box(lo, hi, org, idir, tmin, tmax, t0)) stack_.emplace_back(node.children[j], t0);
+            }
+            std::sort(stack_.begin() + first, stack_.end(), [] (const std::pair<int32_t, float>& a, const std::pair<int32_t, float>& b) {
+                return a.second > b.second;
+            });
+        }
+    }
+
+private:
+    void intersect_leaf(int32_t leaf, const float3& org, const float3& dir, float tmin, float& tmax, AccessStats& stats) {
+        for_each_tri_block(tris_, leaf, [&] (const float* block) {
+            // The kernels also read the first vector of the next block, to find the end of the leaf
+            cache_.read(tri_base_ + sizeof(float) * (block - (const float*)tris_), sizeof(cpu::Vec4) * 14, stats);
+            stats.blocks++;
+            intersect_tri_block(block, org, dir, tmin, tmax);
+        });
+    }
+
+    const cpu::Node* nodes_;
+    const cpu::Vec4* tris_;
+    uint64_t tri_base_;
+    CacheSim cache_;
+    std::vector<std::pair<int32_t, float>> stack_;
+};
+
+} // namespace
+
+bool reorder_mbvh(Mbvh& mbvh, NodeLayout layout, const std::vector<uint64_t>& visits) {
+    Reorderer reorderer(mbvh, visits);
+    if (!reorderer.check()) return false;
+    mbvh = reorderer.apply(reorderer.order(layout));
+    return true;
+}
+
+void profile_accesses(const Mbvh& mbvh, const float* rays, size_t ray_count, size_t cache_size,
+                      AccessStats& stats, std::vector<uint64_t>* visits) {
+    memset(&stats, 0, sizeof(AccessStats));
+    stats.rays = ray_count;
+    if (visits) visits->assign(mbvh.nodes.size(), 0);
+    if (mbvh.nodes.empty()) return;
+
+    const std::vector<char> block = cpu_mbvh_block(mbvh);
+    const cpu::Header* header = (const cpu::Header*)block.data();
+    const cpu::Node* nodes = (const cpu::Node*)(header + 1);
+    const cpu::Vec4* tris = (const cpu::Vec4*)(nodes + header->node_count);
+
+    const size_t chunk_size = 4096;
+    std::mutex mutex;
+    parallel_for(0, (ray_count + chunk_size - 1) / chunk_size, [&] (int i) {
+        Tracer tracer(nodes, header->node_count, tris, cache_size);
+        AccessStats local;
+        memset(&local, 0, sizeof(AccessStats));
+        std::vector<uint32_t> local_visits(visits ? mbvh.nodes.size() : 0, 0);
+
+        const size_t end = std::min(ray_count, (i + 1) * chunk_size);
+        for (size_t j = i * chunk_size; j < end; j++)
+            tracer.trace(rays + 8 * j, local, visits ? &local_visits : nullptr);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        stats.nodes  += local.nodes;
+        stats.blocks += local.blocks;
+        stats.lines  += local.lines;
+        stats.misses += local.misses;
+        if (visits) {
+            for (size_t k = 0; k < local_visits.size(); k++) (*visits)[k] += local_visits[k];
+        }
+    });
+}
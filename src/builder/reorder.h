@@ -0,0 +1,39 @@
+#ifndef BUILDER_REORDER_H
+#define BUILDER_REORDER_H
+
+#include <string>
+#include <vector>
+#include "mbvh.h"
+
+/// Order in which the nodes of an MBVH are stored in memory. The root always stays first.
+enum class NodeLayout {
+    DEPTH_FIRST,        // Preorder, with the children in the order of their slots
+    VAN_EMDE_BOAS,      // Cache-oblivious: the top half of the levels first, then every subtree below it, recursively
+    HOT_FIRST           // The most visited nodes first, so that the hot part of the tree is contiguous (needs visit counts)
+};
+
+/// Parses the name of a layout (depth-first, veb or hot). Returns false if the name is unknown.
+bool parse_node_layout(const std::string& name, NodeLayout& layout);
+
+/// Stores the nodes of an MBVH in the given layout. The child indices are rewritten, and the triangle blocks
+/// of the leaves are moved so that they follow the order of the nodes, as in the CPU layout. The visit counts
+/// are only needed by HOT_FIRST, and are indexed by the current node indices. Returns false if the nodes do not
+/// form a tree, in which case the MBVH is left untouched.
+bool reorder_mbvh(Mbvh& mbvh, NodeLayout layout, const std::vector<uint64_t>& visits = std::vector<uint64_t>());
+
+struct AccessStats {
+    uint64_t rays;          // Number of rays traced
+    uint64_t nodes;         // Number of nodes traversed
+    uint64_t blocks;        // Number of blocks of 4 triangles intersected
+    uint64_t lines;         // Number of cache lines read
+    uint64_t misses;        // Number of cache lines that were not in the simulated cache
+};
+
+/// Traces rays (8 floats per ray: origin and tmin, direction and tmax) through the CPU layout of an MBVH, with a scalar
+/// replica of the closest-hit traversal of the kernels. The memory accesses go through a simulated 8-way LRU cache of the
+/// given size, with one cache per range of 4096 rays, like the cores do. The number of visits of every node is written to
+/// visits if it is not null.
+void profile_accesses(const Mbvh& mbvh, const float* rays, size_t ray_count, size_t cache_size,
+                      AccessStats& stats, std::vector<uint64_t>* visits = nullptr);
+
+#endif // BUILDER_REORDER_H
@@ -0,0 +1,165 @@
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <algorithm>
+
+#include "sah_builder.h"
+#include "binning.h"
+#include "../frontend/parallel.h"
+
+namespace {
+
+class SahBuilder {
+public:
+    SahBuilder(std::vector<PrimRef>& refs, const SahOptions& options, Bvh2& bvh)
+        : refs_(refs), options_(options), bvh_(bvh), node_count_(1), task_count_(1)
+    {}
+
+    void build() {
+        bvh_.nodes.resize(2 * refs_.size() - 1);
+        BBox bbox, centers;
+        compute_bounds(0, refs_.size(), bbox, centers);
+        build_node(0, 0, refs_.size(), bbox, centers);
+        bvh_.nodes.resize(node_count_);
+
+        bvh_.prim_ids.resize(refs_.size());
+        for (size_t i = 0; i < refs_.size(); i++) bvh_.prim_ids[i] = refs_[i].id;
+    }
+
+private:
+    void compute_bounds(int begin, int end, BBox& bbox, BBox& centers) const {
+        bbox = BBox::empty();
+        centers = BBox::empty();
+        for (int i = begin; i < end; i++) {
+            bbox.extend(refs_[i].bbox);
+            centers.extend(refs_[i].bbox.center());
+        }
+    }
+
+    int bin_index(const PrimRef& ref, int axis, const BBox& centers) const {
+        return ::bin_index(component(ref.bbox.center(), axis), component(centers.min, axis), component(centers.max, axis), options_.bin_count);
+    }
+
+    void fill_bins(int begin, int end, const BBox& centers, std::vector<Bin>* bins) const {
+        for (int i = begin; i < end; i++) {
+            for (int axis = 0; axis < 3; axis++) {
+                if (component(centers.min, axis) == component(centers.max, axis)) continue;
+                Bin& bin = bins[axis][bin_index(refs_[i], axis, centers)];
+                bin.bbox.extend(refs_[i].bbox);
+                bin.count++;
+            }
+        }
+    }
+
+    void leaf(int node_id, int begin, int end) {
+        bvh_.nodes[node_id].child = begin;
+        bvh_.nodes[node_id].prim_count = end - begin;
+    }
+
+    void build_node(int node_id, int begin, int end, const BBox& bbox, const BBox& centers) {
+        const int count = end - begin;
+        Bvh2::Node& node = bvh_.nodes[node_id];
+        node.bbox = bbox;
+
+        if (count == 1) {
+            leaf(node_id, begin, end);
+            return;
+        }
+
+        std::vector<Bin> bins[3];
+        for (int axis = 0; axis < 3; axis++) bins[axis].resize(options_.bin_count);
+
+        if (count > parallel_bin_threshold) {
+            // Every chunk has its own bins, which are merged at the end
+            const int chunk_size = parallel_bin_threshold / 4;
+            const int chunk_count = (count + chunk_size - 1) / chunk_size;
+            std::mutex mutex;
+            parallel_for(0, chunk_count, [&] (int chunk) {
+                std::vector<Bin> local[3];
+                for (int axis = 0; axis < 3; axis++) local[axis].resize(options_.bin_count);
+                fill_bins(begin + chunk * chunk_size, std::min(begin + (chunk + 1) * chunk_size, end), centers, local);
+
+                std::lock_guard<std::mutex> lock(mutex);
+                for (int axis = 0; axis < 3; axis++) {
+                    for (int i = 0; i < options_.bin_count; i++) bins[axis][i].add(local[axis][i]);
+                }
+            });
+        } else {
+            fill_bins(begin, end, centers, bins);
+        }
+
+        const SahCosts& costs = options_.costs;
+        BinSplit split;
+        for (int axis = 0; axis < 3; axis++) {
+            if (component(centers.min, axis) != component(centers.max, axis))
+                sweep_bins(bins[axis], axis, costs, split);
+        }
+
+        const float area = bbox.half_area();
+        const float split_cost = area > 0.0f ? costs.traversal + split.cost / area : costs.traversal;
+        if (count <= options_.max_leaf_size && (!split.is_valid() || costs.leaf_cost(count) <= split_cost)) {
+            leaf(node_id, begin, end);
+            return;
+        }
+
+        int mid;
+        if (split.is_valid()) {
+            mid = std::partition(refs_.begin() + begin, refs_.begin() + end, [&] (const PrimRef& ref) {
+                return bin_index(ref, split.axis, centers) < split.bin;
+            }) - refs_.begin();
+        } else {
+            // All the centers are the same, split in the middle
+            mid = begin + count / 2;
+        }
+
+        BBox left_bbox, left_centers, right_bbox, right_centers;
+        compute_bounds(begin, mid, left_bbox, left_centers);
+        compute_bounds(mid, end, right_bbox, right_centers);
+
+        const int child = node_count_.fetch_add(2);
+        node.child = child;
+        node.prim_count = 0;
+
+        if (count > task_threshold && task_count_ < (int)std::thread::hardware_concurrency()) {
+            task_count_++;
+            std::thread task([&] {
+                build_node(child, begin, mid, left_bbox, left_centers);
+                task_count_--;
+            });
+            build_node(child + 1, mid, end, right_bbox, right_centers);
+            task.join();
+        } else {
+            build_node(child, begin, mid, left_bbox, left_centers);
+            build_node(child + 1, mid, end, right_bbox, right_centers);
+        }
+    }
+
+    std::vector<PrimRef>& refs_;
+    const SahOptions& options_;
+    Bvh2& bvh_;
+    std::atomic<int> node_count_;
+    std::atomic<int> task_count_;
+};
+
+} // namespace
+
+Bvh2 build_sah(std::vector<PrimRef>& refs, const SahOptions& options) {
+    Bvh2 bvh;
+    if (refs.empty()) return bvh;
+    SahBuilder builder(refs, options, bvh);
+    builder.build();
+    return bvh;
+}
+
+float sah_cost(const Bvh2& bvh, const SahCosts& costs) {
+    if (bvh.nodes.empty()) return 0.0f;
+    const float root_area = bvh.nodes[0].bbox.half_area();
+    if (root_area <= 0.0f) return 0.0f;
+
+    float cost = 0.0f;
+    for (auto& node : bvh.nodes) {
+        const float area = node.bbox.half_area() / root_area;
+        cost += area * (node.is_leaf() ? costs.leaf_cost(node.prim_count) : costs.traversal);
+    }
+    return cost;
+}
@@ -0,0 +1,27 @@
+#ifndef BUILDER_SAH_BUILDER_H
+#define BUILDER_SAH_BUILDER_H
+
+#include <vector>
+#include "bvh2.h"
+
+/// Primitive reference: bounding box of a (part of a) triangle
+struct PrimRef {
+    BBox bbox;
+    int32_t id;
+};
+
+struct SahOptions {
+    SahCosts costs;
+    int bin_count;          // Number of bins used to evaluate the splits
+    int max_leaf_size;      // Larger leaves are always split
+
+    SahOptions()
+        : bin_count(16), max_leaf_size(8)
+    {}
+};
+
+/// Builds a binary BVH over the given references with the binned SAH, on all the cores.
+/// The references are reordered, so that the primitives of every leaf are contiguous.
+Bvh2 build_sah(std::vector<PrimRef>& refs, const SahOptions& options);
+
+#endif // BUILDER_SAH_BUILDER_H
@@ -0,0 +1,338 @@
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <algorithm>
+
+#include "sbvh_builder.h"
+#include "binning.h"
+#include "presplit.h"
+#include "../frontend/parallel.h"
+
+namespace {
+
+class SbvhBuilder {
+public:
+    SbvhBuilder(const TriMesh& mesh, const SahOptions& options, const SpatialSplitOptions& spatial, Bvh2& bvh)
+        : mesh_(mesh), options_(options), spatial_(spatial), bvh_(bvh), node_count_(1), task_count_(1)
+    {}
+
+    void build(std::vector<PrimRef>& refs) {
+        // There is at least one reference per leaf, which bounds the number of nodes
+        const int max_splits = spatial_.enabled ? int(spatial_.budget * refs.size()) : 0;
+        split_budget_ = max_splits;
+        bvh_.nodes.resize(2 * (refs.size() + max_splits) - 1);
+        leaves_.resize(bvh_.nodes.size());
+
+        BBox bbox = BBox::empty();
+        for (auto& ref : refs) bbox.extend(ref.bbox);
+        root_area_ = bbox.half_area();
+        build_node(0, refs, bbox);
+        bvh_.nodes.resize(node_count_);
+
+        // Gather the primitives of the leaves, in the order of the nodes
+        bvh_.prim_ids.clear();
+        for (int i = 0; i < node_count_; i++) {
+            Bvh2::Node& node = bvh_.nodes[i];
+            if (!node.is_leaf()) continue;
+            node.child = bvh_.prim_ids.size();
+            bvh_.prim_ids.insert(bvh_.prim_ids.end(), leaves_[i].begin(), leaves_[i].end());
+        }
+        leaves_.clear();
+    }
+
+private:
+    /// Fills the bins with the references, in parallel for large nodes (every chunk has its own bins)
+    template <typename F>
+    void fill_bins(const std::vector<PrimRef>& refs, std::vector<Bin>* bins, F fill) const {
+        const int count = refs.size();
+        if (count <= parallel_bin_threshold) {
+            fill(0, count, bins);
+            return;
+        }
+
+        const int chunk_size = parallel_bin_threshold / 4;
+        const int chunk_count = (count + chunk_size - 1) / chunk_size;
+        std::mutex mutex;
+        parallel_for(0, chunk_count, [&] (int chunk) {
+            std::vector<Bin> local[3];
+            for (int axis = 0; axis < 3; axis++) local[axis].resize(bins[axis].size());
+            fill(chunk * chunk_size, std::min((chunk + 1) * chunk_size, count), local);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            for (int axis = 0; axis < 3; axis++) {
+                for (size_t i = 0; i < bins[axis].size(); i++) bins[axis][i].add(local[axis][i]);
+            }
+        });
+    }
+
+    BinSplit find_object_split(const std::vector<PrimRef>& refs, const BBox& centers) const {
+        std::vector<Bin> bins[3];
+        for (int axis = 0; axis < 3; axis++) bins[axis].resize(options_.bin_count);
+        fill_bins(refs, bins, [&] (int begin, int end, std::vector<Bin>* bins) {
+            for (int i = begin; i < end; i++) {
+                for (int axis = 0; axis < 3; axis++) {
+                    if (component(centers.min, axis) == component(centers.max, axis)) continue;
+                    Bin& bin = bins[axis][object_bin(refs[i], axis, centers)];
+                    bin.bbox.extend(refs[i].bbox);
+                    bin.count++;
+                }
+            }
+        });
+
+        BinSplit split;
+        for (int axis = 0; axis < 3; axis++) {
+            if (component(centers.min, axis) != component(centers.max, axis))
+                sweep_bins(bins[axis], axis, options_.costs, split);
+        }
+        return split;
+    }
+
+    /// Spatial split: the bins are placed uniformly over the node, and every reference is clipped to
+    /// the bins it overlaps. The reference enters the node at its first bin and exits at its last one.
+    BinSplit find_spatial_split(const std::vector<PrimRef>& refs, const BBox& bbox) const {
+        std::vector<Bin> bins[3];
+        std::vector<int> entries[3], exits[3];
+        for (int axis = 0; axis < 3; axis++) {
+            bins[axis].resize(options_.bin_count);
+            entries[axis].resize(options_.bin_count);
+            exits[axis].resize(options_.bin_count);
+        }
+
+        std::mutex mutex;
+        fill_bins(refs, bins, [&] (int begin, int end, std::vector<Bin>* bins) {
+            std::vector<int> local_entries[3], local_exits[3];
+            for (int axis = 0; axis < 3; axis++) {
+                local_entries[axis].resize(options_.bin_count);
+                local_exits[axis].resize(options_.bin_count);
+            }
+
+            for (int i = begin; i < end; i++) {
+                for (int axis = 0; axis < 3; axis++) {
+                    if (component(bbox.min, axis) == component(bbox.max, axis)) continue;
+                    const int first = spatial_bin(component(refs[i].bbox.min, axis), axis, bbox);
+                    const int last  = spatial_bin(component(refs[i].bbox.max, axis), axis, bbox);
+                    PrimRef ref = refs[i];
+                    for (int j = first; j < last; j++) {
+                        BBox left, right;
+                        split_ref(mesh_, ref, axis, split_plane(j + 1, axis, bbox), left, right);
+                        bins[axis][j].bbox.extend(left);
+                        ref.bbox = right;
+                    }
+                    bins[axis][last].bbox.extend(ref.bbox);
+                    local_entries[axis][first]++;
+                    local_exits[axis][last]++;
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            for (int axis = 0; axis < 3; axis++) {
+                for (int j = 0; j < options_.bin_count; j++) {
+                    entries[axis][j] += local_entries[axis][j];
+                    exits[axis][j] += local_exits[axis][j];
+                }
+            }
+        });
+
+        BinSplit split;
+        for (int axis = 0; axis < 3; axis++) {
+            if (component(bbox.min, axis) != component(bbox.max, axis))
+                sweep_bins(bins[axis], entries[axis], exits[axis], axis, options_.costs, split);
+        }
+        return split;
+    }
+
+    int object_bin(const PrimRef& ref, int axis, const BBox& centers) const {
+        return bin_index(component(ref.bbox.center(), axis), component(centers.min, axis), component(centers.max, axis), options_.bin_count);
+    }
+
+    int spatial_bin(float x, int axis, const BBox& bbox) const {
+        return bin_index(x, component(bbox.min, axis), component(bbox.max, axis), options_.bin_count);
+    }
+
+    float split_plane(int bin, int axis, const BBox& bbox) const {
+        const float lo = component(bbox.min, axis);
+        const float hi = component(bbox.max, axis);
+        return lo + (hi - lo) * bin / options_.bin_count;
+    }
+
+    /// Distributes the references on both sides of the plane. References that straddle the plane are split,
+    /// unless moving them entirely to one side is cheaper (reference unsplitting). Returns false if one side
+    /// is empty, or if there is not enough budget left for the additional references.
+    bool spatial_partition(const std::vector<PrimRef>& refs, int axis, float plane,
+                           std::vector<PrimRef>& left, std::vector<PrimRef>& right) {
+        BBox left_bbox = BBox::empty(), right_bbox = BBox::empty();
+        std::vector<int> straddling;
+        for (int i = 0; i < (int)refs.size(); i++) {
+            const PrimRef& ref = refs[i];
+            if (component(ref.bbox.max, axis) <= plane) {
+                left.push_back(ref);
+                left_bbox.extend(ref.bbox);
+            } else if (component(ref.bbox.min, axis) >= plane) {
+                right.push_back(ref);
+                right_bbox.extend(ref.bbox);
+            } else {
+                straddling.push_back(i);
+            }
+        }
+
+        int left_count = left.size() + straddling.size();
+        int right_count = right.size() + straddling.size();
+        int splits = 0;
+        for (int i : straddling) {
+            const PrimRef& ref = refs[i];
+            PrimRef left_ref = ref, right_ref = ref;
+            split_ref(mesh_, ref, axis, plane, left_ref.bbox, right_ref.bbox);
+            // The part of the triangle in the reference may only touch the plane
+            if (left_ref.bbox.is_empty()) {
+                right.push_back(right_ref);
+                right_bbox.extend(right_ref.bbox);
+                left_count--;
+                continue;
+            }
+            if (right_ref.bbox.is_empty()) {
+                left.push_back(left_ref);
+                left_bbox.extend(left_ref.bbox);
+                right_count--;
+                continue;
+            }
+
+            const BBox split_left  = BBox(left_bbox).extend(left_ref.bbox);
+            const BBox split_right = BBox(right_bbox).extend(right_ref.bbox);
+            const BBox all_left  = BBox(left_bbox).extend(ref.bbox);
+            const BBox all_right = BBox(right_bbox).extend(ref.bbox);
+            const float split_cost = split_left.half_area() * left_count + split_right.half_area() * right_count;
+            const float left_cost  = all_left.half_area() * left_count + right_bbox.half_area() * (right_count - 1);
+            const float right_cost = left_bbox.half_area() * (left_count - 1) + all_right.half_area() * right_count;
+
+            if (left_cost < split_cost && left_cost <= right_cost) {
+                left.push_back(ref);
+                left_bbox = all_left;
+                right_count--;
+            } else if (right_cost < split_cost) {
+                right.push_back(ref);
+                right_bbox = all_right;
+                left_count--;
+            } else {
+                left.push_back(left_ref);
+                right.push_back(right_ref);
+                left_bbox = split_left;
+                right_bbox = split_right;
+                splits++;
+            }
+        }
+
+        if (left.empty() || right.empty() || !reserve_splits(splits)) {
+            left.clear();
+            right.clear();
+            return false;
+        }
+        return true;
+    }
+
+    bool reserve_splits(int splits) {
+        if (splits == 0) return true;
+        if (split_budget_.fetch_sub(splits) >= splits) return true;
+        split_budget_ += splits;
+        return false;
+    }
+
+    void object_partition(const std::vector<PrimRef>& refs, const BinSplit& split, const BBox& centers,
+                          std::vector<PrimRef>& left, std::vector<PrimRef>& right) const {
+        if (!split.is_valid()) {
+            // All the centers are the same, split in the middle
+            left.assign(refs.begin(), refs.begin() + refs.size() / 2);
+            right.assign(refs.begin() + refs.size() / 2, refs.end());
+            return;
+        }
+        for (auto& ref : refs)
+            (object_bin(ref, split.axis, centers) < split.bin ? left : right).push_back(ref);
+    }
+
+    void leaf(int node_id, const std::vector<PrimRef>& refs) {
+        std::vector<int32_t>& ids = leaves_[node_id];
+        ids.resize(refs.size());
+        for (size_t i = 0; i < refs.size(); i++) ids[i] = refs[i].id;
+        bvh_.nodes[node_id].prim_count = refs.size();
+    }
+
+    void build_node(int node_id, std::vector<PrimRef>& refs, const BBox& bbox) {
+        const int count = refs.size();
+        bvh_.nodes[node_id].bbox = bbox;
+
+        if (count == 1) {
+            leaf(node_id, refs);
+            return;
+        }
+
+        BBox centers = BBox::empty();
+        for (auto& ref : refs) centers.extend(ref.bbox.center());
+
+        const SahCosts& costs = options_.costs;
+        const BinSplit object_split = find_object_split(refs, centers);
+
+        // Only try spatial splits when the children of the object split overlap significantly
+        BinSplit spatial_split;
+        if (spatial_.enabled && split_budget_ > 0 && object_split.is_valid() && root_area_ > 0.0f) {
+            const BBox overlap = BBox(object_split.left_bbox).overlap(object_split.right_bbox);
+            if (overlap.half_area() > spatial_.alpha * root_area_)
+                spatial_split = find_spatial_split(refs, bbox);
+        }
+
+        const bool use_spatial = spatial_split.cost < object_split.cost;
+        const BinSplit& best = use_spatial ? spatial_split : object_split;
+        const float area = bbox.half_area();
+        const float split_cost = area > 0.0f ? costs.traversal + best.cost / area : costs.traversal;
+        if (count <= options_.max_leaf_size && (!best.is_valid() || costs.leaf_cost(count) <= split_cost)) {
+            leaf(node_id, refs);
+            return;
+        }
+
+        std::vector<PrimRef> left, right;
+        if (!use_spatial || !spatial_partition(refs, spatial_split.axis, split_plane(spatial_split.bin, spatial_split.axis, bbox), left, right))
+            object_partition(refs, object_split, centers, left, right);
+
+        // The references of this node are not needed anymore
+        std::vector<PrimRef>().swap(refs);
+
+        BBox left_bbox = BBox::empty(), right_bbox = BBox::empty();
+        for (auto& ref : left)  left_bbox.extend(ref.bbox);
+        for (auto& ref : right) right_bbox.extend(ref.bbox);
+
+        const int child = node_count_.fetch_add(2);
+        bvh_.nodes[node_id].child = child;
+        bvh_.nodes[node_id].prim_count = 0;
+
+        if (count > task_threshold && task_count_ < (int)std::thread::hardware_concurrency()) {
+            task_count_++;
+            std::thread task([&] {
+                build_node(child, left, left_bbox);
+                task_count_--;
+            });
+            build_node(child + 1, right, right_bbox);
+            task.join();
+        } else {
+            build_node(child, left, left_bbox);
+            build_node(child + 1, right, right_bbox);
+        }
+    }
+
+    const TriMesh& mesh_;
+    const SahOptions& options_;
+    const SpatialSplitOptions& spatial_;
+    Bvh2& bvh_;
+    std::vector<std::vector<int32_t>> leaves_;
+    float root_area_;
+    std::atomic<int> split_budget_;
+    std::atomic<int> node_count_;
+    std::atomic<int> task_count_;
+};
+
+} // namespace
+
+Bvh2 build_sbvh(const TriMesh& mesh, std::vector<PrimRef> refs, const SahOptions& options, const SpatialSplitOptions& spatial) {
+    Bvh2 bvh;
+    if (refs.empty()) return bvh;
+    SbvhBuilder builder(mesh, options, spatial, bvh);
+    builder.build(refs);
+    return bvh;
+}
@@ -0,0 +1,24 @@
+#ifndef BUILDER_SBVH_BUILDER_H
+#define BUILDER_SBVH_BUILDER_H
+
+#include <vector>
+#include "mesh.h"
+#include "sah_builder.h"
+
+struct SpatialSplitOptions {
+    bool enabled;
+    float budget;           // Maximum number of additional references, relative to the number of triangles
+    float alpha;            // Spatial splits are only tried when the children of the best object split
+                            // overlap by more than this fraction of the area of the root
+
+    SpatialSplitOptions()
+        : enabled(false), budget(0.3f), alpha(1e-5f)
+    {}
+};
+
+/// Builds a binary BVH over the given references with the binned SAH and spatial splits (SBVH), on all the cores.
+/// Spatial splits clip the triangles against the split plane, so that a triangle may be referenced by several leaves.
+/// The number of additional references is limited by the budget given in the options.
+Bvh2 build_sbvh(const TriMesh& mesh, std::vector<PrimRef> refs, const SahOptions& options, const SpatialSplitOptions& spatial);
+
+#endif // BUILDER_SBVH_BUILDER_H
@@ -0,0 +1,203 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <anydsl_runtime.hpp>
+
+#include "batch.h"
+#include "loaders.h"
+#include "hit_writer.h"
+
+struct BatchRun {
+    std::string scene, rays, output;
+    float tmin, tmax;
+
+    // Results
+    bool ok;
+    int ray_count;
+    double average, median, min;
+    int intr;
+};
+
+static bool read_manifest(const std::string& manifest, std::vector<BatchRun>& runs) {
+    std::ifstream in(manifest);
+    if (!in) return false;
+
+    std::string line;
+    int line_no = 0;
+    while (std::getline(in, line)) {
+        line_no++;
+        std::istringstream is(line);
+        BatchRun run;
+        if (!(is >> run.scene) || run.scene[0] == '#') continue;
+
+        run.output = "-";
+        run.tmin = 0.0f;
+        run.tmax = 1e9f;
+        if (!(is >> run.rays)) {
+            std::cerr << "Missing ray distribution on line " << line_no << " of the manifest." << std::endl;
+            return false;
+        }
+        if (is >> run.output) {
+            std::string tmin, tmax, extra;
+            if (is >> tmin && !(is >> tmax && !(is >> extra) &&
+                                std::istringstream(tmin) >> run.tmin &&
+                                std::istringstream(tmax) >> run.tmax)) {
+                std::cerr << "Invalid interval on line " << line_no << " of the manifest." << std::endl;
+                return false;
+            }
+        }
+        run.ok = false;
+        runs.push_back(run);
+    }
+    return true;
+}
+
+/// Buffers that only grow, so that they are allocated once for all the runs
+template <typename T>
+static void reserve(anydsl::Array<T>& array, int64_t size, bool on_device) {
+    if (array.size() >= size) return;
+    array = on_device
+        ? std::move(anydsl::Array<T>(anydsl::Platform::TRAVERSAL_PLATFORM, anydsl::Device(TRAVERSAL_DEVICE), size))
+        : std::move(anydsl::Array<T>(size));
+}
+
+static bool run_distribution(Node* nodes, Vec4* tris, BatchRun& run, const BatchOptions& options,
+                             anydsl::Array<Ray>& host_rays, anydsl::Array<Ray>& dev_rays,
+                             anydsl::Array<Hit>& host_hits, anydsl::Array<Hit>& dev_hits) {
+    const bool on_host = anydsl::Platform::TRAVERSAL_PLATFORM == anydsl::Platform::Host;
+
+    std::ifstream in;
+    rays::Header header;
+    if (!open_rays(run.rays, in, header)) {
+        std::cerr << "Cannot load ray distribution file " << run.rays << "." << std::endl;
+        return false;
+    }
+
+    const int ray_count = header.ray_count;
+    reserve(host_rays, ray_count, false);
+    reserve(host_hits, ray_count, false);
+    if (read_rays(in, header, host_rays.data(), ray_count, run.tmin, run.tmax) != (size_t)ray_count) {
+        std::cerr << "Cannot load ray distribution file " << run.rays << "." << std::endl;
+        return false;
+    }
+
+    Ray* rays = host_rays.data();
+    Hit* hits = host_hits.data();
+    if (!on_host) {
+        reserve(dev_rays, ray_count, true);
+        reserve(dev_hits, ray_count, true);
+        anydsl::copy(host_rays, 0, dev_rays, 0, ray_count);
+        rays = dev_rays.data();
+        hits = dev_hits.data();
+    }
+
+    auto traversal = options.any ? occluded : intersect;
+    for (int i = 0; i < options.warmup; i++) {
+        traversal(nodes, tris, rays, hits, ray_count);
+    }
+
+    std::vector<double> iter_times(options.times);
+    for (int i = 0; i < options.times; i++) {
+        long long t0 = get_time();
+        traversal(nodes, tris, rays, hits, ray_count);
+        long long t1 = get_time();
+        iter_times[i] = t1 - t0;
+    }
+
+    if (!on_host) anydsl::copy(dev_hits, 0, host_hits, 0, ray_count);
+
+    std::sort(iter_times.begin(), iter_times.end());
+    run.ray_count = ray_count;
+    run.average = std::accumulate(iter_times.begin(), iter_times.end(), 0.0) / options.times;
+    run.median = iter_times[options.times / 2];
+    run.min = iter_times[0];
+    run.intr = 0;
+    for (int i = 0; i < ray_count; i++) {
+        if (host_hits[i].tri_id >= 0) run.intr++;
+    }
+
+    if (run.output != "-") {
+        HitWriter writer;
+        if (!writer.open(run.output, options.format)) {
+            std::cerr << "Cannot open output file " << run.output << ", or invalid output format." << std::endl;
+            return false;
+        }
+        writer.write(host_hits.data(), ray_count);
+        if (!writer.close()) {
+            std::cerr << "Cannot write output file " << run.output << "." << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool run_batch(const std::string& manifest, const BatchOptions& options) {
+    std::vector<BatchRun> runs;
+    if (!read_manifest(manifest, runs)) {
+        std::cerr << "Cannot read manifest file." << std::endl;
+        return false;
+    }
+
+    if (options.times <= 0) {
+        std::cerr << "Invalid iteration count." << std::endl;
+        return false;
+    }
+
+    // Group the runs by scene, keeping the order in which the scenes appear
+    std::vector<std::string> scenes;
+    for (auto& run : runs) {
+        if (std::find(scenes.begin(), scenes.end(), run.scene) == scenes.end())
+            scenes.push_back(run.scene);
+    }
+
+    anydsl::Array<Ray> host_rays, dev_rays;
+    anydsl::Array<Hit> host_hits, dev_hits;
+    bool ok = true;
+    for (auto& scene : scenes) {
+        anydsl::Array<Node> nodes;
+        anydsl::Array<Vec4> tris;
+        MappedFile accel_map;
+        Node* nodes_ptr = nullptr;
+        Vec4* tris_ptr = nullptr;
+
+        auto load_start = std::chrono::high_resolution_clock::now();
+        if (!(options.map && map_accel(scene, accel_map, nodes_ptr, tris_ptr))) {
+            if (!load_accel(scene, nodes, tris)) {
+                std::cerr << "Cannot load acceleration structure file " << scene << "." << std::endl;
+                ok = false;
+                continue;
+            }
+            nodes_ptr = nodes.data();
+            tris_ptr = tris.data();
+        }
+        auto load_end = std::chrono::high_resolution_clock::now();
+        std::cout << scene << " loaded in " << std::chrono::duration_cast<std::chrono::microseconds>(load_end - load_start).count() / 1000.0 << "ms." << std::endl;
+
+        for (auto& run : runs) {
+            if (run.scene != scene) continue;
+            run.ok = run_distribution(nodes_ptr, tris_ptr, run, options, host_rays, dev_rays, host_hits, dev_hits);
+            ok &= run.ok;
+        }
+    }
+
+    // Consolidated results, one line per run
+    std::cout << "# scene, distribution, rays, average (ms), median (ms), min (ms), rays/sec, intersections" << std::endl;
+    for (auto& run : runs) {
+        std::cout << run.scene << ", " << run.rays << ", ";
+        if (run.ok) {
+            std::cout << run.ray_count << ", "
+                      << run.average / 1000.0 << ", "
+                      << run.median / 1000.0 << ", "
+                      << run.min / 1000.0 << ", "
+                      << run.ray_count * 1000000.0 / run.average << ", "
+                      << run.intr << std::endl;
+        } else {
+            std::cout << "failed" << std::endl;
+        }
+    }
+    return ok;
+}
@@ -0,0 +1,21 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <string>
+
+struct BatchOptions {
+    int times;
+    int warmup;
+    bool any;
+    bool map;
+    std::string format;
+};
+
+/// Runs all the scene and ray distribution pairs listed in a manifest file, one per line:
+///     scene.bvh distribution.rays [output.fbuf [tmin tmax]]
+/// Empty lines and lines starting with '#' are ignored, and "-" disables the output of a run.
+/// Every scene is loaded once, and the ray and hit buffers are reused across the runs.
+/// The results of all the runs are printed at the end, in the order of the manifest.
+bool run_batch(const std::string& manifest, const BatchOptions& options);
+
+#endif // BATCH_H
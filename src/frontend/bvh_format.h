@@ -2,11 +2,22 @@
 #define BVH_FILE_H
 
 #include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdio>
 
 enum class BlockType {
+    PADDING = 0,
     BVH = 1,
     MBVH = 2,
-    MESH = 3
+    MESH = 3,
+    CPU_MBVH = 4,
+    DIRECTORY = 5,
+    COMPRESSED = 6
 };
 
 namespace bvh {
@@ -23,6 +34,19 @@ namespace bvh {
         uint32_t prim_count;
         uint32_t vert_count;
     };
+
+    /// Node in the layout of the GPU kernels (see mapping_gpu.impala), as stored in BVH blocks. Leaves are referenced
+    /// with the bitwise complement of the index of their first triangle vector. Every triangle takes 3 vectors, one per
+    /// vertex: the id of the triangle is in the w component of the second one, and the w component of the third one
+    /// is -0.0f for the last triangle of the leaf.
+    struct GpuNode {
+        float left_bb[6];       // lo_x, hi_x, lo_y, hi_y, lo_z, hi_z
+        float right_bb[6];
+        int32_t left, right;
+        int32_t pad[2];
+    };
+
+    static_assert(sizeof(GpuNode) == 64, "Invalid GPU node layout");
 }
 
 namespace mbvh {
@@ -44,6 +68,53 @@ namespace mbvh {
     };
 }
 
+/// MBVH stored in the layout of the CPU kernels (see mapping_cpu.impala), so that it can be used without conversion
+namespace cpu {
+    struct Header {
+        uint32_t node_count;
+        uint32_t vert_count;    // Number of Vec4 in the triangle array
+        uint32_t pad[2];        // Keeps the nodes aligned on 16 bytes
+    };
+
+    struct Node {
+        float min_x[4], min_y[4], min_z[4];
+        float max_x[4], max_y[4], max_z[4];
+        int32_t children[4];
+    };
+
+    struct Vec4 {
+        float x, y, z, w;
+    };
+
+    /// 8-wide node of the AVX2 traversal (see nodes_cpu8.impala). The triangles are stored as for 4-wide nodes.
+    struct Node8 {
+        float min_x[8], min_y[8], min_z[8];
+        float max_x[8], max_y[8], max_z[8];
+        int32_t children[8];
+    };
+
+    /// Quantized node of the CPU traversal (see nodes_cpuq.impala), which fits in a cache line. The boxes of the children
+    /// are stored on a grid of 255 steps of scale[k] along each axis k, from the origin, rounded outwards. The origin is
+    /// absolute rather than relative to the parent, because the traversal stack only holds the index of the nodes.
+    struct QNode {
+        float origin[3];
+        float scale[3];         // Powers of two, so that the boxes are computed exactly in the kernels
+        uint8_t lo_x[4], lo_y[4], lo_z[4];
+        uint8_t hi_x[4], hi_y[4], hi_z[4];
+        int32_t children[4];
+    };
+
+    /// The kernels detect the end of a leaf when the next block of triangles starts with -0.0f,
+    /// so the first float of a block must be stored as 0.0f instead.
+    inline void normalize_block_start(float* block) {
+        if (block[0] == 0.0f) block[0] = 0.0f;
+    }
+
+    static_assert(sizeof(Node) == 112, "Invalid CPU node layout");
+    static_assert(sizeof(Node8) == 224, "Invalid 8-wide CPU node layout");
+    static_assert(sizeof(QNode) == 64, "Invalid quantized CPU node layout");
+}
+
 namespace mesh {
     struct Header {
         uint32_t vert_count;
@@ -52,6 +123,35 @@ namespace mesh {
     };
 }
 
+/// Block compressed with zlib, in chunks that can be decompressed independently. The header of the
+/// original block is kept uncompressed, so that the destination can be allocated before decompression.
+/// The header is followed by the original block header (padded to 8 bytes), the offsets of the
+/// chunk_count + 1 chunk boundaries in the compressed data, and the compressed data.
+namespace compressed {
+    struct Header {
+        uint32_t block_type;    // Type of the original block
+        uint32_t header_size;   // Size of the original block header
+        uint64_t block_size;    // Size of the original block contents, header included
+        uint64_t chunk_size;    // Size of the decompressed chunks, except for the last one
+        uint64_t chunk_count;
+    };
+}
+
+/// Directory of the blocks of a file, stored as the first block so that any block can be found with a single seek
+namespace dir {
+    struct Header {
+        uint32_t entry_count;
+        uint32_t capacity;
+    };
+
+    struct Entry {
+        uint32_t type;
+        uint32_t align;     // Alignment of the block contents in the file
+        uint64_t offset;    // Offset of the block contents from the beginning of the file
+        uint64_t size;      // Size of the block contents
+    };
+}
+
 inline bool check_header(std::istream& is) {
     uint32_t magic;
     is.read((char*)&magic, sizeof(uint32_t));
@@ -59,6 +159,32 @@ inline bool check_header(std::istream& is) {
 }
 
 inline bool locate_block(std::istream& is, BlockType type) {
+    // Use the block directory when the file starts with one
+    std::streampos start = is.tellg();
+    uint64_t dir_offset;
+    uint32_t dir_type;
+    is.read((char*)&dir_offset, sizeof(uint64_t));
+    is.read((char*)&dir_type, sizeof(uint32_t));
+    if (is && dir_type == (uint32_t)BlockType::DIRECTORY) {
+        dir::Header h;
+        is.read((char*)&h, sizeof(dir::Header));
+        if (!is) return false;
+
+        std::vector<dir::Entry> entries(h.entry_count);
+        is.read((char*)entries.data(), sizeof(dir::Entry) * h.entry_count);
+        if (!is) return false;
+
+        for (auto& entry : entries) {
+            if (entry.type == (uint32_t)type) {
+                is.seekg(entry.offset);
+                return static_cast<bool>(is);
+            }
+        }
+        return false;
+    }
+    is.clear();
+    is.seekg(start);
+
     uint32_t block_type;
     uint64_t offset = 0;
     do {
@@ -69,10 +195,191 @@ inline bool locate_block(std::istream& is, BlockType type) {
         is.read((char*)&block_type, sizeof(uint32_t));
         if (is.gcount() != sizeof(uint32_t)) return false;
 
+        // The offset includes the block type, a smaller one can only come from a malformed file
+        if (offset < sizeof(BlockType)) return false;
         offset -= sizeof(BlockType);
     } while (!is.eof() && block_type != (uint32_t)type);
 
     return static_cast<bool>(is);
 }
 
+inline void write_header(std::ostream& os) {
+    uint32_t magic = 0x313F1A57;
+    os.write((const char*)&magic, sizeof(uint32_t));
+}
+
+/// Starts a block of the given size. If needed, a padding block is inserted
+/// before it so that the block contents are aligned in the file.
+inline void write_block_header(std::ostream& os, BlockType type, uint64_t size, uint64_t align = 16) {
+    const uint64_t header_size = sizeof(uint64_t) + sizeof(uint32_t);
+    uint64_t pos = os.tellp();
+    if ((pos + header_size) % align != 0) {
+        uint64_t pad = 0;
+        while ((pos + 2 * header_size + pad) % align != 0) pad++;
+        uint64_t pad_offset = sizeof(BlockType) + pad;
+        uint32_t pad_type = (uint32_t)BlockType::PADDING;
+        os.write((const char*)&pad_offset, sizeof(uint64_t));
+        os.write((const char*)&pad_type, sizeof(uint32_t));
+        for (uint64_t i = 0; i < pad; i++) os.put(0);
+    }
+
+    uint64_t offset = sizeof(BlockType) + size;
+    uint32_t block_type = (uint32_t)type;
+    os.write((const char*)&offset, sizeof(uint64_t));
+    os.write((const char*)&block_type, sizeof(uint32_t));
+}
+
+inline bool check_header(const char* data, size_t size) {
+    uint32_t magic;
+    if (size < sizeof(uint32_t)) return false;
+    std::memcpy(&magic, data, sizeof(uint32_t));
+    return magic == 0x313F1A57;
+}
+
+/// Returns the block directory of a file loaded or mapped in memory, or nullptr if the file has none.
+inline const dir::Header* find_directory(const char* data, size_t size) {
+    const size_t pos = sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint32_t);
+    if (pos + sizeof(dir::Header) > size) return nullptr;
+
+    uint32_t block_type;
+    std::memcpy(&block_type, data + pos - sizeof(uint32_t), sizeof(uint32_t));
+    if (block_type != (uint32_t)BlockType::DIRECTORY) return nullptr;
+
+    const dir::Header* h = (const dir::Header*)(data + pos);
+    if (pos + sizeof(dir::Header) + sizeof(dir::Entry) * h->entry_count > size) return nullptr;
+    return h;
+}
+
+/// Finds a block in a file loaded or mapped in memory. Returns a pointer to the
+/// block contents (right after the block type), or nullptr if there is no such block.
+inline const char* locate_block(const char* data, size_t size, BlockType type, size_t* block_size = nullptr) {
+    if (auto h = find_directory(data, size)) {
+        const dir::Entry* entries = (const dir::Entry*)(h + 1);
+        for (uint32_t i = 0; i < h->entry_count; i++) {
+            if (entries[i].type != (uint32_t)type) continue;
+            if (entries[i].offset > size || entries[i].size > size - entries[i].offset) return nullptr;
+            if (block_size) *block_size = entries[i].size;
+            return data + entries[i].offset;
+        }
+        return nullptr;
+    }
+
+    size_t pos = sizeof(uint32_t);
+    while (pos + sizeof(uint64_t) + sizeof(uint32_t) <= size) {
+        uint64_t offset;
+        uint32_t block_type;
+        std::memcpy(&offset, data + pos, sizeof(uint64_t));
+        std::memcpy(&block_type, data + pos + sizeof(uint64_t), sizeof(uint32_t));
+        pos += sizeof(uint64_t) + sizeof(uint32_t);
+
+        if (offset < sizeof(BlockType)) return nullptr;
+        offset -= sizeof(BlockType);
+        if (offset > size - pos) return nullptr;
+
+        if (block_type == (uint32_t)type) {
+            if (block_size) *block_size = offset;
+            return data + pos;
+        }
+        pos += offset;
+    }
+    return nullptr;
+}
+
+/// Calls the given function with the type, contents and size of every block
+/// of a file loaded or mapped in memory. Returns false if the file is truncated.
+template <typename F>
+inline bool for_each_block(const char* data, size_t size, F f) {
+    size_t pos = sizeof(uint32_t);
+    while (pos + sizeof(uint64_t) + sizeof(uint32_t) <= size) {
+        uint64_t offset;
+        uint32_t block_type;
+        std::memcpy(&offset, data + pos, sizeof(uint64_t));
+        std::memcpy(&block_type, data + pos + sizeof(uint64_t), sizeof(uint32_t));
+        pos += sizeof(uint64_t) + sizeof(uint32_t);
+
+        if (offset < sizeof(BlockType)) return false;
+        offset -= sizeof(BlockType);
+        if (offset > size - pos) return false;
+
+        f((BlockType)block_type, data + pos, (size_t)offset);
+        pos += offset;
+    }
+    return pos == size;
+}
+
+/// Writes a file starting with a directory of its blocks. The directory is
+/// filled in when the file is finished, and has room for a fixed number of blocks.
+class BlockWriter {
+public:
+    BlockWriter(std::ostream& os, uint32_t capacity = 16)
+        : os_(os), capacity_(capacity)
+    {
+        write_header(os_);
+        const uint64_t dir_size = sizeof(dir::Header) + sizeof(dir::Entry) * capacity_;
+        write_block_header(os_, BlockType::DIRECTORY, dir_size, sizeof(uint64_t));
+        dir_pos_ = os_.tellp();
+        for (uint64_t i = 0; i < dir_size; i++) os_.put(0);
+    }
+
+    /// Starts a block, whose contents must then be written to the stream.
+    bool begin_block(BlockType type, uint64_t size, uint64_t align = 16) {
+        if (entries_.size() >= capacity_) return false;
+        write_block_header(os_, type, size, align);
+        dir::Entry entry;
+        entry.type = (uint32_t)type;
+        entry.align = align;
+        entry.offset = os_.tellp();
+        entry.size = size;
+        entries_.push_back(entry);
+        return true;
+    }
+
+    /// Writes a block and its contents.
+    bool write_block(BlockType type, const char* data, uint64_t size, uint64_t align = 16) {
+        if (!begin_block(type, size, align)) return false;
+        os_.write(data, size);
+        return static_cast<bool>(os_);
+    }
+
+    bool write_block(BlockType type, const std::vector<char>& data, uint64_t align = 16) {
+        return write_block(type, data.data(), data.size(), align);
+    }
+
+    /// Fills in the directory.
+    bool finish() {
+        std::streampos end = os_.tellp();
+        dir::Header h;
+        h.entry_count = entries_.size();
+        h.capacity = capacity_;
+        os_.seekp(dir_pos_);
+        os_.write((const char*)&h, sizeof(dir::Header));
+        os_.write((const char*)entries_.data(), sizeof(dir::Entry) * entries_.size());
+        os_.seekp(end);
+        return static_cast<bool>(os_);
+    }
+
+private:
+    std::ostream& os_;
+    uint32_t capacity_;
+    std::streampos dir_pos_;
+    std::vector<dir::Entry> entries_;
+};
+
+/// Writes a scene file with write(writer, os), which writes the blocks with the given BlockWriter and returns false
+/// on failure. The blocks go to a temporary file first, so that the output can also be the input of a tool, and an
+/// existing file is only replaced by a complete one. The temporary file is removed if anything fails.
+template <typename F>
+bool write_scene_file(const std::string& output, F write) {
+    const std::string tmp = output + ".tmp";
+    std::ofstream os(tmp, std::ofstream::binary);
+    if (!os) return false;
+
+    BlockWriter writer(os);
+    bool ok = write(writer, static_cast<std::ostream&>(os)) && writer.finish();
+    os.close();
+    ok = ok && !os.fail() && std::rename(tmp.c_str(), output.c_str()) == 0;
+    if (!ok) std::remove(tmp.c_str());
+    return ok;
+}
+
 #endif 
@@ -0,0 +1,151 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <zlib.h>
+
+#include "compression.h"
+#include "parallel.h"
+
+static inline size_t align8(size_t size) { return (size + 7) & ~size_t(7); }
+
+static inline double elapsed_ms(std::chrono::high_resolution_clock::time_point t0,
+                                std::chrono::high_resolution_clock::time_point t1) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count() / 1000.0;
+}
+
+DecompressionStats& decompression_stats() {
+    static DecompressionStats stats = { 0.0, 0.0, 0, 0 };
+    return stats;
+}
+
+size_t block_header_size(BlockType type) {
+    switch (type) {
+        case BlockType::BVH:      return sizeof(bvh::Header);
+        case BlockType::MBVH:     return sizeof(mbvh::Header);
+        case BlockType::MESH:     return sizeof(mesh::Header);
+        case BlockType::CPU_MBVH: return sizeof(cpu::Header);
+        default:                  return 0;
+    }
+}
+
+const compressed::Header* locate_compressed_block(const char* data, size_t size, BlockType type) {
+    const compressed::Header* found = nullptr;
+    auto check_block = [&] (const char* block, size_t block_size) {
+        if (found || block_size < sizeof(compressed::Header)) return;
+        const compressed::Header* h = (const compressed::Header*)block;
+        if (h->block_type == (uint32_t)type &&
+            block_size >= sizeof(compressed::Header) + align8(h->header_size) + sizeof(uint64_t) * (h->chunk_count + 1))
+            found = h;
+    };
+
+    if (auto h = find_directory(data, size)) {
+        const dir::Entry* entries = (const dir::Entry*)(h + 1);
+        for (uint32_t i = 0; i < h->entry_count; i++) {
+            if (entries[i].type == (uint32_t)BlockType::COMPRESSED &&
+                entries[i].offset <= size && entries[i].size <= size - entries[i].offset)
+                check_block(data + entries[i].offset, entries[i].size);
+        }
+    } else {
+        for_each_block(data, size, [&] (BlockType block_type, const char* block, size_t block_size) {
+            if (block_type == BlockType::COMPRESSED) check_block(block, block_size);
+        });
+    }
+    return found;
+}
+
+bool decompress_block(const MappedFile& file, const compressed::Header* h, std::vector<BlockSegment> segments) {
+    const uint64_t* offsets = (const uint64_t*)(original_header(h) + align8(h->header_size));
+    const char* data = (const char*)(offsets + h->chunk_count + 1);
+    if (offsets[h->chunk_count] > (uint64_t)(file.data() + file.size() - data))
+        return false;
+
+    std::sort(segments.begin(), segments.end(), [] (const BlockSegment& a, const BlockSegment& b) {
+        return a.offset < b.offset;
+    });
+
+    // Read the compressed data first, so that I/O and decompression can be timed separately
+    auto t0 = std::chrono::high_resolution_clock::now();
+    file.prefetch(data, offsets[h->chunk_count]);
+    const size_t page = sysconf(_SC_PAGESIZE);
+    volatile char touch = 0;
+    for (uint64_t i = 0; i < offsets[h->chunk_count]; i += page) touch += data[i];
+    auto t1 = std::chrono::high_resolution_clock::now();
+
+    std::atomic<bool> ok(true);
+    parallel_for(0, h->chunk_count, [&] (int i) {
+        const uint64_t begin = h->header_size + i * h->chunk_size;
+        const uint64_t end = std::min(begin + h->chunk_size, h->block_size);
+
+        z_stream zs;
+        memset(&zs, 0, sizeof(z_stream));
+        if (inflateInit(&zs) != Z_OK) {
+            ok = false;
+            return;
+        }
+
+        zs.next_in = (Bytef*)(data + offsets[i]);
+        zs.avail_in = offsets[i + 1] - offsets[i];
+
+        // The chunk may span several segments: switch the output buffer as needed
+        uint64_t pos = begin;
+        for (auto& segment : segments) {
+            if (segment.offset + segment.size <= pos) continue;
+            if (segment.offset > pos || pos >= end) break;
+
+            const uint64_t seg_end = std::min(segment.offset + segment.size, end);
+            zs.next_out = (Bytef*)segment.dst + (pos - segment.offset);
+            zs.avail_out = seg_end - pos;
+            while (zs.avail_out > 0) {
+                int ret = inflate(&zs, Z_NO_FLUSH);
+                if (ret != Z_OK && (ret != Z_STREAM_END || zs.avail_out > 0)) break;
+            }
+            if (zs.avail_out > 0) break;
+            pos = seg_end;
+        }
+
+        inflateEnd(&zs);
+        if (pos != end) ok = false;
+    });
+    auto t2 = std::chrono::high_resolution_clock::now();
+
+    auto& stats = decompression_stats();
+    stats.io_time += elapsed_ms(t0, t1);
+    stats.decompression_time += elapsed_ms(t1, t2);
+    stats.compressed_size += offsets[h->chunk_count];
+    stats.block_size += h->block_size;
+    return ok;
+}
+
+bool compress_block(BlockType type, const char* data, size_t size, size_t chunk_size, int level, std::vector<char>& out) {
+    compressed::Header h;
+    h.block_type = (uint32_t)type;
+    h.header_size = block_header_size(type);
+    h.block_size = size;
+    h.chunk_size = chunk_size;
+    h.chunk_count = (size - h.header_size + chunk_size - 1) / chunk_size;
+    if (size < h.header_size) return false;
+
+    std::vector<std::vector<char>> chunks(h.chunk_count);
+    std::atomic<bool> ok(true);
+    parallel_for(0, h.chunk_count, [&] (int i) {
+        const uint64_t begin = h.header_size + i * chunk_size;
+        const uint64_t end = std::min<uint64_t>(begin + chunk_size, size);
+        uLongf dst_size = compressBound(end - begin);
+        chunks[i].resize(dst_size);
+        if (compress2((Bytef*)chunks[i].data(), &dst_size, (const Bytef*)data + begin, end - begin, level) != Z_OK)
+            ok = false;
+        chunks[i].resize(dst_size);
+    });
+    if (!ok) return false;
+
+    std::vector<uint64_t> offsets(h.chunk_count + 1, 0);
+    for (size_t i = 0; i < h.chunk_count; i++) offsets[i + 1] = offsets[i] + chunks[i].size();
+
+    out.clear();
+    out.insert(out.end(), (const char*)&h, (const char*)(&h + 1));
+    out.insert(out.end(), data, data + h.header_size);
+    out.resize(align8(out.size()), 0);
+    out.insert(out.end(), (const char*)offsets.data(), (const char*)(offsets.data() + offsets.size()));
+    for (auto& chunk : chunks) out.insert(out.end(), chunk.begin(), chunk.end());
+    return true;
+}
@@ -0,0 +1,41 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <vector>
+#include "bvh_format.h"
+#include "mapped_file.h"
+
+/// Time spent reading and decompressing the compressed blocks loaded so far (in milliseconds)
+struct DecompressionStats {
+    double io_time;
+    double decompression_time;
+    uint64_t compressed_size;
+    uint64_t block_size;
+};
+
+DecompressionStats& decompression_stats();
+
+/// Range of a decompressed block, along with the memory it is decompressed to
+struct BlockSegment {
+    uint64_t offset;
+    uint64_t size;
+    void* dst;
+};
+
+/// Returns the size of the header of a block, which is kept uncompressed
+size_t block_header_size(BlockType type);
+
+/// Finds the compressed version of a block, or returns nullptr if there is none.
+const compressed::Header* locate_compressed_block(const char* data, size_t size, BlockType type);
+
+/// Returns the header of the original block, stored uncompressed after the compressed block header.
+inline const char* original_header(const compressed::Header* h) { return (const char*)(h + 1); }
+
+/// Decompresses a block in parallel, directly to the given segments.
+/// The segments must cover the whole block contents, except the block header.
+bool decompress_block(const MappedFile& file, const compressed::Header* h, std::vector<BlockSegment> segments);
+
+/// Compresses the contents of a block in parallel, and returns the contents of the compressed block.
+bool compress_block(BlockType type, const char* data, size_t size, size_t chunk_size, int level, std::vector<char>& out);
+
+#endif // COMPRESSION_H
@@ -0,0 +1,513 @@
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+#include <array>
+
+#include "convert_mbvh.h"
+
+size_t cpu_vert_count(const mbvh::Node* nodes, size_t node_count) {
+    size_t count = 0;
+    for (size_t i = 0; i < node_count; i++) {
+        for (int j = 0; j < 4; j++) {
+            // Leaves are made of blocks of 13 Vec4, plus a sentinel
+            if (nodes[i].prim_count[j] > 0)
+                count += 13 * nodes[i].prim_count[j] + 1;
+        }
+    }
+    return count;
+}
+
+/// Converts the nodes of an MBVH to the layout of the CPU kernels. The leaves are given by leaf_node(node, child),
+/// which returns the index of the leaf in the triangle array.
+template <typename LeafFn>
+static void convert_nodes(const mbvh::Node* nodes, size_t node_count, cpu::Node* dst_nodes, LeafFn leaf_node) {
+    for (size_t i = 0; i < node_count; i++) {
+        const mbvh::Node& src_node = nodes[i];
+        cpu::Node& dst_node = dst_nodes[i];
+        int k = 0;
+        for (int j = 0  ; j < 4; j++) {
+            if (src_node.prim_count[j] == 0) {
+                // Empty leaf
+                continue;
+            }
+
+            dst_node.min_x[k] = src_node.bb[j].lx;
+            dst_node.min_y[k] = src_node.bb[j].ly;
+            dst_node.min_z[k] = src_node.bb[j].lz;
+
+            dst_node.max_x[k] = src_node.bb[j].ux;
+            dst_node.max_y[k] = src_node.bb[j].uy;
+            dst_node.max_z[k] = src_node.bb[j].uz;
+
+            if (src_node.prim_count[j] < 0) {
+                // Inner node
+                dst_node.children[k] = src_node.children[j];
+            } else {
+                // Leaf
+                dst_node.children[k] = ~leaf_node(src_node, j);
+            }
+
+            k++;
+        }
+
+        for (; k < 4; k++) {
+            dst_node.min_x[k] = 1.0f;
+            dst_node.min_y[k] = 1.0f;
+            dst_node.min_z[k] = 1.0f;
+
+            dst_node.max_x[k] = -1.0f;
+            dst_node.max_y[k] = -1.0f;
+            dst_node.max_z[k] = -1.0f;
+
+            dst_node.children[k] = 0;
+        }
+    }
+}
+
+void convert_mbvh(const mbvh::Node* nodes, size_t node_count, const float* vertices,
+                  cpu::Node* dst_nodes, cpu::Vec4* dst_tris) {
+    cpu::Vec4* tri_ptr = dst_tris;
+    convert_nodes(nodes, node_count, dst_nodes, [&] (const mbvh::Node& node, int c) {
+        int offset = tri_ptr - dst_tris;
+
+        // Each block of 4 triangles is made of 13 Vec4 and is already in the right layout
+        memcpy(tri_ptr, vertices + node.children[c] * 4, sizeof(cpu::Vec4) * 13 * node.prim_count[c]);
+        tri_ptr += 13 * node.prim_count[c];
+
+        // Insert sentinel
+        cpu::Vec4 sentinel = { -0.0f, -0.0f, -0.0f, -0.0f };
+        *(tri_ptr++) = sentinel;
+        return offset;
+    });
+
+    assert(tri_ptr == dst_tris + cpu_vert_count(nodes, node_count));
+}
+
+int tri_block_size(TriLayout layout) {
+    return layout == TriLayout::MOELLER ? 13 : 10;
+}
+
+void convert_tris(cpu::Node* nodes, size_t node_count, const cpu::Vec4* tris, TriLayout layout,
+                  std::vector<cpu::Vec4>& dst_tris,
+                  const std::vector<int>* mesh_indices, const std::vector<float>* mesh_vertices) {
+    const int block_size = tri_block_size(layout);
+    const size_t mesh_tris = mesh_indices ? mesh_indices->size() / 3 : 0;
+    const size_t mesh_verts = mesh_vertices ? mesh_vertices->size() / 4 : 0;
+
+    // Returns the given vertex of a triangle of the mesh, or nullptr if the mesh does not have it
+    auto mesh_vertex = [&] (int32_t id, int j) -> const float* {
+        if (id < 0 || (size_t)id >= mesh_tris) return nullptr;
+        const int index = (*mesh_indices)[id * 3 + j];
+        if (index < 0 || (size_t)index >= mesh_verts) return nullptr;
+        return mesh_vertices->data() + index * 4;
+    };
+
+    dst_tris.clear();
+    for (size_t i = 0; i < node_count; i++) {
+        for (int j = 0; j < 4; j++) {
+            int32_t child = nodes[i].children[j];
+            if (child >= 0) continue;
+
+            nodes[i].children[j] = ~(int32_t)dst_tris.size();
+            for_each_tri_block(tris, child, [&] (const float* src) {
+                float dst[13 * 4];
+                if (layout == TriLayout::MOELLER) {
+                    memcpy(dst, src, sizeof(float) * 13 * 4);
+                } else if (layout == TriLayout::EDGES) {
+                    // Drop the normals, and move the ids after the edges
+                    memcpy(dst, src, sizeof(float) * 36);
+                    memcpy(dst + 36, src + 48, sizeof(float) * 4);
+                } else {
+                    for (int k = 0; k < 4; k++) {
+                        int32_t id;
+                        memcpy(&id, src + 48 + k, sizeof(int32_t));
+                        const float* p0 = mesh_vertex(id, 0);
+                        const float* p1 = mesh_vertex(id, 1);
+                        const float* p2 = mesh_vertex(id, 2);
+                        for (int c = 0; c < 3; c++) {
+                            if (p0 && p1 && p2) {
+                                dst[c * 4 + k]      = p0[c];
+                                dst[12 + c * 4 + k] = p1[c];
+                                dst[24 + c * 4 + k] = p2[c];
+                            } else {
+                                // v1 = v0 - e1 and v2 = v0 + e2
+                                dst[c * 4 + k]      = src[c * 4 + k];
+                                dst[12 + c * 4 + k] = src[c * 4 + k] - src[12 + c * 4 + k];
+                                dst[24 + c * 4 + k] = src[c * 4 + k] + src[24 + c * 4 + k];
+                            }
+                        }
+                    }
+                    cpu::normalize_block_start(dst);
+                    memcpy(dst + 36, src + 48, sizeof(float) * 4);
+                }
+                dst_tris.insert(dst_tris.end(), (const cpu::Vec4*)dst, (const cpu::Vec4*)dst + block_size);
+            });
+
+            // Insert sentinel
+            cpu::Vec4 sentinel = { -0.0f, -0.0f, -0.0f, -0.0f };
+            dst_tris.push_back(sentinel);
+        }
+    }
+}
+
+LaneStats lane_stats(const cpu::Node* nodes, size_t node_count, const cpu::Vec4* tris) {
+    LaneStats stats = { 0, 0, 0 };
+    for (size_t i = 0; i < node_count; i++) {
+        for (int j = 0; j < 4; j++) {
+            if (nodes[i].children[j] >= 0) continue;
+            stats.leaf_count++;
+            for_each_tri_block(tris, nodes[i].children[j], [&] (const float* block) {
+                stats.block_count++;
+                for (int k = 0; k < 4; k++) {
+                    int32_t id;
+                    memcpy(&id, block + 48 + k, sizeof(int32_t));
+                    stats.tri_count += id >= 0;
+                }
+            });
+        }
+    }
+    return stats;
+}
+
+void repack_leaves(cpu::Node* nodes, size_t node_count, const cpu::Vec4* tris, std::vector<cpu::Vec4>& dst_tris) {
+    // Child of a node, which may be made of several leaves once merged
+    struct Child {
+        float min[3], max[3];
+        int32_t index;
+        int32_t leaves[4];
+        int leaf_count;
+        int tri_count;
+
+        int blocks() const { return std::max((tri_count + 3) / 4, 1); }
+        float cost() const {
+            const float dx = max[0] - min[0], dy = max[1] - min[1], dz = max[2] - min[2];
+            return (dx * dy + dy * dz + dz * dx) * blocks();
+        }
+    };
+
+    auto merge = [] (const Child& a, const Child& b) {
+        Child child = a;
+        for (int k = 0; k < 3; k++) {
+            child.min[k] = std::min(a.min[k], b.min[k]);
+            child.max[k] = std::max(a.max[k], b.max[k]);
+        }
+        for (int i = 0; i < b.leaf_count; i++) child.leaves[child.leaf_count++] = b.leaves[i];
+        child.tri_count += b.tri_count;
+        return child;
+    };
+
+    // Triangles of merged leaves, with their ids in the last element
+    std::vector<std::array<float, 13>> lanes;
+
+    // Merging leaves never adds blocks
+    const LaneStats stats = lane_stats(nodes, node_count, tris);
+    dst_tris.clear();
+    dst_tris.reserve(13 * stats.block_count + stats.leaf_count);
+    for (size_t i = 0; i < node_count; i++) {
+        cpu::Node& node = nodes[i];
+
+        Child children[4];
+        int child_count = 0;
+        for (int j = 0; j < 4 && node.children[j] != 0; j++) {
+            Child& child = children[child_count++];
+            child.min[0] = node.min_x[j]; child.min[1] = node.min_y[j]; child.min[2] = node.min_z[j];
+            child.max[0] = node.max_x[j]; child.max[1] = node.max_y[j]; child.max[2] = node.max_z[j];
+            child.index = node.children[j];
+            child.leaves[0] = node.children[j];
+            child.leaf_count = 1;
+            child.tri_count = 0;
+            if (child.index < 0) {
+                for_each_tri_block(tris, child.index, [&] (const float* block) {
+                    for (int k = 0; k < 4; k++) {
+                        int32_t id;
+                        memcpy(&id, block + 48 + k, sizeof(int32_t));
+                        child.tri_count += id >= 0;
+                    }
+                });
+            }
+        }
+
+        // Greedily merge the pair of leaves that reduces the cost the most, as long as blocks are saved. The triangles
+        // that both leaves reference are only removed once the leaves are merged, which can only save more.
+        while (true) {
+            int best_a = -1, best_b = -1;
+            float best_gain = 0.0f;
+            Child best_child;
+            for (int a = 0; a < child_count; a++) {
+                for (int b = a + 1; b < child_count; b++) {
+                    if (children[a].index >= 0 || children[b].index >= 0) continue;
+
+                    const Child child = merge(children[a], children[b]);
+                    const float gain = children[a].cost() + children[b].cost() - child.cost();
+                    if (child.blocks() < children[a].blocks() + children[b].blocks() &&
+                        gain >= 0.0f && (best_a < 0 || gain > best_gain)) {
+                        best_a = a;
+                        best_b = b;
+                        best_gain = gain;
+                        best_child = child;
+                    }
+                }
+            }
+            if (best_a < 0) break;
+            children[best_a] = best_child;
+            std::copy(children + best_b + 1, children + child_count, children + best_b);
+            child_count--;
+        }
+
+        for (int j = 0; j < 4; j++) {
+            if (j >= child_count) {
+                node.min_x[j] = node.min_y[j] = node.min_z[j] = 1.0f;
+                node.max_x[j] = node.max_y[j] = node.max_z[j] = -1.0f;
+                node.children[j] = 0;
+                continue;
+            }
+
+            const Child& child = children[j];
+            node.min_x[j] = child.min[0]; node.min_y[j] = child.min[1]; node.min_z[j] = child.min[2];
+            node.max_x[j] = child.max[0]; node.max_y[j] = child.max[1]; node.max_z[j] = child.max[2];
+            if (child.index >= 0) {
+                node.children[j] = child.index;
+                continue;
+            }
+
+            node.children[j] = ~(int32_t)dst_tris.size();
+            if (child.leaf_count == 1) {
+                // Leaves that are not merged are copied as they are
+                for_each_tri_block(tris, child.index, [&] (const float* block) {
+                    dst_tris.insert(dst_tris.end(), (const cpu::Vec4*)block, (const cpu::Vec4*)block + 13);
+                });
+            } else {
+                // Gather the triangles of the merged leaves, and write them again in blocks of 4
+                lanes.clear();
+                for (int l = 0; l < child.leaf_count; l++) {
+                    for_each_tri_block(tris, child.leaves[l], [&] (const float* block) {
+                        for (int k = 0; k < 4; k++) {
+                            int32_t id;
+                            memcpy(&id, block + 48 + k, sizeof(int32_t));
+                            if (id < 0) continue;
+                            bool found = false;
+                            for (size_t m = 0; m < lanes.size() && !found; m++) found = !memcmp(&lanes[m][12], &id, sizeof(int32_t));
+                            if (found) continue;
+                            lanes.emplace_back();
+                            for (int c = 0; c < 13; c++) lanes.back()[c] = block[c * 4 + k];
+                        }
+                    });
+                }
+
+                // Leaves always have at least one block, even without triangle
+                const int lane_count = lanes.size();
+                for (int first = 0; first < std::max(lane_count, 1); first += 4) {
+                    float block[13 * 4];
+                    for (int k = 0; k < 4; k++) {
+                        if (first + k < lane_count) {
+                            for (int c = 0; c < 13; c++) block[c * 4 + k] = lanes[first + k][c];
+                        } else {
+                            // Unused lanes are degenerate triangles with an id of -1
+                            const int32_t id = -1;
+                            for (int c = 0; c < 12; c++) block[c * 4 + k] = 0.0f;
+                            memcpy(block + 48 + k, &id, sizeof(int32_t));
+                        }
+                    }
+                    cpu::normalize_block_start(block);
+                    dst_tris.insert(dst_tris.end(), (const cpu::Vec4*)block, (const cpu::Vec4*)block + 13);
+                }
+            }
+
+            // Insert sentinel
+            cpu::Vec4 sentinel = { -0.0f, -0.0f, -0.0f, -0.0f };
+            dst_tris.push_back(sentinel);
+        }
+    }
+}
+
+bool convert_mbvh_indexed(const mbvh::Node* nodes, size_t node_count, const float* vertices,
+                          const std::vector<int>& mesh_indices, const std::vector<float>& mesh_vertices,
+                          std::vector<cpu::Node>& dst_nodes, std::vector<cpu::Vec4>& dst_tris) {
+    const size_t tri_count = mesh_indices.size() / 3;
+    const size_t vert_count = mesh_vertices.size() / 4;
+    for (int i : mesh_indices) {
+        if (i < 0 || (size_t)i >= vert_count) return false;
+    }
+
+    // The vertices come first, so that the indices of the mesh are also indices in the triangle array
+    dst_tris.resize(vert_count);
+    memcpy(dst_tris.data(), mesh_vertices.data(), sizeof(cpu::Vec4) * vert_count);
+    dst_nodes.resize(node_count);
+
+    bool ok = true;
+    convert_nodes(nodes, node_count, dst_nodes.data(), [&] (const mbvh::Node& node, int c) {
+        const int offset = dst_tris.size();
+        for (int k = 0; k < node.prim_count[c]; k++) {
+            const float* block = vertices + (node.children[c] + 13 * k) * 4;
+            int32_t data[16];
+            for (int i = 0; i < 4; i++) {
+                int32_t id;
+                memcpy(&id, block + 48 + i, sizeof(int32_t));
+                if (id >= (int32_t)tri_count) ok = false;
+
+                // Unused lanes are degenerate triangles, which are never hit
+                const bool valid = id >= 0 && id < (int32_t)tri_count;
+                for (int j = 0; j < 3; j++) data[j * 4 + i] = valid ? mesh_indices[id * 3 + j] : 0;
+                data[12 + i] = valid ? id : -1;
+            }
+            cpu::Vec4 vecs[4];
+            memcpy(vecs, data, sizeof(vecs));
+            dst_tris.insert(dst_tris.end(), vecs, vecs + 4);
+        }
+
+        // Insert sentinel
+        cpu::Vec4 sentinel = { -0.0f, -0.0f, -0.0f, -0.0f };
+        dst_tris.push_back(sentinel);
+        return offset;
+    });
+    return ok;
+}
+
+namespace {
+
+class Widener {
+public:
+    Widener(const mbvh::Node* nodes, const float* vertices, std::vector<cpu::Node8>& dst_nodes, std::vector<cpu::Vec4>& dst_tris)
+        : nodes_(nodes), vertices_(vertices), dst_nodes_(dst_nodes), dst_tris_(dst_tris)
+    {}
+
+    int emit_node(int index) {
+        // Open the inner child with the largest area until no inner child fits in the remaining slots
+        std::vector<Slot> slots;
+        add_children(index, slots);
+        while (true) {
+            int best = -1;
+            float best_area = -1.0f;
+            for (int i = 0; i < (int)slots.size(); i++) {
+                if (slots[i].prim_count >= 0 || slots.size() - 1 + child_count(slots[i].child) > 8) continue;
+                const mbvh::BBox& bb = slots[i].bb;
+                const float dx = bb.ux - bb.lx, dy = bb.uy - bb.ly, dz = bb.uz - bb.lz;
+                const float area = dx * dy + dy * dz + dz * dx;
+                if (area > best_area) {
+                    best = i;
+                    best_area = area;
+                }
+            }
+            if (best < 0) break;
+
+            const int child = slots[best].child;
+            slots.erase(slots.begin() + best);
+            add_children(child, slots);
+        }
+
+        const int dst_index = dst_nodes_.size();
+        dst_nodes_.emplace_back();
+        for (int j = 0; j < 8; j++) {
+            float lo[3] = { 1.0f, 1.0f, 1.0f }, hi[3] = { -1.0f, -1.0f, -1.0f };
+            int32_t child = 0;
+            if (j < (int)slots.size()) {
+                const Slot& slot = slots[j];
+                lo[0] = slot.bb.lx; lo[1] = slot.bb.ly; lo[2] = slot.bb.lz;
+                hi[0] = slot.bb.ux; hi[1] = slot.bb.uy; hi[2] = slot.bb.uz;
+                child = slot.prim_count < 0 ? emit_node(slot.child) : emit_leaf(slot);
+            }
+            // The vector of nodes may have grown in emit_node()
+            cpu::Node8& dst = dst_nodes_[dst_index];
+            dst.min_x[j] = lo[0]; dst.min_y[j] = lo[1]; dst.min_z[j] = lo[2];
+            dst.max_x[j] = hi[0]; dst.max_y[j] = hi[1]; dst.max_z[j] = hi[2];
+            dst.children[j] = child;
+        }
+        return dst_index;
+    }
+
+private:
+    struct Slot {
+        mbvh::BBox bb;
+        int32_t child;
+        int32_t prim_count;
+    };
+
+    int child_count(int index) const {
+        int count = 0;
+        for (int j = 0; j < 4; j++) count += nodes_[index].prim_count[j] != 0;
+        return count;
+    }
+
+    void add_children(int index, std::vector<Slot>& slots) const {
+        const mbvh::Node& node = nodes_[index];
+        for (int j = 0; j < 4; j++) {
+            if (node.prim_count[j] != 0) slots.push_back(Slot { node.bb[j], node.children[j], node.prim_count[j] });
+        }
+    }
+
+    int emit_leaf(const Slot& slot) {
+        const int offset = dst_tris_.size();
+        const cpu::Vec4* blocks = (const cpu::Vec4*)(vertices_ + slot.child * 4);
+        dst_tris_.insert(dst_tris_.end(), blocks, blocks + 13 * slot.prim_count);
+
+        // Insert sentinel
+        cpu::Vec4 sentinel = { -0.0f, -0.0f, -0.0f, -0.0f };
+        dst_tris_.push_back(sentinel);
+        return ~offset;
+    }
+
+    const mbvh::Node* nodes_;
+    const float* vertices_;
+    std::vector<cpu::Node8>& dst_nodes_;
+    std::vector<cpu::Vec4>& dst_tris_;
+};
+
+} // namespace
+
+void convert_mbvh8(const mbvh::Node* nodes, size_t node_count, const float* vertices,
+                   std::vector<cpu::Node8>& dst_nodes, std::vector<cpu::Vec4>& dst_tris) {
+    dst_nodes.clear();
+    dst_tris.clear();
+    if (node_count == 0) return;
+
+    dst_nodes.reserve(node_count / 2 + 1);
+    dst_tris.reserve(cpu_vert_count(nodes, node_count));
+    Widener widener(nodes, vertices, dst_nodes, dst_tris);
+    widener.emit_node(0);
+}
+
+void quantize_nodes(const cpu::Node* nodes, size_t node_count, cpu::QNode* dst_nodes) {
+    for (size_t i = 0; i < node_count; i++) {
+        const cpu::Node& src = nodes[i];
+        cpu::QNode& dst = dst_nodes[i];
+        memset(&dst, 0, sizeof(cpu::QNode));
+
+        int count = 0;
+        while (count < 4 && src.children[count] != 0) count++;
+
+        const float* mins[3] = { src.min_x, src.min_y, src.min_z };
+        const float* maxs[3] = { src.max_x, src.max_y, src.max_z };
+        uint8_t* lows[3]  = { dst.lo_x, dst.lo_y, dst.lo_z };
+        uint8_t* highs[3] = { dst.hi_x, dst.hi_y, dst.hi_z };
+        for (int k = 0; k < 3; k++) {
+            float lo = FLT_MAX, hi = -FLT_MAX;
+            for (int j = 0; j < count; j++) {
+                lo = std::min(lo, mins[k][j]);
+                hi = std::max(hi, maxs[k][j]);
+            }
+            if (count == 0) lo = hi = 0.0f;
+
+            // Smallest power of two for which the grid covers the node, once rounded like in the kernels
+            int exponent;
+            std::frexp((hi - lo) / 255.0f, &exponent);
+            exponent = std::max(exponent, -126);
+            while (exponent < 127 && lo + 255.0f * std::ldexp(1.0f, exponent) < hi) exponent++;
+            const float scale = std::ldexp(1.0f, exponent);
+            dst.origin[k] = lo;
+            dst.scale[k] = scale;
+
+            for (int j = 0; j < count; j++) {
+                int qlo = std::min(std::max((int)std::floor((mins[k][j] - lo) / scale), 0), 255);
+                int qhi = std::min(std::max((int)std::ceil((maxs[k][j] - lo) / scale), 0), 255);
+                while (qlo > 0 && lo + qlo * scale > mins[k][j]) qlo--;
+                while (qhi < 255 && lo + qhi * scale < maxs[k][j]) qhi++;
+                lows[k][j] = qlo;
+                highs[k][j] = qhi;
+            }
+        }
+
+        for (int j = 0; j < 4; j++) dst.children[j] = j < count ? src.children[j] : 0;
+    }
+}
@@ -0,0 +1,135 @@
+#ifndef CONVERT_MBVH_H
+#define CONVERT_MBVH_H
+
+#include <vector>
+#include <algorithm>
+#include <cfloat>
+#include "bvh_format.h"
+#include "../tools/linear.h"
+
+/// Returns the number of Vec4 needed to store the triangles of an MBVH in the CPU layout.
+size_t cpu_vert_count(const mbvh::Node* nodes, size_t node_count);
+
+/// Converts an MBVH to the layout of the CPU kernels. The destination arrays
+/// must hold node_count nodes and cpu_vert_count(nodes, node_count) vectors.
+void convert_mbvh(const mbvh::Node* nodes, size_t node_count, const float* vertices,
+                  cpu::Node* dst_nodes, cpu::Vec4* dst_tris);
+
+/// Layouts of the triangle blocks of the CPU kernels. Each one goes with a triangle test: the Moeller-Trumbore test
+/// with a stored normal (triangles_cpu.impala), the same test with the normal computed from the edges
+/// (triangles_cpu_edges.impala), or the Pluecker test, which reads the vertices (triangles_cpu_pluecker.impala).
+enum class TriLayout {
+    MOELLER,    // v0, e1, e2, n and ids: 13 Vec4 per block of 4 triangles
+    EDGES,      // v0, e1, e2 and ids: 10 Vec4 per block
+    PLUECKER    // v0, v1, v2 and ids: 10 Vec4 per block
+};
+
+/// Returns the number of Vec4 in a block of 4 triangles of the given layout.
+int tri_block_size(TriLayout layout);
+
+/// Converts the triangles of the CPU layout, in blocks of 13 Vec4, to the given layout. The leaves of the nodes are
+/// updated to point into the new triangle array. The vertices of the Pluecker layout are taken from the mesh of the
+/// scene when it is given (so that neighbouring triangles share them exactly), or recovered from the edges otherwise.
+void convert_tris(cpu::Node* nodes, size_t node_count, const cpu::Vec4* tris, TriLayout layout,
+                  std::vector<cpu::Vec4>& dst_tris,
+                  const std::vector<int>* mesh_indices = nullptr, const std::vector<float>* mesh_vertices = nullptr);
+
+/// Lane utilization of the triangle blocks of the CPU layout
+struct LaneStats {
+    size_t leaf_count;
+    size_t block_count;     // Blocks of 4 triangles
+    size_t tri_count;       // Lanes that hold a triangle
+
+    double utilization() const { return block_count > 0 ? tri_count / (4.0 * block_count) : 1.0; }
+};
+
+/// Computes the lane utilization of the triangles of the CPU layout, in blocks of 13 Vec4.
+LaneStats lane_stats(const cpu::Node* nodes, size_t node_count, const cpu::Vec4* tris);
+
+/// Re-packs the leaves of the CPU layout, in blocks of 13 Vec4, so that fewer lanes are left empty. Sibling leaves are
+/// merged when this saves blocks without increasing the expected number of blocks tested per ray (the number of blocks
+/// of a leaf, weighted by the area of its box). Triangles referenced by both leaves are kept once. The nodes are
+/// updated in place, and their remaining children stay in the same order.
+void repack_leaves(cpu::Node* nodes, size_t node_count, const cpu::Vec4* tris, std::vector<cpu::Vec4>& dst_tris);
+
+/// Converts an MBVH to the layout of the CPU kernels with indexed triangles (see triangles_cpu_indexed.impala), given
+/// the mesh of the scene, as stored in MESH blocks. The vertices of the mesh are stored first, followed by the leaves,
+/// which only hold the indices of the vertices of their triangles. Returns false if the MBVH does not match the mesh.
+bool convert_mbvh_indexed(const mbvh::Node* nodes, size_t node_count, const float* vertices,
+                          const std::vector<int>& mesh_indices, const std::vector<float>& mesh_vertices,
+                          std::vector<cpu::Node>& dst_nodes, std::vector<cpu::Vec4>& dst_tris);
+
+/// Converts an MBVH to the 8-wide layout of the AVX2 kernels. Every node takes the children of its largest inner
+/// children in place of them, as long as they fit in its 8 slots, so that the tree is about half as deep.
+void convert_mbvh8(const mbvh::Node* nodes, size_t node_count, const float* vertices,
+                   std::vector<cpu::Node8>& dst_nodes, std::vector<cpu::Vec4>& dst_tris);
+
+/// Quantizes nodes in the layout of the CPU kernels. The quantized boxes always contain the original ones.
+void quantize_nodes(const cpu::Node* nodes, size_t node_count, cpu::QNode* dst_nodes);
+
+/// Returns true if the given float is -0.0f, which marks the end of a leaf: it is the first float after the last block
+/// of a leaf in the CPU layout, and the w component of the last triangle of a leaf in the GPU layout.
+inline bool is_leaf_end(float f) {
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(uint32_t));
+    return bits == 0x80000000u;
+}
+
+/// Calls f(block) for every block of 13 Vec4 of a leaf of the CPU layout
+template <typename F>
+void for_each_tri_block(const cpu::Vec4* tris, int32_t leaf, F f) {
+    for (const cpu::Vec4* block = tris + ~leaf;; block += 13) {
+        f((const float*)block);
+        if (is_leaf_end(block[13].x)) break;
+    }
+}
+
+/// Inverse of a ray direction, as used by the ray-box test of the kernels. Zero components give +-FLT_MAX.
+inline float3 ray_inverse_dir(const float3& dir) {
+    return float3(dir.x != 0.0f ? 1.0f / dir.x : std::copysign(FLT_MAX, dir.x),
+                  dir.y != 0.0f ? 1.0f / dir.y : std::copysign(FLT_MAX, dir.y),
+                  dir.z != 0.0f ? 1.0f / dir.z : std::copysign(FLT_MAX, dir.z));
+}
+
+/// Scalar replica of the ray-box test of the CPU kernels. Returns true if the ray overlaps the box between tmin
+/// and tmax, in which case t0 is set to the distance at which the ray enters the box.
+inline bool intersect_ray_box(const float3& lo, const float3& hi, const float3& org, const float3& idir,
+                              float tmin, float tmax, float& t0) {
+    const float tx0 = (lo.x - org.x) * idir.x, tx1 = (hi.x - org.x) * idir.x;
+    const float ty0 = (lo.y - org.y) * idir.y, ty1 = (hi.y - org.y) * idir.y;
+    const float tz0 = (lo.z - org.z) * idir.z, tz1 = (hi.z - org.z) * idir.z;
+    t0 = std::max(std::max(tmin, std::min(tx0, tx1)), std::max(std::min(ty0, ty1), std::min(tz0, tz1)));
+    const float t1 = std::min(std::min(tmax, std::max(tx0, tx1)), std::min(std::max(ty0, ty1), std::max(tz0, tz1)));
+    return t1 >= t0;
+}
+
+/// Scalar replica of the triangle test of the CPU kernels (Moeller-Trumbore with a stored normal), on a block of
+/// 13 Vec4. Returns true if a triangle of the block is hit between tmin and tmax, and sets tmax to the closest hit.
+inline bool intersect_tri_block(const float* block, const float3& org, const float3& dir, float tmin, float& tmax) {
+    bool hit = false;
+    for (int i = 0; i < 4; i++) {
+        int32_t id;
+        memcpy(&id, block + 48 + i, sizeof(int32_t));
+        if (id < 0) continue;
+
+        const float3 v0(block[0 * 4 + i], block[1 * 4 + i], block[2 * 4 + i]);
+        const float3 e1(block[3 * 4 + i], block[4 * 4 + i], block[5 * 4 + i]);
+        const float3 e2(block[6 * 4 + i], block[7 * 4 + i], block[8 * 4 + i]);
+        const float3 n(block[9 * 4 + i], block[10 * 4 + i], block[11 * 4 + i]);
+        const float det = dot(n, dir);
+        if (det == 0.0f) continue;
+
+        const float3 c = v0 - org;
+        const float3 r = cross(dir, c);
+        const float u = dot(r, e2) / det;
+        const float v = dot(r, e1) / det;
+        const float t = dot(n, c) / det;
+        if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t >= tmin && t <= tmax) {
+            tmax = t;
+            hit = true;
+        }
+    }
+    return hit;
+}
+
+#endif // CONVERT_MBVH_H
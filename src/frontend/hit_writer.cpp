@@ -0,0 +1,133 @@
+#include <sstream>
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+#include "hit_writer.h"
+
+static_assert(sizeof(Hit) == 4 * sizeof(int32_t), "Hit records must be made of 4 words");
+
+// Number of buffers in flight: one being filled, the others being written
+static const int buffer_count = 3;
+
+HitWriter::HitWriter()
+    : raw_(false), record_size_(0), cur_(-1), cur_size_(0), done_(false)
+{}
+
+HitWriter::~HitWriter() {
+    close();
+}
+
+bool HitWriter::open(const std::string& filename, const std::string& format, size_t buffer_size) {
+    close();
+
+    columns_.clear();
+    raw_ = format == "raw";
+    if (raw_) {
+        record_size_ = sizeof(Hit);
+    } else if (format == "fbuf") {
+        columns_.push_back(offsetof(Hit, tmax) / sizeof(int32_t));
+    } else {
+        std::istringstream is(format);
+        std::string col;
+        while (std::getline(is, col, ',')) {
+            if      (col == "inst_id") columns_.push_back(offsetof(Hit, inst_id) / sizeof(int32_t));
+            else if (col == "tri_id")  columns_.push_back(offsetof(Hit, tri_id)  / sizeof(int32_t));
+            else if (col == "tmax")    columns_.push_back(offsetof(Hit, tmax)    / sizeof(int32_t));
+            else if (col == "u")       columns_.push_back(offsetof(Hit, u)       / sizeof(int32_t));
+            else return false;
+        }
+        if (columns_.empty()) return false;
+    }
+    if (!raw_) record_size_ = sizeof(int32_t) * columns_.size();
+
+    out_.open(filename, std::ofstream::binary);
+    if (!out_) return false;
+
+    // Buffers hold a whole number of records
+    buffer_size = std::max(buffer_size / record_size_, (size_t)1) * record_size_;
+    buffers_.assign(buffer_count, std::vector<char>(buffer_size));
+    sizes_.assign(buffer_count, 0);
+    full_.clear();
+    free_.clear();
+    for (int i = 1; i < buffer_count; i++) free_.push_back(i);
+    cur_ = 0;
+    cur_size_ = 0;
+
+    done_ = false;
+    thread_ = std::thread(&HitWriter::run, this);
+    return true;
+}
+
+void HitWriter::write(const Hit* hits, size_t count) {
+    while (count > 0) {
+        std::vector<char>& buf = buffers_[cur_];
+        const size_t n = std::min(count, (buf.size() - cur_size_) / record_size_);
+        char* ptr = buf.data() + cur_size_;
+
+        if (raw_) {
+            memcpy(ptr, hits, sizeof(Hit) * n);
+        } else {
+            int32_t* dst = (int32_t*)ptr;
+            const int cols = columns_.size();
+            for (size_t i = 0; i < n; i++) {
+                const int32_t* src = (const int32_t*)(hits + i);
+                for (int j = 0; j < cols; j++) dst[i * cols + j] = src[columns_[j]];
+            }
+        }
+
+        cur_size_ += n * record_size_;
+        hits += n;
+        count -= n;
+
+        if (cur_size_ + record_size_ > buf.size()) submit();
+    }
+}
+
+void HitWriter::submit() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    sizes_[cur_] = cur_size_;
+    full_.push_back(cur_);
+    cond_.notify_all();
+
+    cond_.wait(lock, [this] { return !free_.empty(); });
+    cur_ = free_.front();
+    free_.pop_front();
+    cur_size_ = 0;
+}
+
+void HitWriter::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        cond_.wait(lock, [this] { return done_ || !full_.empty(); });
+        if (full_.empty()) break;
+
+        int buf = full_.front();
+        full_.pop_front();
+
+        // Write without holding the lock, so that the other buffers can be filled
+        lock.unlock();
+        out_.write(buffers_[buf].data(), sizes_[buf]);
+        lock.lock();
+
+        free_.push_back(buf);
+        cond_.notify_all();
+    }
+}
+
+bool HitWriter::close() {
+    if (!thread_.joinable()) return true;
+
+    if (cur_size_ > 0) submit();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        done_ = true;
+    }
+    cond_.notify_all();
+    thread_.join();
+
+    bool ok = static_cast<bool>(out_);
+    out_.close();
+    buffers_.clear();
+    return ok;
+}
@@ -0,0 +1,53 @@
+#ifndef HIT_WRITER_H
+#define HIT_WRITER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "traversal.h"
+
+/// Writes hits to a file from a background thread, through large buffers. Supported formats are:
+///  - "fbuf": the distance to the hit point for every ray (default, readable by fbuf2png),
+///  - "raw": the hit records as stored in memory,
+///  - a comma-separated list of the columns to store for every ray, among inst_id, tri_id, tmax and u.
+class HitWriter {
+public:
+    HitWriter();
+    ~HitWriter();
+
+    HitWriter(const HitWriter&) = delete;
+    HitWriter& operator = (const HitWriter&) = delete;
+
+    bool open(const std::string& filename, const std::string& format, size_t buffer_size = 1 << 24);
+    /// Queues hits for writing. Blocks only when all the buffers are waiting to be written.
+    void write(const Hit* hits, size_t count);
+    /// Writes the remaining hits and closes the file. Returns false if an error occured.
+    bool close();
+
+private:
+    void submit();
+    void run();
+
+    std::ofstream out_;
+    std::vector<int> columns_;
+    bool raw_;
+    size_t record_size_;
+
+    std::vector<std::vector<char>> buffers_;
+    std::vector<size_t> sizes_;
+    std::deque<int> full_, free_;
+    int cur_;
+    size_t cur_size_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::thread thread_;
+    bool done_;
+};
+
+#endif // HIT_WRITER_H
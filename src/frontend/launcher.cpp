@@ -0,0 +1,334 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <new>
+#include <cerrno>
+#include <ctime>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <anydsl_runtime.hpp>
+
+#include "launcher.h"
+#include "loaders.h"
+#include "hit_writer.h"
+
+// Shards are a multiple of this number of rays, so that they can be split in packets
+static const size_t shard_align = 64;
+
+/// Results of a worker, in memory shared with the launcher
+struct WorkerResult {
+    int status;
+    size_t first, count;
+    double median;          // Median iteration time, in microseconds
+    long long start, end;   // Time at which the timed iterations start and end
+    size_t intr;
+};
+
+/// Memory shared between the launcher and the workers
+struct SharedState {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int ready;              // Number of workers ready to start, or -1 when they must give up
+};
+
+static bool init_state(SharedState* state) {
+    pthread_mutexattr_t mutex_attr;
+    pthread_condattr_t cond_attr;
+    pthread_mutexattr_init(&mutex_attr);
+    pthread_condattr_init(&cond_attr);
+    // A worker may die while holding the mutex, which must not block the others
+    bool ok = pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED) == 0 &&
+              pthread_mutexattr_setrobust(&mutex_attr, PTHREAD_MUTEX_ROBUST) == 0 &&
+              pthread_condattr_setpshared(&cond_attr, PTHREAD_PROCESS_SHARED) == 0 &&
+              pthread_mutex_init(&state->mutex, &mutex_attr) == 0 &&
+              pthread_cond_init(&state->cond, &cond_attr) == 0;
+    pthread_mutexattr_destroy(&mutex_attr);
+    pthread_condattr_destroy(&cond_attr);
+    state->ready = 0;
+    return ok;
+}
+
+static void lock_state(SharedState* state) {
+    if (pthread_mutex_lock(&state->mutex) == EOWNERDEAD) pthread_mutex_consistent(&state->mutex);
+}
+
+/// Waits for a change of the state, for at most the given time
+static void wait_state(SharedState* state, long ms) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += ms / 1000;
+    deadline.tv_nsec += (ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    if (pthread_cond_timedwait(&state->cond, &state->mutex, &deadline) == EOWNERDEAD)
+        pthread_mutex_consistent(&state->mutex);
+}
+
+/// Tells the workers that are waiting to give up
+static void release_workers(SharedState* state) {
+    lock_state(state);
+    state->ready = -1;
+    pthread_cond_broadcast(&state->cond);
+    pthread_mutex_unlock(&state->mutex);
+}
+
+static std::vector<int> allowed_cpus() {
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &set) != 0) return cpus;
+    for (int i = 0; i < CPU_SETSIZE; i++) {
+        if (CPU_ISSET(i, &set)) cpus.push_back(i);
+    }
+    return cpus;
+}
+
+static int cpu_socket(int cpu) {
+    std::ifstream in("/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/physical_package_id");
+    int socket = 0;
+    in >> socket;
+    return socket;
+}
+
+/// Returns the CPUs every worker is pinned to. When there are more workers than sockets,
+/// the workers on the same socket get an equal share of its cores.
+static bool worker_cpus(int workers, const std::string& pin, std::vector<std::vector<int>>& sets) {
+    sets.assign(workers, std::vector<int>());
+    if (pin == "none") return true;
+
+    std::vector<std::vector<int>> groups;
+    if (pin == "core") {
+        groups.push_back(allowed_cpus());
+    } else if (pin == "socket") {
+        std::map<int, std::vector<int>> sockets;
+        for (auto cpu : allowed_cpus()) sockets[cpu_socket(cpu)].push_back(cpu);
+        for (auto& socket : sockets) groups.push_back(socket.second);
+    } else {
+        return false;
+    }
+    if (groups.empty() || groups[0].empty()) return false;
+
+    const int group_count = groups.size();
+    for (int g = 0; g < group_count; g++) {
+        const std::vector<int>& cpus = groups[g];
+        const int n = (workers - g + group_count - 1) / group_count;
+        for (int i = 0; i < n; i++) {
+            // Split the group evenly, but give at least one CPU to every worker
+            size_t begin = cpus.size() * i / n, end = cpus.size() * (i + 1) / n;
+            if (begin == end) end = begin + 1;
+            for (size_t j = begin; j < end; j++) sets[g + i * group_count].push_back(cpus[j % cpus.size()]);
+        }
+    }
+    return true;
+}
+
+static void pin_worker(const std::vector<int>& cpus) {
+    if (cpus.empty()) return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto cpu : cpus) CPU_SET(cpu, &set);
+    sched_setaffinity(0, sizeof(cpu_set_t), &set);
+}
+
+static int run_worker(const LaunchOptions& options, SharedState* state, WorkerResult& result, Hit* hits) {
+    // Load everything before waiting for the other workers, so that they all start the timed iterations together
+    anydsl::Array<Node> nodes;
+    anydsl::Array<Vec4> tris;
+    MappedFile accel_map, rays_map;
+    Node* nodes_ptr = nullptr;
+    Vec4* tris_ptr = nullptr;
+    bool ok = true;
+    if (map_accel(options.accel_file, accel_map, nodes_ptr, tris_ptr)) {
+        // All the workers share the pages of the mapping
+    } else if (load_accel(options.accel_file, nodes, tris)) {
+        nodes_ptr = nodes.data();
+        tris_ptr = tris.data();
+    } else {
+        ok = false;
+    }
+
+    anydsl::Array<Ray> rays;
+    Ray* rays_ptr = nullptr;
+    size_t mapped_count;
+    if (options.map && map_rays(options.rays_file, rays_map, rays_ptr, mapped_count)) {
+        rays_ptr += result.first;
+    } else {
+        std::ifstream in;
+        rays::Header header;
+        rays = std::move(anydsl::Array<Ray>(std::max(result.count, (size_t)1)));
+        rays_ptr = rays.data();
+        ok &= open_rays(options.rays_file, in, header) &&
+              in.seekg(rays::data_offset(header) + rays::ray_size((rays::Layout)header.layout) * result.first) &&
+              read_rays(in, header, rays_ptr, result.count, options.tmin, options.tmax) == result.count;
+    }
+
+    // Sleep until all the workers are ready, rather than spinning on the pinned cores.
+    // The launcher releases the workers if one of them dies, and they give up if the launcher dies.
+    const pid_t launcher = getppid();
+    lock_state(state);
+    state->ready++;
+    pthread_cond_broadcast(&state->cond);
+    while (state->ready >= 0 && state->ready < options.workers && getppid() == launcher) wait_state(state, 1000);
+    const bool start = state->ready >= options.workers;
+    pthread_mutex_unlock(&state->mutex);
+    if (!ok || !start) return 1;
+
+    auto traversal = options.any ? occluded : intersect;
+    for (int i = 0; i < options.warmup; i++) {
+        traversal(nodes_ptr, tris_ptr, rays_ptr, hits, result.count);
+    }
+
+    std::vector<double> iter_times(options.times);
+    result.start = get_time();
+    for (int i = 0; i < options.times; i++) {
+        long long t0 = get_time();
+        traversal(nodes_ptr, tris_ptr, rays_ptr, hits, result.count);
+        long long t1 = get_time();
+        iter_times[i] = t1 - t0;
+    }
+    result.end = get_time();
+
+    std::sort(iter_times.begin(), iter_times.end());
+    result.median = iter_times[options.times / 2];
+    result.intr = 0;
+    for (size_t i = 0; i < result.count; i++) {
+        if (hits[i].tri_id >= 0) result.intr++;
+    }
+    return 0;
+}
+
+bool run_workers(const LaunchOptions& options) {
+    if (anydsl::Platform::TRAVERSAL_PLATFORM != anydsl::Platform::Host) {
+        std::cerr << "Worker processes are only supported on the CPU." << std::endl;
+        return false;
+    }
+
+    std::vector<std::vector<int>> cpus;
+    if (options.workers <= 0 || options.times <= 0 || !worker_cpus(options.workers, options.pin, cpus)) {
+        std::cerr << "Invalid worker count, iteration count or pinning mode." << std::endl;
+        return false;
+    }
+
+    std::ifstream in;
+    rays::Header header;
+    if (!open_rays(options.rays_file, in, header)) {
+        std::cerr << "Cannot load ray distribution file." << std::endl;
+        return false;
+    }
+    in.close();
+
+    const size_t ray_count = header.ray_count;
+    std::cout << ray_count << " ray(s) in the distribution file." << std::endl;
+
+    // The workers write their hits and results directly in memory shared with the launcher
+    const size_t results_offset = (sizeof(SharedState) + alignof(WorkerResult) - 1) / alignof(WorkerResult) * alignof(WorkerResult);
+    const size_t hits_offset = (results_offset + sizeof(WorkerResult) * options.workers + 63) / 64 * 64;
+    const size_t shared_size = hits_offset + sizeof(Hit) * (ray_count + shard_align);
+    void* ptr = mmap(nullptr, shared_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+        std::cerr << "Cannot allocate shared memory." << std::endl;
+        return false;
+    }
+    SharedState* state = new (ptr) SharedState;
+    if (!init_state(state)) {
+        std::cerr << "Cannot initialize the shared state of the workers." << std::endl;
+        munmap(ptr, shared_size);
+        return false;
+    }
+    WorkerResult* results = (WorkerResult*)((char*)ptr + results_offset);
+    Hit* hits = (Hit*)((char*)ptr + hits_offset);
+
+    std::vector<pid_t> pids;
+    for (int i = 0; i < options.workers; i++) {
+        WorkerResult& result = results[i];
+        result.status = -1;
+        result.first = std::min(ray_count * i / options.workers / shard_align * shard_align, ray_count);
+        const size_t last = i == options.workers - 1 ? ray_count : ray_count * (i + 1) / options.workers / shard_align * shard_align;
+        result.count = std::max(last, result.first) - result.first;
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            pin_worker(cpus[i]);
+            result.status = run_worker(options, state, result, hits + result.first);
+            _exit(result.status);
+        } else if (pid < 0) {
+            // Release the workers that are already waiting
+            release_workers(state);
+            break;
+        }
+        pids.push_back(pid);
+    }
+
+    // Wait for the workers to be ready. A worker that exits before that has failed
+    // (or was killed) while loading, and the others would otherwise wait for it forever.
+    bool ok = pids.size() == (size_t)options.workers;
+    std::vector<int> statuses(pids.size());
+    std::vector<bool> exited(pids.size(), false);
+    while (ok) {
+        lock_state(state);
+        if (state->ready >= 0 && state->ready < options.workers) wait_state(state, 100);
+        const bool waiting = state->ready >= 0 && state->ready < options.workers;
+        pthread_mutex_unlock(&state->mutex);
+        if (!waiting) break;
+
+        for (size_t i = 0; i < pids.size(); i++) {
+            if (!exited[i] && waitpid(pids[i], &statuses[i], WNOHANG) == pids[i]) {
+                exited[i] = true;
+                ok = false;
+            }
+        }
+        if (!ok) release_workers(state);
+    }
+
+    for (size_t i = 0; i < pids.size(); i++) {
+        int status = statuses[i];
+        ok &= (exited[i] || waitpid(pids[i], &status, 0) == pids[i]) && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+
+    if (ok) {
+        long long start = results[0].start, end = results[0].end;
+        size_t intr = 0;
+        for (int i = 0; i < options.workers; i++) {
+            const WorkerResult& result = results[i];
+            std::cout << "Worker " << i << ": " << result.count << " ray(s), "
+                      << (result.median > 0 ? result.count * 1000000.0 / result.median : 0.0) << " rays/sec." << std::endl;
+            start = std::min(start, result.start);
+            end = std::max(end, result.end);
+            intr += result.intr;
+        }
+
+        // The workers run at the same time, so the aggregate throughput is measured from the first start to the last end
+        const double total_time = end - start;
+        std::cout << total_time / 1000.0 << "ms for " << options.times << " iteration(s) on " << options.workers << " worker(s)." << std::endl;
+        std::cout << ray_count * options.times * 1000000.0 / total_time << " rays/sec." << std::endl;
+        std::cout << "# Aggregate: " << total_time / 1000.0 / options.times << " ms" << std::endl;
+        std::cout << intr << " intersection(s)." << std::endl;
+
+        // The writer starts a thread, so it can only be used once all the workers are forked
+        HitWriter writer;
+        if (!writer.open(options.output, options.format)) {
+            std::cerr << "Cannot open output file, or invalid output format." << std::endl;
+            ok = false;
+        } else {
+            writer.write(hits, ray_count);
+            if (!writer.close()) {
+                std::cerr << "Cannot write output file." << std::endl;
+                ok = false;
+            }
+        }
+    } else {
+        std::cerr << "A worker process failed." << std::endl;
+    }
+
+    pthread_cond_destroy(&state->cond);
+    pthread_mutex_destroy(&state->mutex);
+    munmap(ptr, shared_size);
+    return ok;
+}
@@ -0,0 +1,25 @@
+#ifndef LAUNCHER_H
+#define LAUNCHER_H
+
+#include <string>
+
+struct LaunchOptions {
+    std::string accel_file;
+    std::string rays_file;
+    std::string output, format;
+    int workers;
+    std::string pin;    // "none", "core" or "socket"
+    int times;
+    int warmup;
+    float tmin, tmax;
+    bool any;
+    bool map;
+};
+
+/// Splits the ray distribution across worker processes, which all map the same acceleration structure file.
+/// The workers are pinned to an equal share of the cores, or of the cores of one socket. The hits are merged
+/// in ray order and written to the output file. Only available when the traversal runs on the CPU.
+/// Must be called before any thread is started, since the workers are forked from the calling process.
+bool run_workers(const LaunchOptions& options);
+
+#endif // LAUNCHER_H
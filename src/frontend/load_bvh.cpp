@@ -1,10 +1,13 @@
 #include <string>
 #include <vector>
 #include <fstream>
+#include <cstring>
 #include <anydsl_runtime.hpp>
 
 #include "traversal.h"
 #include "bvh_format.h"
+#include "compression.h"
+#include "loaders.h"
 
 static inline float as_float(int i) {
     union {
@@ -15,24 +18,77 @@ static inline float as_float(int i) {
     return u.f;
 }
 
-bool load_accel(const std::string& filename, anydsl::Array<Node>& nodes_ref, anydsl::Array<Vec4>& tris_ref) {
-    std::ifstream in(filename, std::ifstream::binary);
-    if (!in || !check_header(in) || !locate_block(in, BlockType::BVH))
+static bool find_bvh(const MappedFile& file, const bvh::Header*& h, const Node*& nodes, const Vec4*& tris) {
+    if (!check_header(file.data(), file.size()))
+        return false;
+
+    size_t size;
+    const char* block = locate_block(file.data(), file.size(), BlockType::BVH, &size);
+    if (!block || size < sizeof(bvh::Header))
+        return false;
+
+    h = (const bvh::Header*)block;
+    if (size < sizeof(bvh::Header) + sizeof(Node) * h->node_count + sizeof(Vec4) * h->prim_count)
         return false;
 
-    bvh::Header h;
-    in.read((char*)&h, sizeof(bvh::Header));
+    nodes = (const Node*)(block + sizeof(bvh::Header));
+    tris  = (const Vec4*)(nodes + h->node_count);
+    return true;
+}
+
+bool load_accel(const MappedFile& file, anydsl::Array<Node>& nodes_ref, anydsl::Array<Vec4>& tris_ref) {
+    if (!check_header(file.data(), file.size()))
+        return false;
 
-    anydsl::Array<Node> host_nodes(h.node_count);
-    anydsl::Array<Vec4> host_tris(h.prim_count);
+    if (auto ch = locate_compressed_block(file.data(), file.size(), BlockType::BVH)) {
+        bvh::Header h;
+        memcpy(&h, original_header(ch), sizeof(bvh::Header));
 
-    in.read((char*)host_nodes.data(), sizeof(Node) * h.node_count);
-    in.read((char*)host_tris.data(), sizeof(Vec4) * h.prim_count);
+        // On the host, decompress directly to the final storage
+        const bool on_host = anydsl::Platform::TRAVERSAL_PLATFORM == anydsl::Platform::Host;
+        anydsl::Array<Node> host_nodes(h.node_count);
+        anydsl::Array<Vec4> host_tris(h.prim_count);
+        const uint64_t nodes_size = sizeof(Node) * h.node_count;
+        if (!decompress_block(file, ch, {
+                BlockSegment { sizeof(bvh::Header), nodes_size, host_nodes.data() },
+                BlockSegment { sizeof(bvh::Header) + nodes_size, sizeof(Vec4) * h.prim_count, host_tris.data() }
+            }))
+            return false;
 
-    tris_ref = std::move(anydsl::Array<Vec4>(anydsl::Platform::TRAVERSAL_PLATFORM, anydsl::Device(TRAVERSAL_DEVICE), h.prim_count));
-    anydsl::copy(host_tris, tris_ref);
-    nodes_ref = std::move(anydsl::Array<Node>(anydsl::Platform::TRAVERSAL_PLATFORM, anydsl::Device(TRAVERSAL_DEVICE), h.node_count));
-    anydsl::copy(host_nodes, nodes_ref);
+        if (on_host) {
+            nodes_ref = std::move(host_nodes);
+            tris_ref = std::move(host_tris);
+        } else {
+            tris_ref = std::move(anydsl::Array<Vec4>(anydsl::Platform::TRAVERSAL_PLATFORM, anydsl::Device(TRAVERSAL_DEVICE), h.prim_count));
+            anydsl::copy(host_tris, tris_ref);
+            nodes_ref = std::move(anydsl::Array<Node>(anydsl::Platform::TRAVERSAL_PLATFORM, anydsl::Device(TRAVERSAL_DEVICE), h.node_count));
+            anydsl::copy(host_nodes, nodes_ref);
+        }
+        return true;
+    }
+
+    const bvh::Header* h;
+    const Node* nodes;
+    const Vec4* tris;
+    if (!find_bvh(file, h, nodes, tris))
+        return false;
+    file.prefetch((const char*)nodes, sizeof(Node) * h->node_count + sizeof(Vec4) * h->prim_count);
+
+    // Copy directly from the mapped pages, without going through host arrays
+    tris_ref = std::move(anydsl::Array<Vec4>(anydsl::Platform::TRAVERSAL_PLATFORM, anydsl::Device(TRAVERSAL_DEVICE), h->prim_count));
+    anydsl_copy(0, tris, 0, tris_ref.device(), tris_ref.data(), 0, sizeof(Vec4) * h->prim_count);
+    nodes_ref = std::move(anydsl::Array<Node>(anydsl::Platform::TRAVERSAL_PLATFORM, anydsl::Device(TRAVERSAL_DEVICE), h->node_count));
+    anydsl_copy(0, nodes, 0, nodes_ref.device(), nodes_ref.data(), 0, sizeof(Node) * h->node_count);
 
     return true;
 }
+
+bool load_accel(const std::string& filename, anydsl::Array<Node>& nodes_ref, anydsl::Array<Vec4>& tris_ref) {
+    MappedFile file;
+    return file.open(filename) && load_accel(file, nodes_ref, tris_ref);
+}
+
+bool map_accel(const std::string&, MappedFile&, Node*&, Vec4*&) {
+    // Device kernels cannot read from a host mapping
+    return false;
+}
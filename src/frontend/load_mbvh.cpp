@@ -8,6 +8,22 @@
 
 #include "traversal.h"
 #include "bvh_format.h"
+#include "compression.h"
+#include "convert_mbvh.h"
+#include "loaders.h"
+#include "../builder/gpu_bvh.h"
+
+static_assert(sizeof(Node) == sizeof(cpu::Node), "CPU node layout does not match the kernels");
+static_assert(sizeof(Vec4) == sizeof(cpu::Vec4), "CPU vector layout does not match the kernels");
+
+// Layout of the triangles, which depends on the triangle test of the kernels. Scene files only store the first one.
+#if defined(TRAVERSAL_CPUE)
+static const TriLayout tri_layout = TriLayout::EDGES;
+#elif defined(TRAVERSAL_CPUP)
+static const TriLayout tri_layout = TriLayout::PLUECKER;
+#else
+static const TriLayout tri_layout = TriLayout::MOELLER;
+#endif
 
 static inline float as_float(int i) {
     union {
@@ -18,114 +34,145 @@ static inline float as_float(int i) {
     return u.f;
 }
 
-bool load_accel(const std::string& filename, anydsl::Array<Node>& nodes_ref, anydsl::Array<Vec4>& tris_ref) {
-    std::ifstream in(filename, std::ifstream::binary);
-    if (!in || !check_header(in) || !locate_block(in, BlockType::MBVH))
+static bool find_cpu_mbvh(const MappedFile& file, const cpu::Header*& h, const Node*& nodes, const Vec4*& tris) {
+    size_t size;
+    const char* block = locate_block(file.data(), file.size(), BlockType::CPU_MBVH, &size);
+    if (!block || size < sizeof(cpu::Header))
+        return false;
+
+    h = (const cpu::Header*)block;
+    if (size < sizeof(cpu::Header) + sizeof(Node) * h->node_count + sizeof(Vec4) * h->vert_count)
+        return false;
+
+    nodes = (const Node*)(block + sizeof(cpu::Header));
+    tris  = (const Vec4*)(nodes + h->node_count);
+    return true;
+}
+
+static void convert_accel(const mbvh::Header& h, const mbvh::Node* nodes, const float* vertices,
+                          anydsl::Array<Node>& nodes_ref, anydsl::Array<Vec4>& tris_ref) {
+    // Convert the nodes directly to the final storage, and re-pack their leaves as mbvh2cpu does
+    nodes_ref = std::move(anydsl::Array<Node>(h.node_count));
+    std::vector<cpu::Vec4> tris(cpu_vert_count(nodes, h.node_count));
+    convert_mbvh(nodes, h.node_count, vertices, (cpu::Node*)nodes_ref.data(), tris.data());
+
+    std::vector<cpu::Vec4> repacked_tris;
+    repack_leaves((cpu::Node*)nodes_ref.data(), h.node_count, tris.data(), repacked_tris);
+    tris_ref = std::move(anydsl::Array<Vec4>(repacked_tris.size()));
+    memcpy(tris_ref.data(), repacked_tris.data(), sizeof(Vec4) * repacked_tris.size());
+}
+
+static bool load_cpu_accel(const MappedFile& file, anydsl::Array<Node>& nodes_ref, anydsl::Array<Vec4>& tris_ref) {
+    if (!check_header(file.data(), file.size()))
+        return false;
+
+    // Use the block in the layout of the kernels when the file has one
+    const cpu::Header* cpu_header;
+    const Node* cpu_nodes;
+    const Vec4* cpu_tris;
+    if (find_cpu_mbvh(file, cpu_header, cpu_nodes, cpu_tris)) {
+        file.prefetch((const char*)cpu_nodes, sizeof(Node) * cpu_header->node_count + sizeof(Vec4) * cpu_header->vert_count);
+        nodes_ref = std::move(anydsl::Array<Node>(cpu_header->node_count));
+        memcpy(nodes_ref.data(), cpu_nodes, sizeof(Node) * cpu_header->node_count);
+        tris_ref = std::move(anydsl::Array<Vec4>(cpu_header->vert_count));
+        memcpy(tris_ref.data(), cpu_tris, sizeof(Vec4) * cpu_header->vert_count);
+        return true;
+    }
+
+    // Compressed blocks are decompressed directly to the final storage
+    if (auto ch = locate_compressed_block(file.data(), file.size(), BlockType::CPU_MBVH)) {
+        cpu::Header h;
+        memcpy(&h, original_header(ch), sizeof(cpu::Header));
+        nodes_ref = std::move(anydsl::Array<Node>(h.node_count));
+        tris_ref = std::move(anydsl::Array<Vec4>(h.vert_count));
+        const uint64_t nodes_size = sizeof(Node) * h.node_count;
+        return decompress_block(file, ch, {
+            BlockSegment { sizeof(cpu::Header), nodes_size, nodes_ref.data() },
+            BlockSegment { sizeof(cpu::Header) + nodes_size, sizeof(Vec4) * h.vert_count, tris_ref.data() }
+        });
+    }
+
+    size_t size;
+    const char* block = locate_block(file.data(), file.size(), BlockType::MBVH, &size);
+    if (block && size >= sizeof(mbvh::Header)) {
+        mbvh::Header h;
+        memcpy(&h, block, sizeof(mbvh::Header));
+        if (size < sizeof(mbvh::Header) + sizeof(mbvh::Node) * h.node_count + sizeof(float) * 4 * h.vert_count)
+            return false;
+        file.prefetch(block, size);
+
+        // Nodes and vertices are read in place from the mapped file
+        const mbvh::Node* nodes = (const mbvh::Node*)(block + sizeof(mbvh::Header));
+        const float* vertices = (const float*)(nodes + h.node_count);
+        convert_accel(h, nodes, vertices, nodes_ref, tris_ref);
+        return true;
+    }
+
+    if (auto ch = locate_compressed_block(file.data(), file.size(), BlockType::MBVH)) {
+        mbvh::Header h;
+        memcpy(&h, original_header(ch), sizeof(mbvh::Header));
+        std::vector<mbvh::Node> nodes(h.node_count);
+        std::vector<float> vertices(4 * h.vert_count);
+        const uint64_t nodes_size = sizeof(mbvh::Node) * h.node_count;
+        if (!decompress_block(file, ch, {
+                BlockSegment { sizeof(mbvh::Header), nodes_size, nodes.data() },
+                BlockSegment { sizeof(mbvh::Header) + nodes_size, sizeof(float) * vertices.size(), vertices.data() }
+            }))
+            return false;
+        convert_accel(h, nodes.data(), vertices.data(), nodes_ref, tris_ref);
+        return true;
+    }
+
+    // Files with only the binary BVH of the GPU kernels are collapsed to an MBVH at load time
+    GpuBvh gpu_bvh;
+    if (read_gpu_bvh(file, gpu_bvh)) {
+        const Mbvh mbvh = collapse_gpu_bvh(gpu_bvh);
+        convert_accel(mbvh.header, mbvh.nodes.data(), (const float*)mbvh.tris.data(), nodes_ref, tris_ref);
+        return true;
+    }
+
+    return false;
+}
+
+bool load_accel(const MappedFile& file, anydsl::Array<Node>& nodes_ref, anydsl::Array<Vec4>& tris_ref) {
+    if (!load_cpu_accel(file, nodes_ref, tris_ref))
         return false;
 
-    mbvh::Header h;
-    in.read((char*)&h, sizeof(mbvh::Header));
-
-    // Read nodes
-    std::vector<mbvh::Node> nodes(h.node_count);
-    in.read((char*)nodes.data(), sizeof(mbvh::Node) * h.node_count);
-    assert(in.gcount() == sizeof(mbvh::Node) * h.node_count);
-
-    // Read vertices
-    std::vector<float> vertices(4 * h.vert_count);
-    in.read((char*)vertices.data(), sizeof(float) * 4 * h.vert_count);
-    assert(in.gcount() == sizeof(float) * 4 * h.vert_count);
-    
-    std::vector<Node> node_stack;
-    std::vector<Vec4> tri_stack;
-
-    auto leaf_node = [&] (const mbvh::Node& node, int c) {
-        int node_id = ~(tri_stack.size());
-
-        for (int i = 0; i < node.prim_count[c]; i++) {
-            union{
-                struct {
-                    Vec4 v0_x, v0_y, v0_z;
-                    Vec4 e1_x, e1_y, e1_z;
-                    Vec4 e2_x, e2_y, e2_z;
-                    Vec4 n_x, n_y, n_z;
-                    Vec4 ids;
-                } tri_data;
-                float raw_data[4 * 13];
-            } tri;
-
-            memcpy(tri.raw_data, vertices.data() + node.children[c] * 4 + i * 4 * 13, sizeof(float) * 4 * 13);
-
-            tri_stack.push_back(tri.tri_data.v0_x);
-            tri_stack.push_back(tri.tri_data.v0_y);
-            tri_stack.push_back(tri.tri_data.v0_z);
-            tri_stack.push_back(tri.tri_data.e1_x);
-            tri_stack.push_back(tri.tri_data.e1_y);
-            tri_stack.push_back(tri.tri_data.e1_z);
-            tri_stack.push_back(tri.tri_data.e2_x);
-            tri_stack.push_back(tri.tri_data.e2_y);
-            tri_stack.push_back(tri.tri_data.e2_z);
-            tri_stack.push_back(tri.tri_data.n_x);
-            tri_stack.push_back(tri.tri_data.n_y);
-            tri_stack.push_back(tri.tri_data.n_z);
-            tri_stack.push_back(tri.tri_data.ids);
-        }
-
-        // Insert sentinel
-        Vec4 sentinel = { -0.0f, -0.0f, -0.0f, -0.0f };
-        tri_stack.push_back(sentinel);
-        return node_id;
-    };
-
-    for (int i = 0; i < h.node_count; i++) {
-        const mbvh::Node& src_node = nodes[i];
-        Node dst_node;
-        int k = 0;
-        for (int j = 0  ; j < 4; j++) {
-            if (src_node.prim_count[j] == 0) {
-                // Empty leaf
-                continue;
-            }
-
-            dst_node.min_x[k] = src_node.bb[j].lx;
-            dst_node.min_y[k] = src_node.bb[j].ly;
-            dst_node.min_z[k] = src_node.bb[j].lz;
-
-            dst_node.max_x[k] = src_node.bb[j].ux;
-            dst_node.max_y[k] = src_node.bb[j].uy;
-            dst_node.max_z[k] = src_node.bb[j].uz;
-
-            if (src_node.prim_count[j] < 0) {
-                // Inner node
-                dst_node.children[k] = src_node.children[j];
-            } else {
-                // Leaf
-                dst_node.children[k] = leaf_node(src_node, j);
-            }
-
-            k++;
-        }
-
-        for (; k < 4; k++) {
-            dst_node.min_x[k] = 1.0f;
-            dst_node.min_y[k] = 1.0f;
-            dst_node.min_z[k] = 1.0f;
-
-            dst_node.max_x[k] = -1.0f;
-            dst_node.max_y[k] = -1.0f;
-            dst_node.max_z[k] = -1.0f;
-
-            dst_node.children[k] = 0;
-        }
-
-        node_stack.push_back(dst_node);
+    if (tri_layout != TriLayout::MOELLER) {
+        // The Pluecker layout takes its vertices from the mesh, when the file has one
+        std::vector<int> indices;
+        std::vector<float> vertices;
+        const bool has_mesh = tri_layout == TriLayout::PLUECKER && load_mesh(file, indices, vertices);
+
+        std::vector<cpu::Vec4> tris;
+        convert_tris((cpu::Node*)nodes_ref.data(), nodes_ref.size(), (const cpu::Vec4*)tris_ref.data(), tri_layout, tris,
+                     has_mesh ? &indices : nullptr, has_mesh ? &vertices : nullptr);
+        tris_ref = std::move(anydsl::Array<Vec4>(tris.size()));
+        memcpy(tris_ref.data(), tris.data(), sizeof(Vec4) * tris.size());
     }
+    return true;
+}
+
+bool load_accel(const std::string& filename, anydsl::Array<Node>& nodes_ref, anydsl::Array<Vec4>& tris_ref) {
+    MappedFile file;
+    return file.open(filename) && load_accel(file, nodes_ref, tris_ref);
+}
 
-    nodes_ref = std::move(anydsl::Array<Node>(node_stack.size()));
-    std::copy(node_stack.begin(), node_stack.end(), nodes_ref.begin());
+bool map_accel(const std::string& filename, MappedFile& file, Node*& nodes_ptr, Vec4*& tris_ptr) {
+    // Only the block in the layout of the kernels can be used in place
+    if (tri_layout != TriLayout::MOELLER)
+        return false;
 
-    tris_ref = std::move(anydsl::Array<Vec4>(tri_stack.size()));
-    std::copy(tri_stack.begin(), tri_stack.end(), tris_ref.begin());
+    const cpu::Header* h;
+    const Node* nodes;
+    const Vec4* tris;
+    if (!file.open(filename) || !check_header(file.data(), file.size()) || !find_cpu_mbvh(file, h, nodes, tris)) {
+        file.close();
+        return false;
+    }
 
+    // The kernels only read from these arrays, the mapping itself is read-only
+    nodes_ptr = const_cast<Node*>(nodes);
+    tris_ptr  = const_cast<Vec4*>(tris);
     return true;
 }
@@ -0,0 +1,50 @@
+#include <string>
+#include <vector>
+#include <cstring>
+#include <anydsl_runtime.hpp>
+
+#include "traversal.h"
+#include "bvh_format.h"
+#include "convert_mbvh.h"
+#include "loaders.h"
+#include "../builder/mbvh.h"
+#include "../builder/gpu_bvh.h"
+
+static_assert(sizeof(Node) == sizeof(cpu::Node8), "8-wide CPU node layout does not match the kernels");
+static_assert(sizeof(Vec4) == sizeof(cpu::Vec4), "CPU vector layout does not match the kernels");
+
+bool load_accel(const MappedFile& file, anydsl::Array<Node>& nodes_ref, anydsl::Array<Vec4>& tris_ref) {
+    if (!check_header(file.data(), file.size()))
+        return false;
+
+    // The 8-wide nodes are built from the MBVH, or from the binary BVH of the GPU kernels when there is none
+    Mbvh mbvh;
+    if (!read_mbvh(file, mbvh)) {
+        GpuBvh gpu_bvh;
+        if (!read_gpu_bvh(file, gpu_bvh))
+            return false;
+        mbvh = collapse_gpu_bvh(gpu_bvh);
+    }
+
+    std::vector<cpu::Node8> nodes;
+    std::vector<cpu::Vec4> tris;
+    convert_mbvh8(mbvh.nodes.data(), mbvh.nodes.size(), (const float*)mbvh.tris.data(), nodes, tris);
+    if (nodes.empty())
+        return false;
+
+    nodes_ref = std::move(anydsl::Array<Node>(nodes.size()));
+    memcpy(nodes_ref.data(), nodes.data(), sizeof(Node) * nodes.size());
+    tris_ref = std::move(anydsl::Array<Vec4>(tris.size()));
+    memcpy(tris_ref.data(), tris.data(), sizeof(Vec4) * tris.size());
+    return true;
+}
+
+bool load_accel(const std::string& filename, anydsl::Array<Node>& nodes_ref, anydsl::Array<Vec4>& tris_ref) {
+    MappedFile file;
+    return file.open(filename) && load_accel(file, nodes_ref, tris_ref);
+}
+
+bool map_accel(const std::string&, MappedFile&, Node*&, Vec4*&) {
+    // Scene files do not store the 8-wide layout, it is always built at load time
+    return false;
+}
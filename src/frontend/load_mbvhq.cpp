@@ -0,0 +1,73 @@
+#include <string>
+#include <vector>
+#include <cstring>
+#include <anydsl_runtime.hpp>
+
+#include "traversal.h"
+#include "bvh_format.h"
+#include "convert_mbvh.h"
+#include "loaders.h"
+#include "../builder/mbvh.h"
+#include "../builder/gpu_bvh.h"
+
+static_assert(sizeof(Node) == sizeof(cpu::QNode), "Quantized CPU node layout does not match the kernels");
+static_assert(sizeof(Vec4) == sizeof(cpu::Vec4), "CPU vector layout does not match the kernels");
+
+bool load_accel(const MappedFile& file, anydsl::Array<Node>& nodes_ref, anydsl::Array<Vec4>& tris_ref) {
+    if (!check_header(file.data(), file.size()))
+        return false;
+
+    // The nodes are quantized from the block in the layout of the kernels, or from the MBVH converted to that layout
+    const cpu::Node* nodes = nullptr;
+    const cpu::Vec4* tris = nullptr;
+    size_t node_count = 0, vert_count = 0;
+    std::vector<cpu::Node> converted_nodes;
+    std::vector<cpu::Vec4> converted_tris;
+
+    size_t size;
+    const char* block = locate_block(file.data(), file.size(), BlockType::CPU_MBVH, &size);
+    const cpu::Header* h = (const cpu::Header*)block;
+    if (block && size >= sizeof(cpu::Header) &&
+        size >= sizeof(cpu::Header) + sizeof(cpu::Node) * h->node_count + sizeof(cpu::Vec4) * h->vert_count) {
+        nodes = (const cpu::Node*)(block + sizeof(cpu::Header));
+        tris = (const cpu::Vec4*)(nodes + h->node_count);
+        node_count = h->node_count;
+        vert_count = h->vert_count;
+    } else {
+        Mbvh mbvh;
+        if (!read_mbvh(file, mbvh)) {
+            GpuBvh gpu_bvh;
+            if (!read_gpu_bvh(file, gpu_bvh))
+                return false;
+            mbvh = collapse_gpu_bvh(gpu_bvh);
+        }
+        converted_nodes.resize(mbvh.nodes.size());
+        std::vector<cpu::Vec4> mbvh_tris(cpu_vert_count(mbvh.nodes.data(), mbvh.nodes.size()));
+        convert_mbvh(mbvh.nodes.data(), mbvh.nodes.size(), (const float*)mbvh.tris.data(), converted_nodes.data(), mbvh_tris.data());
+
+        // Re-pack the leaves as mbvh2cpu does, stored blocks are used as they are
+        repack_leaves(converted_nodes.data(), converted_nodes.size(), mbvh_tris.data(), converted_tris);
+        nodes = converted_nodes.data();
+        tris = converted_tris.data();
+        node_count = converted_nodes.size();
+        vert_count = converted_tris.size();
+    }
+    if (node_count == 0)
+        return false;
+
+    nodes_ref = std::move(anydsl::Array<Node>(node_count));
+    quantize_nodes(nodes, node_count, (cpu::QNode*)nodes_ref.data());
+    tris_ref = std::move(anydsl::Array<Vec4>(vert_count));
+    memcpy(tris_ref.data(), tris, sizeof(Vec4) * vert_count);
+    return true;
+}
+
+bool load_accel(const std::string& filename, anydsl::Array<Node>& nodes_ref, anydsl::Array<Vec4>& tris_ref) {
+    MappedFile file;
+    return file.open(filename) && load_accel(file, nodes_ref, tris_ref);
+}
+
+bool map_accel(const std::string&, MappedFile&, Node*&, Vec4*&) {
+    // Scene files do not store the quantized layout, it is always built at load time
+    return false;
+}
@@ -1,23 +1,60 @@
 #include <string>
 #include <vector>
 #include <fstream>
+#include <cstring>
 
 #include "traversal.h"
 #include "bvh_format.h"
+#include "compression.h"
+#include "loaders.h"
 
-bool load_mesh(const std::string& filename, std::vector<int>& indices, std::vector<float>& vertices) {
-    std::ifstream in(filename, std::ifstream::binary);
-    if (!in || !check_header(in) || !locate_block(in, BlockType::MESH))
+bool load_mesh(const MappedFile& file, std::vector<int>& indices, std::vector<float>& vertices) {
+    if (!check_header(file.data(), file.size()))
+        return false;
+
+    if (auto ch = locate_compressed_block(file.data(), file.size(), BlockType::MESH)) {
+        mesh::Header h;
+        memcpy(&h, original_header(ch), sizeof(mesh::Header));
+        indices.resize(h.tri_count * 3);
+        vertices.resize(h.vert_count * 4);
+        const uint64_t vertices_size = sizeof(float) * vertices.size();
+        return decompress_block(file, ch, {
+            BlockSegment { sizeof(mesh::Header), vertices_size, vertices.data() },
+            BlockSegment { sizeof(mesh::Header) + vertices_size, sizeof(int) * indices.size(), indices.data() }
+        });
+    }
+
+    size_t size;
+    const char* block = locate_block(file.data(), file.size(), BlockType::MESH, &size);
+    if (!block || size < sizeof(mesh::Header))
         return false;
 
     mesh::Header h;
-    in.read((char*)&h, sizeof(mesh::Header));
+    memcpy(&h, block, sizeof(mesh::Header));
+    if (size < sizeof(mesh::Header) + sizeof(float) * 4 * h.vert_count + sizeof(int) * 3 * h.tri_count)
+        return false;
+    file.prefetch(block, size);
 
     indices.resize(h.tri_count * 3);
     vertices.resize(h.vert_count * 4);
 
-    in.read((char*)vertices.data(), sizeof(float) * 4 * h.vert_count);
-    in.read((char*)indices.data(), sizeof(int) * 3 * h.tri_count);
+    const char* ptr = block + sizeof(mesh::Header);
+    memcpy(vertices.data(), ptr, sizeof(float) * 4 * h.vert_count);
+    memcpy(indices.data(), ptr + sizeof(float) * 4 * h.vert_count, sizeof(int) * 3 * h.tri_count);
 
     return true;
 }
+
+bool load_mesh(const std::string& filename, std::vector<int>& indices, std::vector<float>& vertices) {
+    MappedFile file;
+    return file.open(filename) && load_mesh(file, indices, vertices);
+}
+
+bool load_scene(const std::string& filename,
+                anydsl::Array<Node>& nodes_ref, anydsl::Array<Vec4>& tris_ref,
+                std::vector<int>& indices, std::vector<float>& vertices) {
+    MappedFile file;
+    return file.open(filename) &&
+           load_accel(file, nodes_ref, tris_ref) &&
+           load_mesh(file, indices, vertices);
+}
@@ -2,36 +2,65 @@
 #include <string>
 #include <anydsl_runtime.hpp>
 #include "traversal.h"
+#include "ray_format.h"
+#include "mapped_file.h"
 
-bool load_rays(const std::string& filename, anydsl::Array<Ray>& rays_ref, float tmin, float tmax) {
-    std::ifstream in(filename, std::ifstream::binary);
+static_assert(sizeof(Ray) == sizeof(float) * 8, "Ray does not match the ray file layout");
+
+bool open_rays(const std::string& filename, std::ifstream& in, rays::Header& header) {
+    in.open(filename, std::ifstream::binary);
     if (!in) return false;
 
     in.seekg(0, std::ifstream::end);
-    int count = in.tellg() / (sizeof(float) * 6);
-
-    anydsl::Array<Ray> host_rays(count);
+    size_t size = in.tellg();
     in.seekg(0);
 
-    for (int i = 0; i < count; i++) {
-        float org_dir[6];
-        in.read((char*)org_dir, sizeof(float) * 6);
-        Ray& ray = host_rays.data()[i];
+    return rays::read_header(in, size, header);
+}
 
-        ray.org.x = org_dir[0];
-        ray.org.y = org_dir[1];
-        ray.org.z = org_dir[2];
+size_t read_rays(std::istream& in, const rays::Header& header, Ray* rays, size_t count, float tmin, float tmax) {
+    // Read all the rays at once in the destination buffer, then expand them in place
+    const size_t ray_size = rays::ray_size((rays::Layout)header.layout);
+    in.read((char*)rays, ray_size * count);
+    count = in.gcount() / ray_size;
 
-        ray.dir.x = org_dir[3];
-        ray.dir.y = org_dir[4];
-        ray.dir.z = org_dir[5];
+    rays::expand_rays(header, (float*)rays, count, tmin, tmax);
+    return count;
+}
 
-        ray.org.w = tmin;
-        ray.dir.w = tmax;
-    }
+bool load_rays(const std::string& filename, anydsl::Array<Ray>& rays_ref, float tmin, float tmax) {
+    std::ifstream in;
+    rays::Header header;
+    if (!open_rays(filename, in, header)) return false;
+
+    const size_t count = header.ray_count;
+    anydsl::Array<Ray> host_rays(count);
+    if (read_rays(in, header, host_rays.data(), count, tmin, tmax) != count) return false;
 
     rays_ref = std::move(anydsl::Array<Ray>(anydsl::Platform::TRAVERSAL_PLATFORM, anydsl::Device(TRAVERSAL_DEVICE), count));
     anydsl::copy(host_rays, rays_ref);
 
     return true;
 }
+
+bool map_rays(const std::string& filename, MappedFile& file, Ray*& rays_ptr, size_t& count) {
+    if (anydsl::Platform::TRAVERSAL_PLATFORM != anydsl::Platform::Host) return false;
+    if (!file.open(filename) || file.size() < sizeof(rays::Header)) return false;
+
+    // Only files that store the rays exactly as the kernels expect them can be used directly
+    rays::Header header;
+    memcpy(&header, file.data(), sizeof(rays::Header));
+    if (header.magic != rays::magic ||
+        header.version != rays::version ||
+        header.layout != (uint32_t)rays::Layout::RAY ||
+        !(header.flags & rays::INTERVALS) ||
+        sizeof(rays::Header) + sizeof(Ray) * header.ray_count > file.size()) {
+        file.close();
+        return false;
+    }
+
+    // The kernels only read the rays
+    rays_ptr = (Ray*)(file.data() + sizeof(rays::Header));
+    count = header.ray_count;
+    return true;
+}
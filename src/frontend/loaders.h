@@ -2,10 +2,32 @@
 #define LOADERS_H
 
 #include <string>
+#include <vector>
+#include <fstream>
+#include <anydsl_runtime.hpp>
 #include "traversal.h"
+#include "mapped_file.h"
+#include "ray_format.h"
 
 bool load_accel(const std::string& filename, anydsl::Array<Node>& nodes_ref, anydsl::Array<Vec4>& tris_ref);
+bool load_accel(const MappedFile& file, anydsl::Array<Node>& nodes_ref, anydsl::Array<Vec4>& tris_ref);
+/// Maps the acceleration structure file and points the arrays directly into the
+/// mapping. Fails if the file does not store the kernel layout for this platform.
+bool map_accel(const std::string& filename, MappedFile& file, Node*& nodes_ptr, Vec4*& tris_ptr);
+/// Loads a ray distribution file. The tmin and tmax arguments are used when the file has no per-ray intervals.
 bool load_rays(const std::string& filename, anydsl::Array<Ray>& rays_ref, float tmin, float tmax);
+/// Maps a ray distribution file and points the rays directly into the mapping.
+/// Fails if the file does not store the rays in the kernel layout, with their intervals.
+bool map_rays(const std::string& filename, MappedFile& file, Ray*& rays_ptr, size_t& count);
+/// Opens a ray distribution file to read it in chunks, and gives its header.
+bool open_rays(const std::string& filename, std::ifstream& in, rays::Header& header);
+/// Reads and converts the next rays of a file opened with open_rays. Returns the number of rays read.
+size_t read_rays(std::istream& in, const rays::Header& header, Ray* rays, size_t count, float tmin, float tmax);
 bool load_mesh(const std::string& filename, std::vector<int>& indices, std::vector<float>& vertices);
+bool load_mesh(const MappedFile& file, std::vector<int>& indices, std::vector<float>& vertices);
+/// Loads the acceleration structure and the mesh of a scene, opening the file only once.
+bool load_scene(const std::string& filename,
+                anydsl::Array<Node>& nodes_ref, anydsl::Array<Vec4>& tris_ref,
+                std::vector<int>& indices, std::vector<float>& vertices);
 
 #endif
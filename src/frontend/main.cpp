@@ -1,13 +1,226 @@
 #include <iostream>
 #include <fstream>
 #include <chrono>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
 #include <functional>
 #include <numeric>
+#include <thread>
+#include <vector>
 #include <anydsl_runtime.hpp>
 
 #include "options.h"
 #include "traversal.h"
 #include "loaders.h"
+#include "hit_writer.h"
+#include "compression.h"
+#include "server.h"
+#include "launcher.h"
+#include "batch.h"
+#include "refit.h"
+#include "parallel.h"
+
+typedef decltype(&intersect) TraversalFn;
+
+// Chunks are a multiple of this number of rays, so that they can be split in packets
+static const int chunk_align = 64;
+
+/// Traverses a ray distribution chunk by chunk, so that it does not need to fit in memory.
+/// While the kernel runs on a chunk, the next chunk is read and the hits of the previous one are written.
+static bool stream_rays(TraversalFn traversal, Node* nodes, Vec4* tris,
+                        const std::string& rays_file, HitWriter& writer,
+                        int chunk_size, float tmin, float tmax, int warmup) {
+    std::ifstream in;
+    rays::Header header;
+    if (!open_rays(rays_file, in, header)) {
+        std::cerr << "Cannot load ray distribution file." << std::endl;
+        return false;
+    }
+
+    const size_t ray_count = header.ray_count;
+    std::cout << ray_count << " ray(s) in the distribution file." << std::endl;
+
+    chunk_size = (chunk_size + chunk_align - 1) / chunk_align * chunk_align;
+
+    // Two chunks are in flight: one is traversed while the other is read or written.
+    // On the host, the kernels directly use these buffers.
+    const bool on_host = anydsl::Platform::TRAVERSAL_PLATFORM == anydsl::Platform::Host;
+    anydsl::Array<Ray> host_rays[2] = { anydsl::Array<Ray>(chunk_size), anydsl::Array<Ray>(chunk_size) };
+    anydsl::Array<Hit> host_hits[2] = { anydsl::Array<Hit>(chunk_size), anydsl::Array<Hit>(chunk_size) };
+    anydsl::Array<Ray> dev_rays;
+    anydsl::Array<Hit> dev_hits;
+    if (!on_host) {
+        dev_rays = std::move(anydsl::Array<Ray>(anydsl::Platform::TRAVERSAL_PLATFORM, anydsl::Device(TRAVERSAL_DEVICE), chunk_size));
+        dev_hits = std::move(anydsl::Array<Hit>(anydsl::Platform::TRAVERSAL_PLATFORM, anydsl::Device(TRAVERSAL_DEVICE), chunk_size));
+    }
+
+    size_t counts[2] = { 0, 0 };
+    auto read_chunk = [&] (int buf) {
+        Ray* rays = host_rays[buf].data();
+        size_t count = read_rays(in, header, rays, chunk_size, tmin, tmax);
+        // Pad the last chunk with rays that cannot hit anything
+        for (size_t i = count; i < (count + chunk_align - 1) / chunk_align * chunk_align; i++) {
+            rays[i].org = Vec4 { 0.0f, 0.0f, 0.0f, 1.0f };
+            rays[i].dir = Vec4 { 1.0f, 1.0f, 1.0f, 0.0f };
+        }
+        counts[buf] = count;
+    };
+
+    auto traverse_chunk = [&] (int buf) {
+        const int count = (counts[buf] + chunk_align - 1) / chunk_align * chunk_align;
+        if (on_host) {
+            traversal(nodes, tris, host_rays[buf].data(), host_hits[buf].data(), count);
+        } else {
+            anydsl::copy(host_rays[buf], 0, dev_rays, 0, count);
+            traversal(nodes, tris, dev_rays.data(), dev_hits.data(), count);
+            anydsl::copy(dev_hits, 0, host_hits[buf], 0, count);
+        }
+    };
+
+    int intr = 0;
+    auto write_chunk = [&] (int buf, size_t count) {
+        const Hit* hits = host_hits[buf].data();
+        for (size_t i = 0; i < count; i++) {
+            if (hits[i].tri_id >= 0) intr++;
+        }
+        writer.write(hits, count);
+    };
+
+    read_chunk(0);
+
+    // Warmup iterations on the first chunk
+    for (int i = 0; i < warmup && counts[0] > 0; i++) {
+        traverse_chunk(0);
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    double kernel_time = 0;
+    int chunks = 0;
+    for (int n = 0; ; n++) {
+        const int cur = n % 2, prev = 1 - cur;
+        if (counts[cur] == 0) {
+            if (n > 0) write_chunk(prev, counts[prev]);
+            break;
+        }
+
+        // Read chunk N+1 and write chunk N-1 in the background
+        const size_t prev_count = counts[prev];
+        std::thread writer;
+        if (n > 0) writer = std::thread(write_chunk, prev, prev_count);
+        std::thread reader(read_chunk, prev);
+
+        long long t0 = get_time();
+        traverse_chunk(cur);
+        long long t1 = get_time();
+        kernel_time += t1 - t0;
+        chunks++;
+
+        reader.join();
+        if (writer.joinable()) writer.join();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    double total_time = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+
+    std::cout << total_time / 1000.0 << "ms for " << chunks << " chunk(s) of " << chunk_size << " ray(s)." << std::endl;
+    std::cout << ray_count * 1000000.0 / total_time << " rays/sec." << std::endl;
+    std::cout << "# Total: " << total_time / 1000.0 << " ms" << std::endl;
+    std::cout << "# Kernel: " << kernel_time / 1000.0 << " ms" << std::endl;
+    std::cout << intr << " intersection(s)." << std::endl;
+
+    return true;
+}
+
+// The refitter only knows the layout of the cpu version (full-precision 4-wide nodes and precomputed triangles)
+#if defined(TRAVERSAL_CPU)
+static const bool can_refit = true;
+#else
+static const bool can_refit = false;
+#endif
+
+/// Deforms the mesh of the scene frame by frame, refits the acceleration structure and traverses the rays after every
+/// refit, so that the time spent refitting can be compared with the time spent traversing. The hits of the last frame
+/// are written. Only available when the traversal runs on the CPU.
+static bool refit_frames(TraversalFn traversal, anydsl::Array<Node>& nodes, anydsl::Array<Vec4>& tris,
+                         const std::string& accel_file, Ray* rays, Hit* hits, int ray_count,
+                         HitWriter& writer, int frames, int warmup) {
+    std::vector<int> indices;
+    std::vector<float> vertices;
+    if (!load_mesh(accel_file, indices, vertices)) {
+        std::cerr << "Cannot load the mesh of the acceleration structure file." << std::endl;
+        return false;
+    }
+
+    Refitter refitter;
+    if (!refitter.init((const cpu::Node*)nodes.data(), nodes.size(), (const cpu::Vec4*)tris.data(), tris.size(),
+                       indices, vertices.size() / 4)) {
+        std::cerr << "The acceleration structure does not match its mesh." << std::endl;
+        return false;
+    }
+
+    // The mesh moves as a wave of 1% of the size of the scene, so that the rays still hit it
+    float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    for (size_t i = 0; i < vertices.size(); i += 4) {
+        for (int k = 0; k < 3; k++) {
+            lo[k] = std::min(lo[k], vertices[i + k]);
+            hi[k] = std::max(hi[k], vertices[i + k]);
+        }
+    }
+    const float extent = std::max(std::max(hi[0] - lo[0], hi[1] - lo[1]), std::max(hi[2] - lo[2], 1e-6f));
+    const float amplitude = 0.01f * extent;
+    const float two_pi = 6.28318530718f;
+    const int vert_count = vertices.size() / 4;
+    const int vert_chunk = 4096;
+    std::vector<float> frame_vertices(vertices);
+    auto deform = [&] (int frame) {
+        const float phase = two_pi * frame / frames;
+        parallel_for(0, (vert_count + vert_chunk - 1) / vert_chunk, [&] (int chunk) {
+            for (int i = chunk * vert_chunk, n = std::min(vert_count, (chunk + 1) * vert_chunk); i < n; i++) {
+                const float* src = &vertices[i * 4];
+                float* dst = &frame_vertices[i * 4];
+                dst[0] = src[0] + amplitude * std::sin(phase + 4.0f * two_pi * (src[1] - lo[1]) / extent);
+                dst[2] = src[2] + amplitude * std::cos(phase + 4.0f * two_pi * (src[0] - lo[0]) / extent);
+            }
+        });
+    };
+
+    for (int i = 0; i < warmup; i++) {
+        traversal(nodes.data(), tris.data(), rays, hits, ray_count);
+    }
+
+    std::vector<double> refit_times(frames), traversal_times(frames);
+    for (int i = 0; i < frames; i++) {
+        deform(i);
+        long long t0 = get_time();
+        refitter.refit((cpu::Node*)nodes.data(), (cpu::Vec4*)tris.data(), indices, frame_vertices.data());
+        long long t1 = get_time();
+        traversal(nodes.data(), tris.data(), rays, hits, ray_count);
+        long long t2 = get_time();
+        refit_times[i] = t1 - t0;
+        traversal_times[i] = t2 - t1;
+    }
+
+    const double refit_sum = std::accumulate(refit_times.begin(), refit_times.end(), 0.0);
+    const double traversal_sum = std::accumulate(traversal_times.begin(), traversal_times.end(), 0.0);
+    std::sort(refit_times.begin(), refit_times.end());
+    std::sort(traversal_times.begin(), traversal_times.end());
+    std::cout << frames << " frame(s) refit and traversed." << std::endl;
+    std::cout << ray_count * frames * 1000000.0 / traversal_sum << " rays/sec." << std::endl;
+    std::cout << "# Refit average: " << refit_sum / 1000.0 / frames << " ms" << std::endl;
+    std::cout << "# Refit median: " << refit_times[frames / 2] / 1000.0 << " ms" << std::endl;
+    std::cout << "# Traversal average: " << traversal_sum / 1000.0 / frames << " ms" << std::endl;
+    std::cout << "# Traversal median: " << traversal_times[frames / 2] / 1000.0 << " ms" << std::endl;
+    std::cout << "# Refit share: " << 100.0 * refit_sum / (refit_sum + traversal_sum) << "%" << std::endl;
+
+    int intr = 0;
+    for (int i = 0; i < ray_count; i++) {
+        if (hits[i].tri_id >= 0) intr++;
+    }
+    std::cout << intr << " intersection(s)." << std::endl;
+
+    writer.write(hits, ray_count);
+    return true;
+}
 
 int main(int argc, char** argv) {
     if (argc < 2) {
@@ -16,10 +229,10 @@ int main(int argc, char** argv) {
     }
 
     std::string accel_file, rays_file;
-    std::string output;
+    std::string output, format, socket_path, pin, manifest;
     float tmin, tmax;
-    int times, warmup;
-    bool help, any;
+    int times, warmup, chunk, workers, frames;
+    bool help, any, map;
 
     ArgParser parser(argc, argv);
     parser.add_option<bool>("help", "h", "Shows this message", help, false);
@@ -28,9 +241,17 @@ int main(int argc, char** argv) {
     parser.add_option<int>("times", "n", "Sets the iteration count", times, 100, "count");
     parser.add_option<int>("warmup", "d", "Sets the number of dry runs", warmup, 10, "count");
     parser.add_option<std::string>("output", "o", "Sets the output file name", output, "output.fbuf", "output.fbuf");
-    parser.add_option<float>("tmin", "tmin", "Sets the minimum t parameter along the rays", tmin, 0.0f, "t");
-    parser.add_option<float>("tmax", "tmax", "Sets the maximum t parameter along the rays", tmax, 1e9f, "t");
+    parser.add_option<std::string>("format", "f", "Sets the output format (fbuf, raw, or a list of columns among inst_id,tri_id,tmax,u)", format, "fbuf", "format");
+    parser.add_option<float>("tmin", "tmin", "Sets the minimum t parameter along the rays, unless the file has per-ray intervals", tmin, 0.0f, "t");
+    parser.add_option<float>("tmax", "tmax", "Sets the maximum t parameter along the rays, unless the file has per-ray intervals", tmax, 1e9f, "t");
     parser.add_option<bool>("any", "any", "Stops at the first intersection", any, false);
+    parser.add_option<int>("chunk", "c", "Streams the ray distribution in chunks of the given size (0 loads it at once)", chunk, 0, "rays");
+    parser.add_option<std::string>("batch", "b", "Runs all the scenes and ray distributions listed in a manifest file", manifest, "", "manifest");
+    parser.add_option<std::string>("server", "srv", "Runs as a server that takes ray batches on the given Unix socket", socket_path, "", "socket");
+    parser.add_option<int>("workers", "w", "Splits the ray distribution across the given number of processes (0 runs in this process)", workers, 0, "count");
+    parser.add_option<std::string>("pin", "pin", "Sets how the worker processes are pinned (core, socket or none)", pin, "core", "mode");
+    parser.add_option<bool>("mmap", "m", "Maps the acceleration structure and ray files in memory instead of copying them", map, false);
+    parser.add_option<int>("refit", "rf", "Deforms the mesh for the given number of frames, refitting the acceleration structure before traversing (CPU only)", frames, 0, "frames");
 
     if (!parser.parse()) {
         return EXIT_FAILURE;
@@ -41,37 +262,130 @@ int main(int argc, char** argv) {
         return EXIT_SUCCESS;
     }
 
+    if (!manifest.empty()) {
+        BatchOptions options;
+        options.times = times;
+        options.warmup = warmup;
+        options.any = any;
+        options.map = map;
+        options.format = format;
+        return run_batch(manifest, options) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (workers > 0) {
+        // The workers load the acceleration structure themselves
+        LaunchOptions options;
+        options.accel_file = accel_file;
+        options.rays_file = rays_file;
+        options.output = output;
+        options.format = format;
+        options.workers = workers;
+        options.pin = pin;
+        options.times = times;
+        options.warmup = warmup;
+        options.tmin = tmin;
+        options.tmax = tmax;
+        options.any = any;
+        options.map = map;
+        return run_workers(options) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
     auto traversal = any ? occluded : intersect;
 
     anydsl::Array<Node> nodes;
     anydsl::Array<Vec4> tris;
-    if (!load_accel(accel_file, nodes, tris)) {
-        std::cerr << "Cannot load acceleration structure file." << std::endl;
-        return EXIT_FAILURE;
+    MappedFile accel_map;
+    Node* nodes_ptr = nullptr;
+    Vec4* tris_ptr = nullptr;
+
+    auto load_start = std::chrono::high_resolution_clock::now();
+    // Refitting changes the acceleration structure, which cannot be done in a read-only mapping
+    if (map && frames == 0 && map_accel(accel_file, accel_map, nodes_ptr, tris_ptr)) {
+        std::cout << "Acceleration structure mapped from file." << std::endl;
+    } else {
+        if (map && frames == 0) std::clog << "Cannot map the acceleration structure file, loading it instead." << std::endl;
+        if (!load_accel(accel_file, nodes, tris)) {
+            std::cerr << "Cannot load acceleration structure file." << std::endl;
+            return EXIT_FAILURE;
+        }
+        nodes_ptr = nodes.data();
+        tris_ptr = tris.data();
+    }
+    auto load_end = std::chrono::high_resolution_clock::now();
+    std::cout << "# Load time: " << std::chrono::duration_cast<std::chrono::microseconds>(load_end - load_start).count() / 1000.0 << " ms" << std::endl;
+    if (nodes.size() > 0) {
+        // The node and triangle layouts depend on the version of the traversal
+        std::cout << "# Node memory: " << sizeof(Node) * nodes.size() / (1024.0 * 1024.0) << " MB ("
+                  << nodes.size() << " node(s) of " << sizeof(Node) << " bytes)" << std::endl;
+        std::cout << "# Triangle memory: " << sizeof(Vec4) * tris.size() / (1024.0 * 1024.0) << " MB" << std::endl;
+    }
+    auto& stats = decompression_stats();
+    if (stats.compressed_size > 0) {
+        std::cout << "# I/O time: " << stats.io_time << " ms" << std::endl;
+        std::cout << "# Decompression time: " << stats.decompression_time << " ms" << std::endl;
+        std::cout << stats.compressed_size << " compressed byte(s) expanded to " << stats.block_size << " byte(s)." << std::endl;
     }
 
-    anydsl::Array<Ray> rays;
-    if (!load_rays(rays_file, rays, tmin, tmax)) {
-        std::cerr << "Cannot load ray distribution file." << std::endl;
+    if (!socket_path.empty()) {
+        if (!run_server(socket_path, nodes_ptr, tris_ptr)) {
+            std::cerr << "Cannot listen on socket." << std::endl;
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+
+    HitWriter writer;
+    if (!writer.open(output, format)) {
+        std::cerr << "Cannot open output file, or invalid output format." << std::endl;
         return EXIT_FAILURE;
     }
 
-    int ray_count = rays.size();
+    if (chunk > 0) {
+        // The distribution is traversed only once in streaming mode
+        bool ok = stream_rays(traversal, nodes_ptr, tris_ptr, rays_file, writer, chunk, tmin, tmax, warmup);
+        return ok && writer.close() ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    anydsl::Array<Ray> rays;
+    MappedFile rays_map;
+    Ray* rays_ptr = nullptr;
+    size_t mapped_count = 0;
+    int ray_count;
+    if (map && map_rays(rays_file, rays_map, rays_ptr, mapped_count)) {
+        std::cout << "Ray distribution mapped from file." << std::endl;
+        ray_count = mapped_count;
+    } else {
+        if (!load_rays(rays_file, rays, tmin, tmax)) {
+            std::cerr << "Cannot load ray distribution file." << std::endl;
+            return EXIT_FAILURE;
+        }
+        rays_ptr = rays.data();
+        ray_count = rays.size();
+    }
 
     std::cout << ray_count << " ray(s) in the distribution file." << std::endl;
 
     anydsl::Array<Hit> hits(anydsl::Platform::TRAVERSAL_PLATFORM, anydsl::Device(TRAVERSAL_DEVICE), ray_count);
 
+    if (frames > 0) {
+        if (!can_refit) {
+            std::cerr << "Refitting is only available with the cpu version of the traversal." << std::endl;
+            return EXIT_FAILURE;
+        }
+        bool ok = refit_frames(traversal, nodes, tris, accel_file, rays_ptr, hits.data(), ray_count, writer, frames, warmup);
+        return ok && writer.close() ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
     // Warmup iterations
     for (int i = 0; i < warmup; i++) {
-        traversal(nodes.data(), tris.data(), rays.data(), hits.data(), ray_count);
+        traversal(nodes_ptr, tris_ptr, rays_ptr, hits.data(), ray_count);
     }
 
     // Compute traversal time
     std::vector<double> iter_times(times);
     for (int i = 0; i < times; i++) {
         long long t0 = get_time();
-        traversal(nodes.data(), tris.data(), rays.data(), hits.data(), ray_count);
+        traversal(nodes_ptr, tris_ptr, rays_ptr, hits.data(), ray_count);
         long long t1 = get_time();
         iter_times[i] = t1 - t0;
     }
@@ -97,9 +411,10 @@ int main(int argc, char** argv) {
     }
     std::cout << intr << " intersection(s)." << std::endl;
 
-    std::ofstream out(output, std::ofstream::binary);
-    for (int i = 0; i < ray_count; i++) {
-        out.write((char*)&host_hits[i].tmax, sizeof(float));
+    writer.write(host_hits.data(), ray_count);
+    if (!writer.close()) {
+        std::cerr << "Cannot write output file." << std::endl;
+        return EXIT_FAILURE;
     }
 
     return EXIT_SUCCESS;
@@ -0,0 +1,76 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <string>
+#include <cstddef>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/// Read-only memory mapping of a whole file. The mapping is shared, so several
+/// processes mapping the same file use the same page-cache pages.
+class MappedFile {
+public:
+    MappedFile()
+        : data_(nullptr), size_(0)
+    {}
+
+    MappedFile(MappedFile&& other)
+        : data_(other.data_), size_(other.size_)
+    {
+        other.data_ = nullptr;
+        other.size_ = 0;
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator = (const MappedFile&) = delete;
+
+    ~MappedFile() { close(); }
+
+    bool open(const std::string& filename) {
+        close();
+
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+
+        void* ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        // The mapping stays valid after the descriptor is closed
+        ::close(fd);
+        if (ptr == MAP_FAILED) return false;
+
+        data_ = (const char*)ptr;
+        size_ = st.st_size;
+        return true;
+    }
+
+    void close() {
+        if (data_) munmap((void*)data_, size_);
+        data_ = nullptr;
+        size_ = 0;
+    }
+
+    /// Asks the system to start reading a range of the file in the background,
+    /// so that it is fetched with large reads rather than one page fault at a time.
+    void prefetch(const char* ptr, size_t size) const {
+        const size_t page = sysconf(_SC_PAGESIZE);
+        const char* begin = data_ + (ptr - data_) / page * page;
+        madvise((void*)begin, ptr + size - begin, MADV_WILLNEED);
+    }
+
+    bool is_open() const { return data_ != nullptr; }
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    const char* data_;
+    size_t size_;
+};
+
+#endif // MAPPED_FILE_H
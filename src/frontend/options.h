@@ -87,6 +87,7 @@ struct Option {
         : full_name(fn)
         , short_name(sn)
         , desc(dc)
+        , given(false)
         {}
 
     virtual ~Option() {}
@@ -99,6 +100,7 @@ struct Option {
     std::string full_name;
     std::string short_name;
     std::string desc;
+    bool given;     // True when the option is on the command line
 };
 
 template <typename T>
@@ -217,6 +219,7 @@ public:
                         bool ok = (*it)->read_value(opt_arg.c_str());
                         assert(ok && "read_value returns false for an option without args");
                     }
+                    (*it)->given = true;
                 } else {
                     // Try short name
                     auto it = std::find_if(options_.begin(), options_.end(), [this, i] (const Option* opt) -> bool {
@@ -246,6 +249,7 @@ public:
                             return false;
                         }
                     }
+                    (*it)->given = true;
                 }
             } else {
                 // This is an argument
@@ -294,6 +298,14 @@ public:
         return args_;
     }
 
+    /// Returns true if the option with the given full name is on the command line.
+    bool given(const std::string& full_name) const {
+        auto it = std::find_if(options_.begin(), options_.end(), [&] (const Option* opt) {
+            return opt->full_name == full_name;
+        });
+        return it != options_.end() && (*it)->given;
+    }
+
 private:
     std::vector<Option*> options_;
     std::vector<std::string> args_;
@@ -0,0 +1,28 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/// Calls f(i) for every i in [begin, end), distributing the iterations over all the cores.
+template <typename F>
+void parallel_for(int begin, int end, F f) {
+    const int thread_count = std::min<int>(std::max<int>(std::thread::hardware_concurrency(), 1), end - begin);
+    if (thread_count <= 1) {
+        for (int i = begin; i < end; i++) f(i);
+        return;
+    }
+
+    std::atomic<int> next(begin);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < thread_count; t++) {
+        threads.emplace_back([&] {
+            for (int i = next++; i < end; i = next++) f(i);
+        });
+    }
+    for (auto& thread : threads) thread.join();
+}
+
+#endif // PARALLEL_H
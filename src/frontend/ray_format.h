@@ -0,0 +1,159 @@
+#ifndef RAY_FORMAT_H
+#define RAY_FORMAT_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+/// Ray distribution files. Version 1 files have no header and store 6 floats per ray (origin and direction).
+/// Version 2 files start with a header, followed by the rays in one of the layouts below.
+namespace rays {
+    static const uint32_t magic = 0x59415232;   // "2RAY"
+    static const uint32_t version = 2;
+
+    enum class Layout : uint32_t {
+        ORG_DIR = 0,        // Origin and direction (6 floats per ray), as in version 1 files
+        RAY = 1,            // Origin and tmin, direction and tmax (8 floats per ray), as in the kernels
+        SHARED_ORG = 2      // Direction and tmax (4 floats per ray), the origin and tmin are in the header
+    };
+
+    enum Flags : uint32_t {
+        INTERVALS = 1       // The rays have their own tmin and tmax, which override the ones given to the frontend
+    };
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t ray_count;
+        uint32_t layout;
+        uint32_t flags;
+        float org[4];       // Origin and tmin of all the rays, for the SHARED_ORG layout
+        uint32_t pad[2];    // Keeps the rays aligned on 16 bytes
+    };
+
+    static_assert(sizeof(Header) == 48, "Invalid ray file header layout");
+
+    inline size_t ray_size(Layout layout) {
+        switch (layout) {
+            case Layout::ORG_DIR:    return sizeof(float) * 6;
+            case Layout::RAY:        return sizeof(float) * 8;
+            case Layout::SHARED_ORG: return sizeof(float) * 4;
+            default:                 return 0;
+        }
+    }
+
+    /// Returns the offset of the first ray in the file
+    inline size_t data_offset(const Header& h) {
+        return h.version == version ? sizeof(Header) : 0;
+    }
+
+    inline Header make_header(Layout layout, uint64_t ray_count, uint32_t flags = 0) {
+        Header h;
+        std::memset(&h, 0, sizeof(Header));
+        h.magic = magic;
+        h.version = version;
+        h.ray_count = ray_count;
+        h.layout = (uint32_t)layout;
+        h.flags = flags;
+        return h;
+    }
+
+    /// Reads the header of a ray distribution file, given its size. Version 1 files get
+    /// a header with the ORG_DIR layout. The stream is left at the beginning of the rays.
+    inline bool read_header(std::istream& is, size_t file_size, Header& h) {
+        if (file_size >= sizeof(Header)) {
+            is.read((char*)&h, sizeof(Header));
+            if (!is) return false;
+            if (h.magic == magic && h.version == version && ray_size((Layout)h.layout) != 0 &&
+                sizeof(Header) + h.ray_count * ray_size((Layout)h.layout) <= file_size)
+                return true;
+            is.seekg(0);
+        }
+
+        h = make_header(Layout::ORG_DIR, file_size / ray_size(Layout::ORG_DIR));
+        h.magic = 0;
+        h.version = 1;
+        return static_cast<bool>(is);
+    }
+
+    /// Writes the header of a version 2 file. Nothing is written for version 1 files.
+    inline void write_header(std::ostream& os, const Header& h) {
+        if (h.version == version) os.write((const char*)&h, sizeof(Header));
+    }
+
+    /// Writes a ray in the layout of the given header. With the SHARED_ORG layout,
+    /// the origin and tmin are taken from the header and the arguments are ignored.
+    inline void write_ray(std::ostream& os, const Header& h, const float* org, float tmin, const float* dir, float tmax) {
+        const Layout layout = (Layout)h.layout;
+        if (layout != Layout::SHARED_ORG) {
+            os.write((const char*)org, sizeof(float) * 3);
+            if (layout == Layout::RAY) os.write((const char*)&tmin, sizeof(float));
+        }
+        os.write((const char*)dir, sizeof(float) * 3);
+        if (layout != Layout::ORG_DIR) os.write((const char*)&tmax, sizeof(float));
+    }
+
+    /// Expands rays stored in the layout of the given header at the beginning of the buffer, in place, to
+    /// 8 floats per ray (origin and tmin, direction and tmax). The tmin and tmax arguments are used
+    /// for the files without per-ray intervals. The buffer must have room for 8 floats per ray.
+    inline void expand_rays(const Header& h, float* data, size_t count, float tmin, float tmax) {
+        const Layout layout = (Layout)h.layout;
+        const bool intervals = h.flags & INTERVALS;
+        if (layout == Layout::RAY) {
+            if (!intervals) {
+                for (size_t i = 0; i < count; i++) {
+                    data[i * 8 + 3] = tmin;
+                    data[i * 8 + 7] = tmax;
+                }
+            }
+            return;
+        }
+
+        // Start from the end, since the rays get larger
+        const size_t stride = ray_size(layout) / sizeof(float);
+        for (size_t i = count; i-- > 0;) {
+            const float* src = data + i * stride;
+            float ray[8];
+            if (layout == Layout::SHARED_ORG) {
+                ray[0] = h.org[0];
+                ray[1] = h.org[1];
+                ray[2] = h.org[2];
+                ray[3] = intervals ? h.org[3] : tmin;
+                ray[4] = src[0];
+                ray[5] = src[1];
+                ray[6] = src[2];
+                ray[7] = intervals ? src[3] : tmax;
+            } else {
+                ray[0] = src[0];
+                ray[1] = src[1];
+                ray[2] = src[2];
+                ray[3] = tmin;
+                ray[4] = src[3];
+                ray[5] = src[4];
+                ray[6] = src[5];
+                ray[7] = tmax;
+            }
+            std::memcpy(data + i * 8, ray, sizeof(float) * 8);
+        }
+    }
+
+    /// Parses the name of a layout, as given on the command line of the tools.
+    /// Version 1 files are requested with "v1".
+    inline bool parse_format(const std::string& name, uint64_t ray_count, uint32_t flags, Header& h) {
+        if (name == "v1") {
+            h = make_header(Layout::ORG_DIR, ray_count);
+            h.version = 1;
+        } else if (name == "ray") {
+            h = make_header(Layout::RAY, ray_count, flags);
+        } else if (name == "shared") {
+            h = make_header(Layout::SHARED_ORG, ray_count, flags);
+        } else {
+            return false;
+        }
+        return true;
+    }
+}
+
+#endif // RAY_FORMAT_H
@@ -0,0 +1,149 @@
+#include <cstring>
+#include <cfloat>
+#include <algorithm>
+
+#include "refit.h"
+#include "parallel.h"
+#include "convert_mbvh.h"
+#include "../tools/linear.h"
+
+// The tree is split into at least this number of subtrees, so that all the cores get work
+static const size_t min_subtrees = 256;
+
+/// Checks the children of a node, marks its inner children as visited and adds them to the given list
+static bool check_node(const cpu::Node* nodes, size_t node_count, const cpu::Vec4* tris, size_t tri_size, size_t tri_count,
+                       int index, std::vector<bool>& visited, std::vector<int>& children) {
+    const cpu::Node& node = nodes[index];
+    for (int j = 0; j < 4; j++) {
+        const int32_t child = node.children[j];
+        if (child == 0) break;
+
+        if (child > 0) {
+            if ((size_t)child >= node_count || visited[child]) return false;
+            visited[child] = true;
+            children.push_back(child);
+            continue;
+        }
+
+        // Every block of the leaf must be followed by another block or by the sentinel
+        for (size_t offset = ~child; ; offset += 13) {
+            if (offset + 13 >= tri_size) return false;
+            for (int i = 0; i < 4; i++) {
+                int32_t id;
+                memcpy(&id, (const float*)&tris[offset] + 48 + i, sizeof(int32_t));
+                if (id >= (int32_t)tri_count || id < -1) return false;
+            }
+            if (is_leaf_end(tris[offset + 13].x)) break;
+        }
+    }
+    return true;
+}
+
+bool Refitter::init(const cpu::Node* nodes, size_t node_count, const cpu::Vec4* tris, size_t tri_size,
+                    const std::vector<int>& indices, size_t vert_count) {
+    subtrees_.clear();
+    top_.clear();
+    if (node_count == 0) return false;
+
+    for (int i : indices) {
+        if (i < 0 || (size_t)i >= vert_count) return false;
+    }
+    const size_t tri_count = indices.size() / 3;
+
+    // Expand the tree level by level from the root, until there are enough subtrees
+    std::vector<bool> visited(node_count, false);
+    std::vector<int> frontier(1, 0);
+    visited[0] = true;
+    while (!frontier.empty() && frontier.size() < min_subtrees) {
+        std::vector<int> next;
+        for (int index : frontier) {
+            if (!check_node(nodes, node_count, tris, tri_size, tri_count, index, visited, next)) return false;
+            top_.push_back(index);
+        }
+        frontier.swap(next);
+    }
+    std::reverse(top_.begin(), top_.end());
+
+    // In reverse depth-first order, the children of every node come before it
+    subtrees_.resize(frontier.size());
+    for (size_t i = 0; i < frontier.size(); i++) {
+        std::vector<int>& subtree = subtrees_[i];
+        std::vector<int> stack(1, frontier[i]);
+        while (!stack.empty()) {
+            const int index = stack.back();
+            stack.pop_back();
+            if (!check_node(nodes, node_count, tris, tri_size, tri_count, index, visited, stack)) return false;
+            subtree.push_back(index);
+        }
+        std::reverse(subtree.begin(), subtree.end());
+    }
+    return true;
+}
+
+void Refitter::refit_node(cpu::Node* nodes, cpu::Vec4* tris, int index, const int* indices, const float* vertices) const {
+    cpu::Node& node = nodes[index];
+    for (int j = 0; j < 4; j++) {
+        const int32_t child = node.children[j];
+        if (child == 0) break;
+
+        float3 lo(FLT_MAX, FLT_MAX, FLT_MAX);
+        float3 hi(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+        auto extend = [&] (const float3& min, const float3& max) {
+            lo = float3(std::min(lo.x, min.x), std::min(lo.y, min.y), std::min(lo.z, min.z));
+            hi = float3(std::max(hi.x, max.x), std::max(hi.y, max.y), std::max(hi.z, max.z));
+        };
+
+        if (child > 0) {
+            // The children of the child have already been refit
+            const cpu::Node& inner = nodes[child];
+            for (int k = 0; k < 4 && inner.children[k] != 0; k++) {
+                extend(float3(inner.min_x[k], inner.min_y[k], inner.min_z[k]),
+                       float3(inner.max_x[k], inner.max_y[k], inner.max_z[k]));
+            }
+        } else {
+            for (cpu::Vec4* block = tris + ~child; ; block += 13) {
+                float* data = (float*)block;
+                for (int i = 0; i < 4; i++) {
+                    int32_t id;
+                    memcpy(&id, data + 48 + i, sizeof(int32_t));
+                    if (id < 0) continue;
+
+                    const float* p0 = vertices + 4 * indices[id * 3 + 0];
+                    const float* p1 = vertices + 4 * indices[id * 3 + 1];
+                    const float* p2 = vertices + 4 * indices[id * 3 + 2];
+                    const float3 v0(p0[0], p0[1], p0[2]);
+                    const float3 v1(p1[0], p1[1], p1[2]);
+                    const float3 v2(p2[0], p2[1], p2[2]);
+                    const float3 e1 = v0 - v1;
+                    const float3 e2 = v2 - v0;
+                    const float3 n = cross(e1, e2);
+                    const float3 vecs[4] = { v0, e1, e2, n };
+                    for (int k = 0; k < 4; k++) {
+                        data[(k * 3 + 0) * 4 + i] = vecs[k].x;
+                        data[(k * 3 + 1) * 4 + i] = vecs[k].y;
+                        data[(k * 3 + 2) * 4 + i] = vecs[k].z;
+                    }
+
+                    extend(float3(std::min(std::min(v0.x, v1.x), v2.x), std::min(std::min(v0.y, v1.y), v2.y), std::min(std::min(v0.z, v1.z), v2.z)),
+                           float3(std::max(std::max(v0.x, v1.x), v2.x), std::max(std::max(v0.y, v1.y), v2.y), std::max(std::max(v0.z, v1.z), v2.z)));
+                }
+                cpu::normalize_block_start(data);
+                if (is_leaf_end(block[13].x)) break;
+            }
+        }
+
+        node.min_x[j] = lo.x;
+        node.min_y[j] = lo.y;
+        node.min_z[j] = lo.z;
+        node.max_x[j] = hi.x;
+        node.max_y[j] = hi.y;
+        node.max_z[j] = hi.z;
+    }
+}
+
+void Refitter::refit(cpu::Node* nodes, cpu::Vec4* tris, const std::vector<int>& indices, const float* vertices) const {
+    parallel_for(0, subtrees_.size(), [&] (int i) {
+        for (int index : subtrees_[i]) refit_node(nodes, tris, index, indices.data(), vertices);
+    });
+    for (int index : top_) refit_node(nodes, tris, index, indices.data(), vertices);
+}
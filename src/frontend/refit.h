@@ -0,0 +1,27 @@
+#ifndef REFIT_H
+#define REFIT_H
+
+#include <vector>
+#include "bvh_format.h"
+
+/// Refits a BVH in the layout of the CPU kernels when the vertices of its mesh move, but its topology does not change.
+/// The triangles are rewritten from the mesh, and the boxes of the nodes are recomputed bottom-up, in place.
+class Refitter {
+public:
+    /// Prepares the refit of a BVH for a mesh in the layout of MESH blocks (3 indices per triangle).
+    /// Returns false if the nodes do not form a tree, or if the triangles do not match the mesh.
+    bool init(const cpu::Node* nodes, size_t node_count, const cpu::Vec4* tris, size_t tri_size,
+              const std::vector<int>& indices, size_t vert_count);
+
+    /// Refits the BVH given to init to new positions of the vertices (4 floats per vertex, as in MESH blocks).
+    /// Independent subtrees are refit in parallel.
+    void refit(cpu::Node* nodes, cpu::Vec4* tris, const std::vector<int>& indices, const float* vertices) const;
+
+private:
+    void refit_node(cpu::Node* nodes, cpu::Vec4* tris, int index, const int* indices, const float* vertices) const;
+
+    std::vector<std::vector<int>> subtrees_;    // Nodes of the independent subtrees, children before parents
+    std::vector<int> top_;                      // Nodes above the subtrees, children before parents
+};
+
+#endif // REFIT_H
@@ -0,0 +1,280 @@
+#include <iostream>
+#include <vector>
+#include <list>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <limits>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <anydsl_runtime.hpp>
+
+#include "server.h"
+
+static_assert(sizeof(Ray) == server::ray_size, "Ray does not match the server protocol");
+static_assert(sizeof(Hit) == server::hit_size, "Hit does not match the server protocol");
+
+/// Buffer of a client, mapped in the address space of the server
+struct ClientBuffer {
+    char* data;
+    size_t size;
+
+    ClientBuffer() : data(nullptr), size(0) {}
+    ~ClientBuffer() { unmap(); }
+
+    bool map(int fd, size_t buffer_size) {
+        unmap();
+
+        // Mapping past the end of the file would fault on the first access
+        struct stat st;
+        if (buffer_size == 0 || fstat(fd, &st) != 0 || st.st_size < 0 || buffer_size > (uint64_t)st.st_size)
+            return false;
+
+        void* ptr = mmap(nullptr, buffer_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (ptr == MAP_FAILED) return false;
+        data = (char*)ptr;
+        size = buffer_size;
+        return true;
+    }
+
+    void unmap() {
+        if (data) munmap(data, size);
+        data = nullptr;
+        size = 0;
+    }
+};
+
+/// Fills the rays of a packet after the given count with rays that cannot hit anything
+static void pad_packet(Ray* rays, size_t count) {
+    for (size_t i = count; i < server::packet_size; i++) {
+        rays[i].org = Vec4 { 0.0f, 0.0f, 0.0f, 1.0f };
+        rays[i].dir = Vec4 { 1.0f, 1.0f, 1.0f, 0.0f };
+    }
+}
+
+/// Receives a request, along with the file descriptor passed with it, if any
+static bool recv_request(int sock, server::Request& request, int& fd) {
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec iov;
+    iov.iov_base = &request;
+    iov.iov_len = sizeof(server::Request);
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msghdr));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    fd = -1;
+    if (recvmsg(sock, &msg, MSG_WAITALL) != sizeof(server::Request)) return false;
+
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+            memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+    return true;
+}
+
+class Server {
+public:
+    Server(Node* nodes, Vec4* tris)
+        : nodes_(nodes), tris_(tris)
+        , tail_rays_(server::packet_size), tail_hits_(server::packet_size)
+        , quit_(false)
+    {}
+
+    bool run(const std::string& socket_path);
+
+private:
+    void serve(int sock, int client_id);
+    int traverse(const ClientBuffer& buffer, const server::Request& request, server::Response& response);
+
+    Node* nodes_;
+    Vec4* tris_;
+
+    // Only one request is traversed at a time, since the kernels already use all the cores
+    std::mutex traversal_mutex_;
+    anydsl::Array<Ray> dev_rays_;
+    anydsl::Array<Hit> dev_hits_;
+    // Copy of the last packet of a request, when it is not full
+    anydsl::Array<Ray> tail_rays_;
+    anydsl::Array<Hit> tail_hits_;
+
+    std::atomic<bool> quit_;
+    int listen_sock_;
+};
+
+bool Server::run(const std::string& socket_path) {
+    struct sockaddr_un addr;
+    if (socket_path.size() >= sizeof(addr.sun_path)) return false;
+    memset(&addr, 0, sizeof(sockaddr_un));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path.c_str());
+
+    listen_sock_ = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_sock_ < 0) return false;
+
+    unlink(socket_path.c_str());
+    if (bind(listen_sock_, (struct sockaddr*)&addr, sizeof(sockaddr_un)) != 0 ||
+        listen(listen_sock_, 16) != 0) {
+        close(listen_sock_);
+        return false;
+    }
+
+    std::cout << "Listening on " << socket_path << "." << std::endl;
+
+    struct Client {
+        std::thread thread;
+        std::atomic<bool> done;
+        Client() : done(false) {}
+    };
+
+    std::list<Client> clients;
+    int client_count = 0;
+    while (!quit_) {
+        int sock = accept(listen_sock_, nullptr, nullptr);
+        if (sock < 0) break;
+
+        // Join the clients that have disconnected, so that a long-running server keeps no thread per past connection
+        for (auto it = clients.begin(); it != clients.end();) {
+            if (it->done) {
+                it->thread.join();
+                it = clients.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        clients.emplace_back();
+        Client& client = clients.back();
+        const int client_id = client_count++;
+        client.thread = std::thread([this, sock, client_id, &client] {
+            serve(sock, client_id);
+            client.done = true;
+        });
+    }
+
+    for (auto& client : clients) client.thread.join();
+    close(listen_sock_);
+    unlink(socket_path.c_str());
+    return true;
+}
+
+void Server::serve(int sock, int client_id) {
+    ClientBuffer buffer;
+    std::vector<int64_t> queue_times, traversal_times;
+    uint64_t total_rays = 0;
+
+    server::Request request;
+    int fd;
+    while (recv_request(sock, request, fd)) {
+        server::Response response;
+        memset(&response, 0, sizeof(server::Response));
+        response.id = request.id;
+
+        switch ((server::Command)request.command) {
+            case server::Command::ATTACH:
+                response.status = fd >= 0 && buffer.map(fd, request.buffer_size) ? 0 : -1;
+                break;
+            case server::Command::TRAVERSE:
+                response.status = traverse(buffer, request, response);
+                if (response.status == 0) {
+                    queue_times.push_back(response.queue_time);
+                    traversal_times.push_back(response.traversal_time);
+                    total_rays += request.ray_count;
+                }
+                break;
+            case server::Command::QUIT:
+                // Wake up the thread waiting for new clients
+                quit_ = true;
+                shutdown(listen_sock_, SHUT_RDWR);
+                break;
+            default:
+                response.status = -1;
+                break;
+        }
+
+        // The buffer stays mapped, so the descriptor is not needed anymore
+        if (fd >= 0) close(fd);
+        if (send(sock, &response, sizeof(server::Response), MSG_NOSIGNAL) != sizeof(server::Response)) break;
+    }
+    close(sock);
+
+    if (!queue_times.empty()) {
+        std::sort(queue_times.begin(), queue_times.end());
+        std::sort(traversal_times.begin(), traversal_times.end());
+        const size_t n = queue_times.size();
+        std::cout << "Client " << client_id << ": " << n << " request(s), " << total_rays << " ray(s)." << std::endl;
+        std::cout << "# Median queueing: " << queue_times[n / 2] / 1000.0 << " ms" << std::endl;
+        std::cout << "# Max queueing: " << queue_times[n - 1] / 1000.0 << " ms" << std::endl;
+        std::cout << "# Median traversal: " << traversal_times[n / 2] / 1000.0 << " ms" << std::endl;
+        std::cout << "# Max traversal: " << traversal_times[n - 1] / 1000.0 << " ms" << std::endl;
+    }
+}
+
+int Server::traverse(const ClientBuffer& buffer, const server::Request& request, server::Response& response) {
+    const uint64_t count = request.ray_count;
+    if (!buffer.data ||
+        count > (uint64_t)std::numeric_limits<int32_t>::max() ||
+        request.ray_offset % alignof(Ray) != 0 ||
+        request.hit_offset % alignof(Hit) != 0 ||
+        request.ray_offset > buffer.size || count > (buffer.size - request.ray_offset) / sizeof(Ray) ||
+        request.hit_offset > buffer.size || count > (buffer.size - request.hit_offset) / sizeof(Hit))
+        return -1;
+
+    Ray* rays = (Ray*)(buffer.data + request.ray_offset);
+    Hit* hits = (Hit*)(buffer.data + request.hit_offset);
+    auto traversal = request.flags & server::ANY_HIT ? occluded : intersect;
+
+    // The kernels only trace full packets, so the rays of the last packet are traversed from a padded copy
+    const uint64_t full_count = count / server::packet_size * server::packet_size;
+    const uint64_t tail_count = count - full_count;
+    const uint64_t padded_count = tail_count > 0 ? full_count + server::packet_size : full_count;
+
+    std::lock_guard<std::mutex> lock(traversal_mutex_);
+    const int64_t start = server::now();
+    if (tail_count > 0) {
+        memcpy(tail_rays_.data(), rays + full_count, sizeof(Ray) * tail_count);
+        pad_packet(tail_rays_.data(), tail_count);
+    }
+    if (anydsl::Platform::TRAVERSAL_PLATFORM == anydsl::Platform::Host) {
+        if (full_count > 0) traversal(nodes_, tris_, rays, hits, full_count);
+        if (tail_count > 0) {
+            traversal(nodes_, tris_, tail_rays_.data(), tail_hits_.data(), server::packet_size);
+            memcpy(hits + full_count, tail_hits_.data(), sizeof(Hit) * tail_count);
+        }
+    } else {
+        // The device buffers only grow, so that they are allocated once for most clients
+        if (dev_rays_.size() < (int64_t)padded_count) {
+            dev_rays_ = std::move(anydsl::Array<Ray>(anydsl::Platform::TRAVERSAL_PLATFORM, anydsl::Device(TRAVERSAL_DEVICE), padded_count));
+            dev_hits_ = std::move(anydsl::Array<Hit>(anydsl::Platform::TRAVERSAL_PLATFORM, anydsl::Device(TRAVERSAL_DEVICE), padded_count));
+        }
+        anydsl_copy(0, rays, 0, dev_rays_.device(), dev_rays_.data(), 0, sizeof(Ray) * full_count);
+        if (tail_count > 0)
+            anydsl_copy(0, tail_rays_.data(), 0, dev_rays_.device(), dev_rays_.data(), sizeof(Ray) * full_count, sizeof(Ray) * server::packet_size);
+        traversal(nodes_, tris_, dev_rays_.data(), dev_hits_.data(), padded_count);
+        anydsl_copy(dev_hits_.device(), dev_hits_.data(), 0, 0, hits, 0, sizeof(Hit) * count);
+    }
+    const int64_t end = server::now();
+
+    uint64_t intr = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        if (hits[i].tri_id >= 0) intr++;
+    }
+
+    response.queue_time = start - request.submit_time;
+    response.traversal_time = end - start;
+    response.intersections = intr;
+    return 0;
+}
+
+bool run_server(const std::string& socket_path, Node* nodes, Vec4* tris) {
+    Server server(nodes, tris);
+    return server.run(socket_path);
+}
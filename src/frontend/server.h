@@ -0,0 +1,12 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <string>
+#include "traversal.h"
+#include "server_protocol.h"
+
+/// Serves traversal requests on a Unix domain socket, on the given acceleration structure (see server_protocol.h).
+/// Requests from different clients are traversed one at a time. Returns when a client sends a QUIT request.
+bool run_server(const std::string& socket_path, Node* nodes, Vec4* tris);
+
+#endif // SERVER_H
@@ -0,0 +1,55 @@
+#ifndef SERVER_PROTOCOL_H
+#define SERVER_PROTOCOL_H
+
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+
+/// Protocol between the frontend in server mode and its clients. Messages go through a Unix domain socket,
+/// while the rays and hits stay in a shared memory buffer owned by the client. The client first attaches
+/// the buffer by sending its file descriptor along with an ATTACH request, and then submits batches of
+/// rays with TRAVERSE requests, each of which gets a response once the hits are in the buffer.
+namespace server {
+    enum class Command : uint32_t {
+        ATTACH = 0,         // Attaches the buffer passed with the request (replaces the previous one)
+        TRAVERSE = 1,       // Traverses the rays of the buffer and writes the hits back to it
+        QUIT = 2            // Stops the server once all the clients are disconnected
+    };
+
+    enum Flags : uint32_t {
+        ANY_HIT = 1         // Stops at the first intersection
+    };
+
+    /// Size of the rays and hits in the buffer, as in the kernels
+    static const size_t ray_size = sizeof(float) * 8;
+    static const size_t hit_size = sizeof(int32_t) * 4;
+    /// Number of rays traced together by the kernels. Requests with other counts are padded by the server.
+    static const size_t packet_size = 8;
+
+    struct Request {
+        uint32_t command;
+        uint32_t flags;
+        uint64_t id;
+        uint64_t buffer_size;   // Size of the attached buffer (ATTACH)
+        uint64_t ray_offset;    // Offset of the rays in the buffer, in bytes (TRAVERSE)
+        uint64_t hit_offset;    // Offset of the hits in the buffer, in bytes (TRAVERSE)
+        uint64_t ray_count;
+        int64_t submit_time;    // Time at which the request was sent, from now()
+    };
+
+    struct Response {
+        uint64_t id;
+        int32_t status;         // Zero on success
+        uint32_t pad;
+        int64_t queue_time;     // Time between the submission and the beginning of the traversal (in microseconds)
+        int64_t traversal_time; // Time spent in the traversal, copies to and from the device included (in microseconds)
+        uint64_t intersections;
+    };
+
+    /// Monotonic time in microseconds, which is the same for all the processes of the machine
+    inline int64_t now() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+}
+
+#endif // SERVER_PROTOCOL_H
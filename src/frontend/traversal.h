@@ -3,6 +3,16 @@
 
 #if defined(TRAVERSAL_CPU)
     #include "traversal_cpu.h"
+#elif defined(TRAVERSAL_CPU8)
+    #include "traversal_cpu8.h"
+#elif defined(TRAVERSAL_CPUQ)
+    #include "traversal_cpuq.h"
+#elif defined(TRAVERSAL_CPUI)
+    #include "traversal_cpui.h"
+#elif defined(TRAVERSAL_CPUE)
+    #include "traversal_cpue.h"
+#elif defined(TRAVERSAL_CPUP)
+    #include "traversal_cpup.h"
 #elif defined(TRAVERSAL_GPU)
     #include "traversal_gpu.h"
 #else
@@ -0,0 +1,106 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include "../frontend/options.h"
+#include "../frontend/bvh_format.h"
+#include "../builder/build.h"
+#include "../builder/cost_profile.h"
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "No arguments. Exiting." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    BuildOptions options;
+    std::string cost_profile;
+    bool help;
+    ArgParser parser(argc, argv);
+    parser.add_option<bool>("help", "h", "Shows this message", help, false);
+    parser.add_option<int>("bins", "b", "Sets the number of bins used to find the splits", options.sah.bin_count, 16, "count");
+    parser.add_option<int>("leaf-size", "l", "Sets the maximum number of triangles per leaf", options.sah.max_leaf_size, 8, "count");
+    parser.add_option<float>("traversal-cost", "ct", "Sets the SAH cost of traversing a node", options.sah.costs.traversal, 1.0f, "cost");
+    parser.add_option<float>("intersection-cost", "ci", "Sets the SAH cost of intersecting a triangle", options.sah.costs.intersection, 1.0f, "cost");
+    parser.add_option<std::string>("cost-profile", "c", "Reads the SAH costs from a profile written by calibrate_cpu", cost_profile, "", "file");
+    parser.add_option<bool>("spatial-splits", "s", "Enables spatial splits (SBVH)", options.spatial.enabled, false);
+    parser.add_option<float>("split-budget", "sb", "Sets the maximum number of additional references, relative to the number of triangles", options.spatial.budget, 0.3f, "ratio");
+    parser.add_option<float>("split-alpha", "sa", "Sets the overlap, relative to the scene, above which spatial splits are tried", options.spatial.alpha, 1e-5f, "ratio");
+    parser.add_option<bool>("presplit", "p", "Splits the triangles with large boxes before building", options.presplit.enabled, false);
+    parser.add_option<float>("presplit-budget", "pb", "Sets the maximum number of additional references from pre-splitting, relative to the number of triangles", options.presplit.budget, 0.3f, "ratio");
+
+    if (!parser.parse()) {
+        parser.usage();
+        return EXIT_SUCCESS;
+    }
+
+    if (help) {
+        parser.usage();
+        return EXIT_SUCCESS;
+    }
+
+    if (!load_cost_profile(cost_profile, parser, options.sah.costs)) return EXIT_FAILURE;
+
+    if (parser.arguments().size() < 2) {
+        std::cerr << "Input file and output file expected. Exiting." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (options.sah.bin_count < 2 || options.sah.max_leaf_size < 1) {
+        std::cerr << "Invalid number of bins or leaf size." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (options.spatial.budget < 0.0f || options.spatial.alpha < 0.0f || options.presplit.budget < 0.0f) {
+        std::cerr << "Invalid split budget or overlap." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const std::string& input = parser.arguments()[0];
+    const std::string& output = parser.arguments()[1];
+
+    TriMesh mesh;
+    if (!read_mesh(input, mesh)) {
+        std::cerr << "Cannot read mesh file." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    Mbvh mbvh;
+    BuildStats stats;
+    if (!build_mbvh(mesh, options, mbvh, stats)) {
+        std::cerr << "The mesh has no valid triangle." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << mesh.tri_count() << " triangle(s), " << mbvh.header.node_count << " node(s)." << std::endl;
+    std::cout << "# Build time: " << stats.build_time << " ms" << std::endl;
+    std::cout << "# SAH cost (BVH2): " << stats.bvh2_cost << std::endl;
+    std::cout << "# SAH cost: " << stats.mbvh_cost << std::endl;
+    if (options.spatial.enabled || options.presplit.enabled) {
+        std::cout << "# References: " << stats.ref_count << " (" << std::showpos
+                  << 100.0 * ((double)stats.ref_count - (double)mesh.tri_count()) / mesh.tri_count() << std::noshowpos << "%)" << std::endl;
+    }
+
+    if (options.presplit.enabled) {
+        // Build again without pre-splitting, to report how much it changes the cost
+        BuildOptions reference = options;
+        reference.presplit.enabled = false;
+        Mbvh unsplit;
+        BuildStats unsplit_stats;
+        build_mbvh(mesh, reference, unsplit, unsplit_stats);
+        std::cout << "# SAH cost without pre-splitting: " << unsplit_stats.mbvh_cost << " ("
+                  << 100.0 * (stats.mbvh_cost - unsplit_stats.mbvh_cost) / unsplit_stats.mbvh_cost << "%)" << std::endl;
+    }
+
+    bool written = write_scene_file(output, [&] (BlockWriter& writer, std::ostream&) {
+        return writer.write_block(BlockType::MBVH, mbvh_block(mbvh)) &&
+               writer.write_block(BlockType::CPU_MBVH, cpu_mbvh_block(mbvh)) &&
+               writer.write_block(BlockType::MESH, mesh_block(mesh));
+    });
+
+    if (!written) {
+        std::cerr << "Cannot write output file." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,82 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include "../frontend/options.h"
+#include "../frontend/bvh_format.h"
+#include "../frontend/mapped_file.h"
+#include "../builder/gpu_bvh.h"
+#include "../builder/cost_profile.h"
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "No arguments. Exiting." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    SahCosts costs;
+    std::string cost_profile;
+    bool help;
+    ArgParser parser(argc, argv);
+    parser.add_option<bool>("help", "h", "Shows this message", help, false);
+    parser.add_option<float>("traversal-cost", "ct", "Sets the SAH cost of traversing a node", costs.traversal, 1.0f, "cost");
+    parser.add_option<float>("intersection-cost", "ci", "Sets the SAH cost of intersecting a triangle", costs.intersection, 1.0f, "cost");
+    parser.add_option<std::string>("cost-profile", "c", "Reads the SAH costs from a profile written by calibrate_cpu", cost_profile, "", "file");
+
+    if (!parser.parse()) {
+        parser.usage();
+        return EXIT_SUCCESS;
+    }
+
+    if (help) {
+        parser.usage();
+        return EXIT_SUCCESS;
+    }
+
+    if (!load_cost_profile(cost_profile, parser, costs)) return EXIT_FAILURE;
+
+    if (parser.arguments().size() < 2) {
+        std::cerr << "Input file and output file expected. Exiting." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const std::string& input = parser.arguments()[0];
+    const std::string& output = parser.arguments()[1];
+
+    MappedFile in;
+    GpuBvh gpu_bvh;
+    if (!in.open(input) || !check_header(in.data(), in.size()) || !read_gpu_bvh(in, gpu_bvh)) {
+        std::cerr << "Invalid BVH file, or the file has no BVH." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const Mbvh mbvh = collapse_gpu_bvh(gpu_bvh, costs);
+    std::cout << gpu_bvh.tri_ids.size() << " triangle(s), " << gpu_bvh.bvh.nodes.size() << " binary node(s) collapsed to "
+              << mbvh.nodes.size() << " node(s)." << std::endl;
+    std::cout << "# SAH cost (BVH2): " << sah_cost(gpu_bvh.bvh, costs) << std::endl;
+    std::cout << "# SAH cost: " << sah_cost(mbvh, costs) << std::endl;
+
+    // Keep all the other blocks (the BVH included), replace any existing MBVH
+    bool written = write_scene_file(output, [&] (BlockWriter& writer, std::ostream&) {
+        bool ok = true;
+        const bool complete = for_each_block(in.data(), in.size(), [&] (BlockType type, const char* data, size_t size) {
+            if (!ok || type == BlockType::PADDING || type == BlockType::DIRECTORY ||
+                type == BlockType::MBVH || type == BlockType::CPU_MBVH) return;
+            if (type == BlockType::COMPRESSED) {
+                const BlockType original = (BlockType)((const compressed::Header*)data)->block_type;
+                if (original == BlockType::MBVH || original == BlockType::CPU_MBVH) return;
+            }
+            ok = writer.write_block(type, data, size);
+        });
+
+        return complete && ok &&
+               writer.write_block(BlockType::MBVH, mbvh_block(mbvh)) &&
+               writer.write_block(BlockType::CPU_MBVH, cpu_mbvh_block(mbvh));
+    });
+
+    if (!written) {
+        std::cerr << "Cannot write output file." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
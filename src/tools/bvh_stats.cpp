@@ -0,0 +1,160 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <cmath>
+#include "../frontend/options.h"
+#include "../frontend/bvh_format.h"
+#include "../frontend/mapped_file.h"
+#include "../builder/analysis.h"
+#include "../builder/gpu_bvh.h"
+#include "../builder/cost_profile.h"
+
+static double percent(size_t count, size_t total) {
+    return total > 0 ? 100.0 * count / total : 0.0;
+}
+
+static void print_histogram(std::ostream& out, const std::vector<size_t>& histogram, size_t total) {
+    for (size_t i = 0; i < histogram.size(); i++) {
+        if (histogram[i] == 0) continue;
+        out << "    " << std::setw(4) << i << ": " << std::setw(10) << histogram[i]
+            << " (" << std::fixed << std::setprecision(2) << percent(histogram[i], total) << "%)" << std::endl;
+        out.unsetf(std::ios::floatfield);
+    }
+}
+
+static void print_text(std::ostream& out, const BvhStats& stats) {
+    out << "# Nodes: " << stats.node_count << std::endl;
+    out << "# Leaves: " << stats.leaf_count << std::endl;
+    out << "# Triangles: " << stats.tri_count << std::endl;
+    out << "# References: " << stats.tri_refs << std::endl;
+    out << "# SAH cost: " << stats.sah_cost << std::endl;
+    out << "# EPO: " << stats.epo << std::endl;
+    out << "# Empty child slots: " << stats.empty_slots << " / " << 4 * stats.node_count
+        << " (" << percent(stats.empty_slots, 4 * stats.node_count) << "%)" << std::endl;
+    out << "# Wasted triangle lanes: " << stats.wasted_lanes << " / " << 4 * stats.block_count
+        << " (" << percent(stats.wasted_lanes, 4 * stats.block_count) << "%)" << std::endl;
+    out << "# Leaf depth: " << stats.min_depth << " min, " << stats.avg_depth << " avg, " << stats.max_depth << " max" << std::endl;
+    out << "# Leaves per depth:" << std::endl;
+    print_histogram(out, stats.depth_histogram, stats.leaf_count);
+    out << "# Leaves per number of triangles:" << std::endl;
+    print_histogram(out, stats.leaf_histogram, stats.leaf_count);
+}
+
+static void print_array(std::ostream& out, const std::vector<size_t>& values) {
+    out << "[";
+    for (size_t i = 0; i < values.size(); i++)
+        out << (i > 0 ? ", " : "") << values[i];
+    out << "]";
+}
+
+/// Real number in JSON, which has no representation of NaN and infinities
+struct JsonReal {
+    double value;
+};
+
+static std::ostream& operator << (std::ostream& out, JsonReal real) {
+    if (std::isfinite(real.value))
+        out << real.value;
+    else
+        out << "null";
+    return out;
+}
+
+static void print_json(std::ostream& out, const BvhStats& stats) {
+    out << "{" << std::endl;
+    out << "    \"nodes\": " << stats.node_count << "," << std::endl;
+    out << "    \"leaves\": " << stats.leaf_count << "," << std::endl;
+    out << "    \"triangles\": " << stats.tri_count << "," << std::endl;
+    out << "    \"references\": " << stats.tri_refs << "," << std::endl;
+    out << "    \"blocks\": " << stats.block_count << "," << std::endl;
+    out << "    \"sah_cost\": " << JsonReal { stats.sah_cost } << "," << std::endl;
+    out << "    \"epo\": " << JsonReal { stats.epo } << "," << std::endl;
+    out << "    \"empty_slots\": " << stats.empty_slots << "," << std::endl;
+    out << "    \"wasted_lanes\": " << stats.wasted_lanes << "," << std::endl;
+    out << "    \"min_depth\": " << stats.min_depth << "," << std::endl;
+    out << "    \"avg_depth\": " << JsonReal { stats.avg_depth } << "," << std::endl;
+    out << "    \"max_depth\": " << stats.max_depth << "," << std::endl;
+    out << "    \"depth_histogram\": ";
+    print_array(out, stats.depth_histogram);
+    out << "," << std::endl;
+    out << "    \"leaf_histogram\": ";
+    print_array(out, stats.leaf_histogram);
+    out << std::endl << "}" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "No arguments. Exiting." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    AnalysisOptions options;
+    std::string format;
+    std::string cost_profile;
+    bool help;
+    ArgParser parser(argc, argv);
+    parser.add_option<bool>("help", "h", "Shows this message", help, false);
+    parser.add_option<std::string>("format", "f", "Sets the output format (text or json)", format, "text", "format");
+    parser.add_option<int>("samples", "n", "Sets the number of points sampled on the triangles to estimate the EPO", options.epo_samples, 1 << 18, "count");
+    parser.add_option<float>("traversal-cost", "ct", "Sets the SAH cost of traversing a node", options.costs.traversal, 1.0f, "cost");
+    parser.add_option<float>("intersection-cost", "ci", "Sets the SAH cost of intersecting a triangle", options.costs.intersection, 1.0f, "cost");
+    parser.add_option<std::string>("cost-profile", "c", "Reads the SAH costs from a profile written by calibrate_cpu", cost_profile, "", "file");
+
+    if (!parser.parse()) {
+        parser.usage();
+        return EXIT_SUCCESS;
+    }
+
+    if (help) {
+        parser.usage();
+        return EXIT_SUCCESS;
+    }
+
+    if (!load_cost_profile(cost_profile, parser, options.costs)) return EXIT_FAILURE;
+
+    if (parser.arguments().size() < 1) {
+        std::cerr << "Input file expected. Exiting." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (format != "text" && format != "json") {
+        std::cerr << "Unknown output format '" << format << "'. Exiting." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    MappedFile in;
+    if (!in.open(parser.arguments()[0]) || !check_header(in.data(), in.size())) {
+        std::cerr << "Invalid BVH file." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // Files that only contain the BVH of the GPU version are analyzed after the collapse done by the CPU frontend
+    Mbvh mbvh;
+    GpuBvh gpu_bvh;
+    bool collapsed = false;
+    if (!read_mbvh(in, mbvh)) {
+        if (!read_gpu_bvh(in, gpu_bvh)) {
+            std::cerr << "The file has no valid BVH." << std::endl;
+            return EXIT_FAILURE;
+        }
+        mbvh = collapse_gpu_bvh(gpu_bvh, options.costs);
+        collapsed = true;
+    }
+
+    BvhStats stats;
+    if (!analyze_mbvh(mbvh, options, stats)) {
+        std::cerr << "Invalid MBVH." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (format == "json") {
+        print_json(std::cout, stats);
+    } else {
+        if (collapsed)
+            std::cout << "Binary BVH with " << gpu_bvh.bvh.nodes.size() << " node(s), collapsed to a 4-wide BVH." << std::endl;
+        print_text(std::cout, stats);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,249 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <random>
+#include <array>
+#include <algorithm>
+#include <vector>
+#include <cmath>
+#include <anydsl_runtime.hpp>
+#include "../frontend/options.h"
+#include "../frontend/traversal.h"
+#include "../frontend/convert_mbvh.h"
+#include "../builder/build.h"
+#include "../builder/cost_profile.h"
+
+// The rays of a packet are all the same, so that the packet traverses the nodes that a single ray would traverse
+static const int packet_size = 8;
+
+/// Measurements for one BVH of the synthetic scene
+struct Sample {
+    int leaf_size;          // Maximum number of triangles per leaf of the BVH
+    double nodes;           // Nodes traversed, per packet
+    double blocks;          // Blocks of 4 triangles intersected, per packet
+    double time;            // Time per packet, in nanoseconds
+};
+
+/// Counts the nodes and triangle blocks that the kernels visit for a ray. Returns false if the ray hits a triangle,
+/// in which case the traversal depends on the order of the children, and the counts are not meaningful.
+static bool count_visits(const Mbvh& mbvh, const float3& org, const float3& dir, float tmax, size_t& nodes, size_t& blocks) {
+    const float3 idir = ray_inverse_dir(dir);
+    std::vector<int> stack(1, 0);
+    while (!stack.empty()) {
+        const mbvh::Node& node = mbvh.nodes[stack.back()];
+        stack.pop_back();
+        nodes++;
+        for (int j = 0; j < 4; j++) {
+            const mbvh::BBox& bb = node.bb[j];
+            float t0;
+            if (node.prim_count[j] == 0 ||
+                !intersect_ray_box(float3(bb.lx, bb.ly, bb.lz), float3(bb.ux, bb.uy, bb.uz), org, idir, 0.0f, tmax, t0))
+                continue;
+            if (node.prim_count[j] < 0) {
+                stack.push_back(node.children[j]);
+                continue;
+            }
+            for (int k = 0; k < node.prim_count[j]; k++) {
+                blocks++;
+                float t = tmax;
+                if (intersect_tri_block((const float*)&mbvh.tris[node.children[j] + 13 * k], org, dir, 0.0f, t)) return false;
+            }
+        }
+    }
+    return true;
+}
+
+/// Solves the linear least squares problem min |A x - b| for 3 unknowns, with the normal equations.
+static bool least_squares(const std::vector<std::array<double, 3>>& a, const std::vector<double>& b, double x[3]) {
+    double m[3][4] = {};
+    for (size_t k = 0; k < a.size(); k++) {
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) m[i][j] += a[k][i] * a[k][j];
+            m[i][3] += a[k][i] * b[k];
+        }
+    }
+
+    // Gaussian elimination with partial pivoting
+    for (int i = 0; i < 3; i++) {
+        int pivot = i;
+        for (int j = i + 1; j < 3; j++) {
+            if (std::abs(m[j][i]) > std::abs(m[pivot][i])) pivot = j;
+        }
+        if (std::abs(m[pivot][i]) < 1e-12) return false;
+        for (int k = 0; k < 4; k++) std::swap(m[i][k], m[pivot][k]);
+        for (int j = 0; j < 3; j++) {
+            if (j == i) continue;
+            const double f = m[j][i] / m[i][i];
+            for (int k = i; k < 4; k++) m[j][k] -= f * m[i][k];
+        }
+    }
+    for (int i = 0; i < 3; i++) x[i] = m[i][3] / m[i][i];
+    return true;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "No arguments. Exiting." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    int tri_count, ray_count, times;
+    float tri_size;
+    bool help;
+    ArgParser parser(argc, argv);
+    parser.add_option<bool>("help", "h", "Shows this message", help, false);
+    parser.add_option<int>("triangles", "n", "Sets the number of triangles of the synthetic scene", tri_count, 1 << 17, "count");
+    parser.add_option<float>("size", "s", "Sets the size of the triangles, relative to the scene", tri_size, 0.004f, "ratio");
+    parser.add_option<int>("rays", "r", "Sets the number of distinct rays (every ray fills a packet)", ray_count, 1 << 16, "count");
+    parser.add_option<int>("times", "t", "Sets the number of timed runs for every BVH", times, 5, "count");
+
+    if (!parser.parse()) {
+        parser.usage();
+        return EXIT_SUCCESS;
+    }
+
+    if (help) {
+        parser.usage();
+        return EXIT_SUCCESS;
+    }
+
+    if (parser.arguments().size() < 1) {
+        std::cerr << "Output file expected. Exiting." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (tri_count < 1 || ray_count < 1 || times < 1 || tri_size <= 0.0f) {
+        std::cerr << "Invalid number of triangles, rays or runs." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // Small triangles scattered in the unit cube, so that most rays traverse many nodes without hitting anything
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    TriMesh mesh;
+    for (int i = 0; i < tri_count; i++) {
+        const float3 center(uniform(rng), uniform(rng), uniform(rng));
+        for (int j = 0; j < 3; j++) {
+            mesh.vertices.push_back(center + float3(uniform(rng) - 0.5f, uniform(rng) - 0.5f, uniform(rng) - 0.5f) * tri_size);
+            mesh.indices.push_back(i * 3 + j);
+        }
+    }
+
+    // The BVHs have leaves of different sizes, which separates the two costs. The traversal cost is high enough for
+    // the builder to make leaves as large as allowed.
+    const int leaf_sizes[] = { 4, 8, 16, 32, 64 };
+    const int config_count = sizeof(leaf_sizes) / sizeof(leaf_sizes[0]);
+    std::vector<Mbvh> mbvhs(config_count);
+    for (int i = 0; i < config_count; i++) {
+        BuildOptions options;
+        options.sah.costs.traversal = 1000.0f;
+        options.sah.max_leaf_size = leaf_sizes[i];
+        BuildStats stats;
+        if (!build_mbvh(mesh, options, mbvhs[i], stats)) {
+            std::cerr << "Cannot build the BVH of the synthetic scene." << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Rays that start outside of the scene and go through a random point of it. Only the rays that hit nothing are kept,
+    // since the nodes they traverse do not depend on the traversal order.
+    std::vector<std::pair<float3, float3>> candidates;
+    const float tmax = 1e9f;
+    for (int attempts = 0; (int)candidates.size() < ray_count && attempts < 16 * ray_count; attempts++) {
+        const float3 dir = normalize(float3(uniform(rng) - 0.5f, uniform(rng) - 0.5f, uniform(rng) - 0.5f));
+        const float3 target(uniform(rng), uniform(rng), uniform(rng));
+        const float3 org = target - dir * 2.0f;
+        size_t nodes = 0, blocks = 0;
+        if (count_visits(mbvhs[0], org, dir, tmax, nodes, blocks))
+            candidates.emplace_back(org, dir);
+    }
+    if ((int)candidates.size() < ray_count) {
+        std::cerr << "Too few rays miss the synthetic scene. Use fewer or smaller triangles." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    anydsl::Array<Ray> rays(ray_count * packet_size);
+    anydsl::Array<Hit> hits(ray_count * packet_size);
+    for (int i = 0; i < ray_count; i++) {
+        const float3& org = candidates[i].first;
+        const float3& dir = candidates[i].second;
+        for (int j = 0; j < packet_size; j++) {
+            rays.data()[i * packet_size + j].org = Vec4 { org.x, org.y, org.z, 0.0f };
+            rays.data()[i * packet_size + j].dir = Vec4 { dir.x, dir.y, dir.z, tmax };
+        }
+    }
+
+    std::vector<Sample> samples(config_count);
+    for (int i = 0; i < config_count; i++) {
+        const Mbvh& mbvh = mbvhs[i];
+        Sample& sample = samples[i];
+        sample.leaf_size = leaf_sizes[i];
+
+        size_t nodes = 0, blocks = 0;
+        for (int j = 0; j < ray_count; j++) {
+            if (!count_visits(mbvh, candidates[j].first, candidates[j].second, tmax, nodes, blocks)) {
+                std::cerr << "A ray hits the synthetic scene. Exiting." << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+        sample.nodes  = double(nodes) / ray_count;
+        sample.blocks = double(blocks) / ray_count;
+
+        anydsl::Array<Node> nodes_ref(mbvh.nodes.size());
+        anydsl::Array<Vec4> tris_ref(cpu_vert_count(mbvh.nodes.data(), mbvh.nodes.size()));
+        convert_mbvh(mbvh.nodes.data(), mbvh.nodes.size(), (const float*)mbvh.tris.data(),
+                     (cpu::Node*)nodes_ref.data(), (cpu::Vec4*)tris_ref.data());
+
+        // The fastest run is the least disturbed by the rest of the system
+        long long best = -1;
+        for (int k = 0; k <= times; k++) {
+            long long t0 = get_time();
+            intersect(nodes_ref.data(), tris_ref.data(), rays.data(), hits.data(), ray_count * packet_size);
+            long long t1 = get_time();
+            if (k > 0 && (best < 0 || t1 - t0 < best)) best = t1 - t0;
+        }
+        sample.time = 1000.0 * best / ray_count;
+
+        int hit_count = 0;
+        for (int j = 0; j < ray_count * packet_size; j++)
+            hit_count += hits.data()[j].tri_id >= 0;
+        if (hit_count > 0)
+            std::cerr << "Warning: " << hit_count << " ray(s) hit the synthetic scene in the kernel." << std::endl;
+
+        std::cout << "Leaf size " << std::setw(2) << sample.leaf_size << ": "
+                  << sample.nodes << " node(s), " << sample.blocks << " block(s), "
+                  << sample.time << " ns per packet" << std::endl;
+    }
+
+    // Time per packet = node time * nodes + block time * blocks + constant time
+    std::vector<std::array<double, 3>> a;
+    std::vector<double> b;
+    for (auto& sample : samples) {
+        a.push_back({{ sample.nodes, sample.blocks, 1.0 }});
+        b.push_back(sample.time);
+    }
+    double x[3];
+    if (!least_squares(a, b, x) || x[0] <= 0.0 || x[1] <= 0.0) {
+        std::cerr << "Cannot fit the cost model to the measurements. Try more rays or runs." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // The builders count the intersection cost per triangle, and a block has 4 triangles
+    SahCosts costs;
+    costs.intersection = 1.0f;
+    costs.traversal = float(x[0] / (x[1] / costs.leaf_block));
+    std::cout << "# Node: " << x[0] << " ns" << std::endl;
+    std::cout << "# Triangle block: " << x[1] << " ns" << std::endl;
+    std::cout << "# Traversal cost: " << costs.traversal << std::endl;
+    std::cout << "# Intersection cost: " << costs.intersection << std::endl;
+
+    std::ostringstream comment;
+    comment << "Cost profile measured by calibrate_cpu" << std::endl
+            << "Node: " << x[0] << " ns, triangle block: " << x[1] << " ns";
+    if (!write_cost_profile(parser.arguments()[0], costs, comment.str())) {
+        std::cerr << "Cannot write output file." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,95 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include "../frontend/options.h"
+#include "../frontend/bvh_format.h"
+#include "../frontend/compression.h"
+#include "../frontend/mapped_file.h"
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "No arguments. Exiting." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    int level, chunk_kb;
+    bool decompress, help;
+    ArgParser parser(argc, argv);
+    parser.add_option<bool>("help", "h", "Shows this message", help, false);
+    parser.add_option<int>("level", "l", "Sets the compression level (1 to 9)", level, 6, "level");
+    parser.add_option<int>("chunk-size", "s", "Sets the size of the independently decompressed chunks", chunk_kb, 1024, "KB");
+    parser.add_option<bool>("decompress", "d", "Decompresses the blocks instead of compressing them", decompress, false);
+
+    if (!parser.parse()) {
+        parser.usage();
+        return EXIT_SUCCESS;
+    }
+
+    if (help) {
+        parser.usage();
+        return EXIT_SUCCESS;
+    }
+
+    if (parser.arguments().size() < 2) {
+        std::cerr << "Input file and output file expected. Exiting." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (chunk_kb <= 0) {
+        std::cerr << "Invalid chunk size." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const std::string& input = parser.arguments()[0];
+    const std::string& output = parser.arguments()[1];
+
+    MappedFile in;
+    if (!in.open(input) || !check_header(in.data(), in.size())) {
+        std::cerr << "Invalid BVH file." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    size_t in_size = 0, out_size = 0;
+    auto t0 = std::chrono::high_resolution_clock::now();
+    bool written = write_scene_file(output, [&] (BlockWriter& writer, std::ostream&) {
+        bool ok = true;
+        std::vector<char> buf;
+        const bool complete = for_each_block(in.data(), in.size(), [&] (BlockType type, const char* data, size_t size) {
+            if (!ok || type == BlockType::PADDING || type == BlockType::DIRECTORY) return;
+
+            const char* contents = data;
+            if (!decompress && block_header_size(type) > 0) {
+                // Only the blocks with a known header can be compressed
+                ok = compress_block(type, data, size, chunk_kb * 1024, level, buf);
+                type = BlockType::COMPRESSED;
+                contents = buf.data();
+                in_size += size;
+                out_size += buf.size();
+                size = buf.size();
+            } else if (decompress && type == BlockType::COMPRESSED) {
+                const compressed::Header* h = (const compressed::Header*)data;
+                buf.resize(h->block_size);
+                memcpy(buf.data(), original_header(h), h->header_size);
+                ok = decompress_block(in, h, { BlockSegment { h->header_size, h->block_size - h->header_size, buf.data() + h->header_size } });
+                type = (BlockType)h->block_type;
+                contents = buf.data();
+                in_size += size;
+                out_size += buf.size();
+                size = buf.size();
+            }
+
+            ok = ok && writer.write_block(type, contents, size);
+        });
+        return complete && ok;
+    });
+    auto t1 = std::chrono::high_resolution_clock::now();
+
+    if (!written) {
+        std::cerr << "Cannot " << (decompress ? "decompress" : "compress") << " the file." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << in_size << " byte(s) " << (decompress ? "decompressed" : "compressed") << " to " << out_size << " byte(s) in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count() << "ms." << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -1,6 +1,7 @@
 #include <iostream>
 #include <fstream>
 #include "../frontend/options.h"
+#include "../frontend/ray_format.h"
 #include "linear.h"
 #include "camera.h"
 
@@ -11,8 +12,8 @@ int main(int argc, char** argv) {
     }
 
     int width, height;
-    float fov;
-    std::string eye_str, center_str, up_str;
+    float fov, tmin, tmax;
+    std::string eye_str, center_str, up_str, format;
     ArgParser parser(argc, argv);
     parser.add_option<std::string>("eye", "e", "Sets the eye position", eye_str, "", "x,y,z");
     parser.add_option<std::string>("center", "c", "Sets the center position", center_str, "", "x,y,z");
@@ -20,6 +21,9 @@ int main(int argc, char** argv) {
     parser.add_option<float>("fov", "f", "Sets the field of view", fov, 60.0f, "degrees");
     parser.add_option<int>("width", "w", "Sets the viewport width", width, 1024, "pixels");
     parser.add_option<int>("height", "h", "Sets the viewport height", height, 1024, "pixels");
+    parser.add_option<float>("tmin", "tmin", "Sets the minimum t parameter along the rays, in the ray and shared formats", tmin, 0.0f, "t");
+    parser.add_option<float>("tmax", "tmax", "Sets the maximum t parameter along the rays, in the ray and shared formats", tmax, 1e9f, "t");
+    parser.add_option<std::string>("format", "fmt", "Sets the file format (v1 for files without header, ray, or shared)", format, "v1", "format");
 
     if (!parser.parse()) {
         parser.usage();
@@ -43,6 +47,18 @@ int main(int argc, char** argv) {
         return EXIT_FAILURE;
     }
 
+    rays::Header header;
+    if (!rays::parse_format(format, (uint64_t)width * height, rays::INTERVALS, header)) {
+        std::cerr << "Invalid file format." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // All the rays start at the eye position
+    header.org[0] = eye.x;
+    header.org[1] = eye.y;
+    header.org[2] = eye.z;
+    header.org[3] = tmin;
+
     std::ofstream ray_file(parser.arguments()[0], std::ofstream::binary);
     if (!ray_file) {
         std::cerr << "Cannot open output file." << std::endl;
@@ -51,13 +67,14 @@ int main(int argc, char** argv) {
 
     Camera cam = gen_camera(eye, center, up, fov, (float)width / (float)height);
 
+    rays::write_header(ray_file, header);
+
     for (int y = 0; y < height; y++) {
         for (int x = 0; x < width; x++) {
             const float kx = 2 * x / (float)width - 1;
             const float ky = 1 - 2 * y / (float)height;
             const float3 dir = cam.dir + cam.right * kx + cam.up * ky;
-            ray_file.write((const char*)&eye, sizeof(float) * 3);
-            ray_file.write((const char*)&dir, sizeof(float) * 3);
+            rays::write_ray(ray_file, header, &eye.x, tmin, &dir.x, tmax);
         }
     }
 
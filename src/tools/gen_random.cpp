@@ -3,6 +3,7 @@
 #include <random>
 #include "../frontend/options.h"
 #include "../frontend/bvh_format.h"
+#include "../frontend/ray_format.h"
 #include "linear.h"
 
 int main(int argc, char** argv) {
@@ -12,7 +13,8 @@ int main(int argc, char** argv) {
     }
 
     int seed, width, height;
-    std::string bvh;
+    float tmin, tmax;
+    std::string bvh, format;
     std::random_device rd;
 
     ArgParser parser(argc, argv);
@@ -20,6 +22,9 @@ int main(int argc, char** argv) {
     parser.add_option<int>("seed", "s", "Sets the random generator seed", seed, rd(), "number");
     parser.add_option<int>("width", "w", "Sets the viewport width", width, 1024, "pixels");
     parser.add_option<int>("height", "h", "Sets the viewport height", height, 1024, "pixels");
+    parser.add_option<float>("tmin", "tmin", "Sets the minimum t parameter along the rays, in the ray format", tmin, 0.0f, "t");
+    parser.add_option<float>("tmax", "tmax", "Sets the maximum t parameter along the rays, in the ray format", tmax, 1e9f, "t");
+    parser.add_option<std::string>("format", "fmt", "Sets the file format (v1 for files without header, or ray)", format, "v1", "format");
 
     if (!parser.parse()) {
         parser.usage();
@@ -35,6 +40,13 @@ int main(int argc, char** argv) {
         std::clog << ")." << std::endl;
     }
 
+    // The rays have random origins, so they cannot be stored with a shared origin
+    rays::Header header;
+    if (format == "shared" || !rays::parse_format(format, (uint64_t)width * height, rays::INTERVALS, header)) {
+        std::cerr << "Invalid file format." << std::endl;
+        return EXIT_FAILURE;
+    }
+
     // Find the bounds from the BVH file
     std::ifstream bvh_file(bvh, std::ifstream::binary);
     if (!bvh_file || !check_header(bvh_file) || !locate_block(bvh_file, BlockType::MBVH)) {
@@ -57,13 +69,13 @@ int main(int argc, char** argv) {
         return EXIT_FAILURE;
     }
 
+    rays::write_header(ray_file, header);
     for (int y = 0; y < height; y++) {
         for (int x = 0; x < width; x++) {
             const float3 rnd1 = min + ext * float3(dis(gen), dis(gen), dis(gen));
             const float3 rnd2 = min + ext * float3(dis(gen), dis(gen), dis(gen));
             const float3 dir = rnd2 - rnd1;
-            ray_file.write((const char*)&rnd1, sizeof(float) * 3);
-            ray_file.write((const char*)&dir, sizeof(float) * 3);
+            rays::write_ray(ray_file, header, &rnd1.x, tmin, &dir.x, tmax);
         }
     }
 
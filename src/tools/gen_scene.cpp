@@ -0,0 +1,247 @@
+#include <iostream>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+#include "../frontend/options.h"
+#include "../frontend/bvh_format.h"
+#include "../frontend/ray_format.h"
+#include "../builder/build.h"
+#include "../builder/cost_profile.h"
+#include "linear.h"
+#include "camera.h"
+
+/// Adds a sphere tessellated in rings and segments, with about the given number of triangles
+static void add_sphere(TriMesh& mesh, const float3& center, float radius, size_t tri_count) {
+    // A sphere with r rings has 4 r (r - 1) triangles, with twice as many segments as rings
+    const int rings = std::max(2, (int)((1.0 + std::sqrt(1.0 + tri_count)) / 2.0 + 0.5));
+    const int segments = 2 * rings;
+
+    const int first = mesh.vertices.size();
+    mesh.vertices.push_back(center + float3(0.0f, radius, 0.0f));
+    for (int i = 1; i < rings; i++) {
+        const float theta = pi * i / rings;
+        for (int j = 0; j < segments; j++) {
+            const float phi = 2.0f * pi * j / segments;
+            mesh.vertices.push_back(center + float3(sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi)) * radius);
+        }
+    }
+    mesh.vertices.push_back(center - float3(0.0f, radius, 0.0f));
+    const int last = mesh.vertices.size() - 1;
+
+    auto vertex = [&] (int ring, int segment) { return first + 1 + (ring - 1) * segments + segment % segments; };
+    auto add_tri = [&] (int a, int b, int c) {
+        mesh.indices.push_back(a);
+        mesh.indices.push_back(b);
+        mesh.indices.push_back(c);
+    };
+    for (int j = 0; j < segments; j++) {
+        add_tri(first, vertex(1, j + 1), vertex(1, j));
+        for (int i = 1; i < rings - 1; i++) {
+            add_tri(vertex(i, j), vertex(i, j + 1), vertex(i + 1, j));
+            add_tri(vertex(i, j + 1), vertex(i + 1, j + 1), vertex(i + 1, j));
+        }
+        add_tri(last, vertex(rings - 1, j), vertex(rings - 1, j + 1));
+    }
+}
+
+/// Random triangles in the cube [-1, 1]^3, about twice as large as the average distance between them
+static void add_soup(TriMesh& mesh, size_t tri_count, std::mt19937& rng) {
+    std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+    const float size = 4.0f / std::cbrt((float)tri_count);
+    for (size_t i = 0; i < tri_count; i++) {
+        const float3 center(uniform(rng), uniform(rng), uniform(rng));
+        for (int j = 0; j < 3; j++) {
+            mesh.indices.push_back(mesh.vertices.size());
+            mesh.vertices.push_back(center + float3(uniform(rng), uniform(rng), uniform(rng)) * (0.5f * size));
+        }
+    }
+}
+
+/// Heightfield over [-1, 1]^2, made of a sum of waves with random directions and phases
+static void add_terrain(TriMesh& mesh, size_t tri_count, std::mt19937& rng) {
+    const int octaves = 6;
+    std::uniform_real_distribution<float> uniform(0.0f, 2.0f * pi);
+    float angles[octaves], phases[octaves];
+    for (int o = 0; o < octaves; o++) {
+        angles[o] = uniform(rng);
+        phases[o] = uniform(rng);
+    }
+    auto height = [&] (float x, float z) {
+        float h = 0.0f;
+        for (int o = 0; o < octaves; o++) {
+            const float freq = 3.0f * (1 << o);
+            h += 0.25f / (1 << o) * sinf(freq * (cosf(angles[o]) * x + sinf(angles[o]) * z) + phases[o]);
+        }
+        return h;
+    };
+
+    // A grid of k x k quads has 2 k^2 triangles
+    const int k = std::max(1, (int)(std::sqrt(tri_count / 2.0) + 0.5));
+    const int first = mesh.vertices.size();
+    for (int i = 0; i <= k; i++) {
+        for (int j = 0; j <= k; j++) {
+            const float x = 2.0f * j / k - 1.0f;
+            const float z = 2.0f * i / k - 1.0f;
+            mesh.vertices.emplace_back(x, height(x, z), z);
+        }
+    }
+    for (int i = 0; i < k; i++) {
+        for (int j = 0; j < k; j++) {
+            const int v = first + i * (k + 1) + j;
+            const int quad[6] = { v, v + k + 1, v + 1, v + 1, v + k + 1, v + k + 2 };
+            mesh.indices.insert(mesh.indices.end(), quad, quad + 6);
+        }
+    }
+}
+
+/// Grid of k x k x k spheres with gaps between them, so that rays traverse several layers. The scene format has
+/// no instances, so that the copies are stored in the mesh.
+static void add_grid(TriMesh& mesh, size_t tri_count, int k) {
+    const size_t copies = (size_t)k * k * k;
+    const size_t sphere_tris = std::max<size_t>(tri_count / copies, 8);
+    for (int x = 0; x < k; x++) {
+        for (int y = 0; y < k; y++) {
+            for (int z = 0; z < k; z++) {
+                const float3 center(x - 0.5f * (k - 1), y - 0.5f * (k - 1), z - 0.5f * (k - 1));
+                add_sphere(mesh, center, 0.35f, sphere_tris);
+            }
+        }
+    }
+}
+
+static bool write_scene(const std::string& output, const Mbvh& mbvh, const TriMesh& mesh) {
+    return write_scene_file(output, [&] (BlockWriter& writer, std::ostream&) {
+        return writer.write_block(BlockType::MBVH, mbvh_block(mbvh)) &&
+               writer.write_block(BlockType::CPU_MBVH, cpu_mbvh_block(mbvh)) &&
+               writer.write_block(BlockType::MESH, mesh_block(mesh));
+    });
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "No arguments. Exiting." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::string type, cost_profile, primary_file, random_file, format;
+    int tri_count, copies, seed, resolution;
+    bool help;
+    BuildOptions options;
+    ArgParser parser(argc, argv);
+    parser.add_option<bool>("help", "h", "Shows this message", help, false);
+    parser.add_option<std::string>("type", "t", "Sets the type of scene (sphere, soup, terrain or grid)", type, "sphere", "type");
+    parser.add_option<int>("triangles", "n", "Sets the approximate number of triangles", tri_count, 100000, "count");
+    parser.add_option<int>("copies", "k", "Sets the number of spheres along every axis of the grid", copies, 4, "count");
+    parser.add_option<int>("seed", "s", "Sets the random generator seed (the same seed gives the same scene)", seed, 0, "number");
+    parser.add_option<std::string>("cost-profile", "c", "Reads the SAH costs from a profile written by calibrate_cpu", cost_profile, "", "file");
+    parser.add_option<std::string>("primary", "p", "Writes primary rays from a camera that frames the scene", primary_file, "", "file.rays");
+    parser.add_option<std::string>("random", "r", "Writes rays between random points of the scene", random_file, "", "file.rays");
+    parser.add_option<int>("resolution", "res", "Sets the width and height of the camera, and the number of random rays", resolution, 1024, "pixels");
+    parser.add_option<std::string>("format", "fmt", "Sets the format of the ray files (v1 for files without header, or ray)", format, "v1", "format");
+
+    if (!parser.parse()) {
+        parser.usage();
+        return EXIT_SUCCESS;
+    }
+
+    if (help) {
+        parser.usage();
+        return EXIT_SUCCESS;
+    }
+
+    if (!load_cost_profile(cost_profile, parser, options.sah.costs)) return EXIT_FAILURE;
+
+    if (parser.arguments().size() < 1) {
+        std::cerr << "Output file expected. Exiting." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (tri_count < 1 || copies < 1 || resolution < 1) {
+        std::cerr << "Invalid number of triangles, copies or resolution." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    rays::Header header;
+    if (format == "shared" || !rays::parse_format(format, (uint64_t)resolution * resolution, rays::INTERVALS, header)) {
+        std::cerr << "Invalid file format." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    TriMesh mesh;
+    std::mt19937 rng(seed);
+    if (type == "sphere") {
+        add_sphere(mesh, float3(0.0f, 0.0f, 0.0f), 1.0f, tri_count);
+    } else if (type == "soup") {
+        add_soup(mesh, tri_count, rng);
+    } else if (type == "terrain") {
+        add_terrain(mesh, tri_count, rng);
+    } else if (type == "grid") {
+        add_grid(mesh, tri_count, copies);
+    } else {
+        std::cerr << "Unknown scene type '" << type << "'. Exiting." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    Mbvh mbvh;
+    BuildStats stats;
+    if (!build_mbvh(mesh, options, mbvh, stats)) {
+        std::cerr << "The scene has no valid triangle." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << mesh.tri_count() << " triangle(s), " << mbvh.header.node_count << " node(s)." << std::endl;
+    std::cout << "# Build time: " << stats.build_time << " ms" << std::endl;
+    std::cout << "# SAH cost: " << stats.mbvh_cost << std::endl;
+
+    if (!write_scene(parser.arguments()[0], mbvh, mesh)) {
+        std::cerr << "Cannot write output file." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const float3 min(mbvh.header.scene_bb.lx, mbvh.header.scene_bb.ly, mbvh.header.scene_bb.lz);
+    const float3 max(mbvh.header.scene_bb.ux, mbvh.header.scene_bb.uy, mbvh.header.scene_bb.uz);
+    const float3 center = (min + max) * 0.5f;
+    const float radius = 0.5f * std::sqrt(dot(max - min, max - min));
+    const float tmin = 0.0f, tmax = 1e9f;
+
+    if (!primary_file.empty()) {
+        // The camera looks at the scene from above and from the front, close enough for the scene to fill the image
+        const float3 eye = center + normalize(float3(0.4f, 0.6f, 1.0f)) * (1.4f * radius);
+        const Camera cam = gen_camera(eye, center, float3(0.0f, 1.0f, 0.0f), 60.0f, 1.0f);
+        std::ofstream ray_file(primary_file, std::ofstream::binary);
+        rays::write_header(ray_file, header);
+        for (int y = 0; y < resolution; y++) {
+            for (int x = 0; x < resolution; x++) {
+                const float kx = 2 * x / (float)resolution - 1;
+                const float ky = 1 - 2 * y / (float)resolution;
+                const float3 dir = cam.dir + cam.right * kx + cam.up * ky;
+                rays::write_ray(ray_file, header, &eye.x, tmin, &dir.x, tmax);
+            }
+        }
+        if (!ray_file) {
+            std::cerr << "Cannot write primary rays." << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (!random_file.empty()) {
+        std::mt19937_64 gen(seed);
+        std::uniform_real_distribution<float> dis(0.0f, 1.0f);
+        const float3 ext = max - min;
+        std::ofstream ray_file(random_file, std::ofstream::binary);
+        rays::write_header(ray_file, header);
+        for (int i = 0; i < resolution * resolution; i++) {
+            const float3 rnd1 = min + ext * float3(dis(gen), dis(gen), dis(gen));
+            const float3 rnd2 = min + ext * float3(dis(gen), dis(gen), dis(gen));
+            const float3 dir = rnd2 - rnd1;
+            rays::write_ray(ray_file, header, &rnd1.x, tmin, &dir.x, tmax);
+        }
+        if (!ray_file) {
+            std::cerr << "Cannot write random rays." << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -2,6 +2,7 @@
 #include <fstream>
 #include "../frontend/options.h"
 #include "../frontend/bvh_format.h"
+#include "../frontend/ray_format.h"
 #include "linear.h"
 
 size_t file_size(std::istream& is) {
@@ -18,12 +19,16 @@ int main(int argc, char** argv) {
         return EXIT_FAILURE;
     }
 
-    std::string depth, primary, light_str;
+    std::string depth, primary, light_str, format;
+    float tmin, tmax;
 
     ArgParser parser(argc, argv);
     parser.add_option<std::string>("depth", "d", "Sets the depth buffer file", depth, "", "depth.fbuf");
     parser.add_option<std::string>("primary", "p", "Sets the primary ray distribution file", primary, "", "primary.rays");
     parser.add_option<std::string>("light", "l", "Sets the light position", light_str, "", "x,y,z");
+    parser.add_option<float>("tmin", "tmin", "Sets the start of the rays, as a fraction of the distance to the light, in the ray and shared formats", tmin, 0.001f, "t");
+    parser.add_option<float>("tmax", "tmax", "Sets the end of the rays, as a fraction of the distance to the light, in the ray and shared formats", tmax, 1.0f, "t");
+    parser.add_option<std::string>("format", "fmt", "Sets the file format (v1 for files without header, ray, or shared)", format, "v1", "format");
 
     if (!parser.parse()) {
         parser.usage();
@@ -64,26 +69,53 @@ int main(int argc, char** argv) {
         return EXIT_FAILURE;
     }
 
+    rays::Header primary_header;
+    if (!rays::read_header(primary_file, file_size(primary_file), primary_header)) {
+        std::cerr << "Invalid primary ray distribution file." << std::endl;
+        return EXIT_FAILURE;
+    }
+
     size_t elem_count = file_size(depth_file) / sizeof(float);
-    size_t ray_count = file_size(primary_file) / (sizeof(float) * 6);
+    size_t ray_count = primary_header.ray_count;
     if (elem_count != ray_count) {
         std::cerr << "Number of rays does not match the depth file size (got "
                   << elem_count << " and " << ray_count << ")." << std::endl;
         return EXIT_FAILURE;
     }
 
+    rays::Header header;
+    if (!rays::parse_format(format, ray_count, rays::INTERVALS, header)) {
+        std::cerr << "Invalid file format." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // With a shared origin, the rays go from the light to the surface
+    const bool from_light = header.layout == (uint32_t)rays::Layout::SHARED_ORG;
+    header.org[0] = light.x;
+    header.org[1] = light.y;
+    header.org[2] = light.z;
+    header.org[3] = 1.0f - tmax;
+    rays::write_header(ray_file, header);
+
+    const size_t primary_size = rays::ray_size((rays::Layout)primary_header.layout);
     for (size_t i = 0; i < elem_count; i++) {
-        float3 org, dir;
+        float ray[8];
         float t;
 
         depth_file.read((char*)&t, sizeof(float));
-        primary_file.read((char*)&org, sizeof(float) * 3);
-        primary_file.read((char*)&dir, sizeof(float) * 3);
+        primary_file.read((char*)ray, primary_size);
+        rays::expand_rays(primary_header, ray, 1, 0.0f, 0.0f);
+        const float3 org(ray[0], ray[1], ray[2]);
+        const float3 dir(ray[4], ray[5], ray[6]);
 
         const float3 new_org = org + t * dir;
-        const float3 new_dir = light - new_org;
-        ray_file.write((const char*)&new_org, sizeof(float) * 3);
-        ray_file.write((const char*)&new_dir, sizeof(float) * 3);
+        if (from_light) {
+            const float3 new_dir = new_org - light;
+            rays::write_ray(ray_file, header, &light.x, 1.0f - tmax, &new_dir.x, 1.0f - tmin);
+        } else {
+            const float3 new_dir = light - new_org;
+            rays::write_ray(ray_file, header, &new_org.x, tmin, &new_dir.x, tmax);
+        }
     }
 
     return EXIT_SUCCESS;
@@ -0,0 +1,114 @@
+#include <iostream>
+#include <vector>
+#include "../frontend/options.h"
+#include "../frontend/bvh_format.h"
+#include "../frontend/convert_mbvh.h"
+#include "../frontend/mapped_file.h"
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "No arguments. Exiting." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    bool help, no_repack;
+    ArgParser parser(argc, argv);
+    parser.add_option<bool>("help", "h", "Shows this message", help, false);
+    parser.add_option<bool>("no-repack", "nr", "Keeps the leaves as they are in the MBVH, without merging them", no_repack, false);
+
+    if (!parser.parse()) {
+        parser.usage();
+        return EXIT_SUCCESS;
+    }
+
+    if (help) {
+        parser.usage();
+        return EXIT_SUCCESS;
+    }
+
+    if (parser.arguments().size() < 2) {
+        std::cerr << "Input file and output file expected. Exiting." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const std::string& input = parser.arguments()[0];
+    const std::string& output = parser.arguments()[1];
+
+    MappedFile in;
+    if (!in.open(input) || !check_header(in.data(), in.size())) {
+        std::cerr << "Invalid BVH file." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    size_t size;
+    const char* block = locate_block(in.data(), in.size(), BlockType::MBVH, &size);
+    if (!block || size < sizeof(mbvh::Header)) {
+        std::cerr << "The file does not contain an MBVH." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    mbvh::Header h;
+    memcpy(&h, block, sizeof(mbvh::Header));
+    if (size < sizeof(mbvh::Header) + sizeof(mbvh::Node) * h.node_count + sizeof(float) * 4 * h.vert_count) {
+        std::cerr << "The MBVH block is truncated." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const mbvh::Node* nodes = (const mbvh::Node*)(block + sizeof(mbvh::Header));
+    const float* vertices = (const float*)(nodes + h.node_count);
+
+    std::vector<cpu::Node> cpu_nodes(h.node_count);
+    std::vector<cpu::Vec4> cpu_tris(cpu_vert_count(nodes, h.node_count));
+    convert_mbvh(nodes, h.node_count, vertices, cpu_nodes.data(), cpu_tris.data());
+
+    if (!no_repack) {
+        const LaneStats before = lane_stats(cpu_nodes.data(), cpu_nodes.size(), cpu_tris.data());
+        std::vector<cpu::Vec4> repacked_tris;
+        repack_leaves(cpu_nodes.data(), cpu_nodes.size(), cpu_tris.data(), repacked_tris);
+        cpu_tris = std::move(repacked_tris);
+        const LaneStats after = lane_stats(cpu_nodes.data(), cpu_nodes.size(), cpu_tris.data());
+
+        std::cout << "Leaves re-packed: " << before.leaf_count << " -> " << after.leaf_count << " leaf(s), "
+                  << before.block_count << " -> " << after.block_count << " block(s)." << std::endl;
+        std::cout << "# Lane utilization: " << 100.0 * before.utilization() << "% -> "
+                  << 100.0 * after.utilization() << "%" << std::endl;
+    }
+
+    cpu::Header cpu_header;
+    cpu_header.node_count = cpu_nodes.size();
+    cpu_header.vert_count = cpu_tris.size();
+    cpu_header.pad[0] = cpu_header.pad[1] = 0;
+
+    // Keep all the other blocks, replace any existing CPU block
+    bool written = write_scene_file(output, [&] (BlockWriter& writer, std::ostream& out) {
+        bool ok = true;
+        const bool complete = for_each_block(in.data(), in.size(), [&] (BlockType type, const char* data, size_t size) {
+            if (!ok || type == BlockType::CPU_MBVH || type == BlockType::PADDING || type == BlockType::DIRECTORY) return;
+            ok = writer.write_block(type, data, size);
+        });
+        if (!complete) {
+            std::cerr << "The input file is truncated." << std::endl;
+            return false;
+        }
+
+        if (!ok || !writer.begin_block(BlockType::CPU_MBVH,
+                                       sizeof(cpu::Header) +
+                                       sizeof(cpu::Node) * cpu_nodes.size() +
+                                       sizeof(cpu::Vec4) * cpu_tris.size())) {
+            std::cerr << "Too many blocks in the input file." << std::endl;
+            return false;
+        }
+        out.write((const char*)&cpu_header, sizeof(cpu::Header));
+        out.write((const char*)cpu_nodes.data(), sizeof(cpu::Node) * cpu_nodes.size());
+        out.write((const char*)cpu_tris.data(), sizeof(cpu::Vec4) * cpu_tris.size());
+        return static_cast<bool>(out);
+    });
+
+    if (!written) {
+        std::cerr << "Cannot write output file." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << cpu_header.node_count << " node(s), " << cpu_header.vert_count << " triangle vector(s) written." << std::endl;
+    return EXIT_SUCCESS;
+}
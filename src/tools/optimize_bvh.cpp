@@ -0,0 +1,100 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include "../frontend/options.h"
+#include "../frontend/bvh_format.h"
+#include "../frontend/compression.h"
+#include "../frontend/mapped_file.h"
+#include "../builder/optimizer.h"
+#include "../builder/cost_profile.h"
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "No arguments. Exiting." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    OptimizerOptions options;
+    float time_budget;
+    std::string cost_profile;
+    bool help;
+    ArgParser parser(argc, argv);
+    parser.add_option<bool>("help", "h", "Shows this message", help, false);
+    parser.add_option<int>("treelet-size", "t", "Sets the number of leaves of the restructured treelets (3 to 8)", options.treelet_size, 7, "count");
+    parser.add_option<float>("time-budget", "b", "Sets the maximum time spent optimizing", time_budget, 10.0f, "seconds");
+    parser.add_option<float>("traversal-cost", "ct", "Sets the SAH cost of traversing a node", options.costs.traversal, 1.0f, "cost");
+    parser.add_option<float>("intersection-cost", "ci", "Sets the SAH cost of intersecting a triangle", options.costs.intersection, 1.0f, "cost");
+    parser.add_option<std::string>("cost-profile", "c", "Reads the SAH costs from a profile written by calibrate_cpu", cost_profile, "", "file");
+
+    if (!parser.parse()) {
+        parser.usage();
+        return EXIT_SUCCESS;
+    }
+
+    if (help) {
+        parser.usage();
+        return EXIT_SUCCESS;
+    }
+
+    if (!load_cost_profile(cost_profile, parser, options.costs)) return EXIT_FAILURE;
+
+    if (parser.arguments().size() < 2) {
+        std::cerr << "Input file and output file expected. Exiting." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (options.treelet_size < 3 || options.treelet_size > 8 || time_budget < 0.0f) {
+        std::cerr << "Invalid treelet size or time budget." << std::endl;
+        return EXIT_FAILURE;
+    }
+    options.time_budget = time_budget;
+
+    const std::string& input = parser.arguments()[0];
+    const std::string& output = parser.arguments()[1];
+
+    MappedFile in;
+    Mbvh mbvh;
+    if (!in.open(input) || !check_header(in.data(), in.size()) || !read_mbvh(in, mbvh)) {
+        std::cerr << "Invalid BVH file, or the file has no MBVH." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const size_t node_count = mbvh.nodes.size();
+    OptimizerStats stats;
+    if (!optimize_mbvh(mbvh, options, stats)) {
+        std::cerr << "Cannot optimize the MBVH." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << node_count << " node(s) before, " << mbvh.nodes.size() << " node(s) after." << std::endl;
+    std::cout << "# Optimization time: " << stats.time << " ms (" << stats.passes << " pass(es), "
+              << stats.treelets << " treelet(s) restructured)" << std::endl;
+    std::cout << "# SAH cost before: " << stats.cost_before << std::endl;
+    std::cout << "# SAH cost after: " << stats.cost_after << std::endl;
+
+    // The MBVH and its CPU layout are replaced (uncompressed), the other blocks are copied as they are
+    bool written = write_scene_file(output, [&] (BlockWriter& writer, std::ostream&) {
+        bool ok = true;
+        const bool complete = for_each_block(in.data(), in.size(), [&] (BlockType type, const char* data, size_t size) {
+            if (!ok || type == BlockType::PADDING || type == BlockType::DIRECTORY) return;
+
+            BlockType original = type;
+            if (type == BlockType::COMPRESSED) original = (BlockType)((const compressed::Header*)data)->block_type;
+
+            if (original == BlockType::MBVH)
+                ok = writer.write_block(original, mbvh_block(mbvh));
+            else if (original == BlockType::CPU_MBVH)
+                ok = writer.write_block(original, cpu_mbvh_block(mbvh));
+            else
+                ok = writer.write_block(type, data, size);
+        });
+        return complete && ok;
+    });
+
+    if (!written) {
+        std::cerr << "Cannot write output file." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,152 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "../frontend/options.h"
+#include "../frontend/bvh_format.h"
+#include "../frontend/ray_format.h"
+#include "../frontend/compression.h"
+#include "../frontend/mapped_file.h"
+#include "../builder/reorder.h"
+
+static bool read_ray_file(const std::string& filename, size_t max_count, float tmin, float tmax, std::vector<float>& rays) {
+    std::ifstream in(filename, std::ifstream::binary);
+    if (!in) return false;
+
+    in.seekg(0, std::ifstream::end);
+    const size_t size = in.tellg();
+    in.seekg(0);
+
+    rays::Header header;
+    if (!rays::read_header(in, size, header)) return false;
+
+    const size_t count = max_count > 0 ? std::min<size_t>(header.ray_count, max_count) : header.ray_count;
+    const size_t ray_size = rays::ray_size((rays::Layout)header.layout);
+    rays.resize(8 * count);
+    in.read((char*)rays.data(), ray_size * count);
+    if ((size_t)in.gcount() != ray_size * count) return false;
+
+    rays::expand_rays(header, rays.data(), count, tmin, tmax);
+    return true;
+}
+
+static void print_stats(const char* name, const AccessStats& stats) {
+    const double rays = std::max<uint64_t>(stats.rays, 1);
+    std::cout << "# " << name << ": " << stats.nodes / rays << " node(s), " << stats.blocks / rays << " block(s), "
+              << stats.misses / rays << " miss(es) per ray (miss rate " << 100.0 * stats.misses / std::max<uint64_t>(stats.lines, 1)
+              << "%)" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "No arguments. Exiting." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::string layout_name, ray_file;
+    int max_rays, cache_size;
+    float tmin, tmax;
+    bool help;
+    ArgParser parser(argc, argv);
+    parser.add_option<bool>("help", "h", "Shows this message", help, false);
+    parser.add_option<std::string>("layout", "l", "Sets the layout of the nodes (depth-first, veb or hot)", layout_name, "veb", "layout");
+    parser.add_option<std::string>("rays", "r", "Traces a ray distribution to count the visits (needed by hot) and the cache misses", ray_file, "", "file.rays");
+    parser.add_option<int>("max-rays", "n", "Sets the maximum number of rays read from the distribution (0 for all)", max_rays, 0, "count");
+    parser.add_option<int>("cache-size", "cs", "Sets the size of the simulated cache", cache_size, 32, "KB");
+    parser.add_option<float>("tmin", "tmin", "Sets the minimum distance along the rays (for files without intervals)", tmin, 0.0f, "t");
+    parser.add_option<float>("tmax", "tmax", "Sets the maximum distance along the rays (for files without intervals)", tmax, 1e9f, "t");
+
+    if (!parser.parse()) {
+        parser.usage();
+        return EXIT_SUCCESS;
+    }
+
+    if (help) {
+        parser.usage();
+        return EXIT_SUCCESS;
+    }
+
+    if (parser.arguments().size() < 2) {
+        std::cerr << "Input file and output file expected. Exiting." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    NodeLayout layout;
+    if (!parse_node_layout(layout_name, layout)) {
+        std::cerr << "Unknown layout '" << layout_name << "'. Exiting." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (layout == NodeLayout::HOT_FIRST && ray_file.empty()) {
+        std::cerr << "The hot layout needs a ray distribution. Exiting." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (max_rays < 0 || cache_size <= 0) {
+        std::cerr << "Invalid number of rays or cache size." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const std::string& input = parser.arguments()[0];
+    const std::string& output = parser.arguments()[1];
+
+    MappedFile in;
+    Mbvh mbvh;
+    if (!in.open(input) || !check_header(in.data(), in.size()) || !read_mbvh(in, mbvh)) {
+        std::cerr << "Invalid BVH file, or the file has no MBVH." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::vector<float> rays;
+    if (!ray_file.empty() && !read_ray_file(ray_file, max_rays, tmin, tmax, rays)) {
+        std::cerr << "Cannot read ray distribution." << std::endl;
+        return EXIT_FAILURE;
+    }
+    const size_t ray_count = rays.size() / 8;
+
+    AccessStats before;
+    std::vector<uint64_t> visits;
+    if (ray_count > 0) {
+        profile_accesses(mbvh, rays.data(), ray_count, (size_t)cache_size * 1024, before, &visits);
+        print_stats("Before", before);
+    }
+
+    if (!reorder_mbvh(mbvh, layout, visits)) {
+        std::cerr << "The nodes of the MBVH do not form a tree." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (ray_count > 0) {
+        AccessStats after;
+        profile_accesses(mbvh, rays.data(), ray_count, (size_t)cache_size * 1024, after);
+        print_stats("After", after);
+        std::cout << "# Misses: " << (before.misses > 0 ? 100.0 * ((double)after.misses / before.misses - 1.0) : 0.0)
+                  << "%" << std::endl;
+    }
+
+    // The MBVH and its CPU layout are replaced (uncompressed), the other blocks are copied as they are
+    bool written = write_scene_file(output, [&] (BlockWriter& writer, std::ostream&) {
+        bool ok = true;
+        const bool complete = for_each_block(in.data(), in.size(), [&] (BlockType type, const char* data, size_t size) {
+            if (!ok || type == BlockType::PADDING || type == BlockType::DIRECTORY) return;
+
+            BlockType original = type;
+            if (type == BlockType::COMPRESSED) original = (BlockType)((const compressed::Header*)data)->block_type;
+
+            if (original == BlockType::MBVH)
+                ok = writer.write_block(original, mbvh_block(mbvh));
+            else if (original == BlockType::CPU_MBVH)
+                ok = writer.write_block(original, cpu_mbvh_block(mbvh));
+            else
+                ok = writer.write_block(type, data, size);
+        });
+        return complete && ok;
+    });
+
+    if (!written) {
+        std::cerr << "Cannot write output file." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,226 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <string>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "../frontend/options.h"
+#include "../frontend/ray_format.h"
+#include "../frontend/server_protocol.h"
+
+static size_t file_size(std::istream& is) {
+    std::streampos pos = is.tellg();
+    is.seekg(0, std::istream::end);
+    size_t size = is.tellg();
+    is.seekg(pos);
+    return size;
+}
+
+static bool send_request(int sock, const server::Request& request, int fd = -1) {
+    struct iovec iov;
+    iov.iov_base = (void*)&request;
+    iov.iov_len = sizeof(server::Request);
+
+    char control[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msghdr));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (fd >= 0) {
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+    return sendmsg(sock, &msg, MSG_NOSIGNAL) == sizeof(server::Request);
+}
+
+static bool recv_response(int sock, server::Response& response) {
+    return recv(sock, &response, sizeof(server::Response), MSG_WAITALL) == sizeof(server::Response) &&
+           response.status == 0;
+}
+
+static double median_ms(std::vector<int64_t>& times) {
+    std::sort(times.begin(), times.end());
+    return times[times.size() / 2] / 1000.0;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "No arguments. Exiting." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::string socket_path, output;
+    int batch, times;
+    float tmin, tmax;
+    bool any, quit, help;
+
+    ArgParser parser(argc, argv);
+    parser.add_option<bool>("help", "h", "Shows this message", help, false);
+    parser.add_option<std::string>("socket", "s", "Sets the socket of the server", socket_path, "traversal.sock", "socket");
+    parser.add_option<int>("batch", "b", "Sets the number of rays per request (rounded up to a multiple of 8)", batch, 65536, "rays");
+    parser.add_option<int>("times", "n", "Sets the number of times the distribution is submitted", times, 10, "count");
+    parser.add_option<std::string>("output", "o", "Sets the output file name (no output by default)", output, "", "output.fbuf");
+    parser.add_option<float>("tmin", "tmin", "Sets the minimum t parameter along the rays, unless the file has per-ray intervals", tmin, 0.0f, "t");
+    parser.add_option<float>("tmax", "tmax", "Sets the maximum t parameter along the rays, unless the file has per-ray intervals", tmax, 1e9f, "t");
+    parser.add_option<bool>("any", "any", "Stops at the first intersection", any, false);
+    parser.add_option<bool>("quit", "q", "Stops the server when done", quit, false);
+
+    if (!parser.parse()) {
+        parser.usage();
+        return EXIT_SUCCESS;
+    }
+
+    if (help) {
+        parser.usage();
+        return EXIT_SUCCESS;
+    }
+
+    if (parser.arguments().size() < 1 && !quit) {
+        std::cerr << "Ray distribution file expected. Exiting." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (batch <= 0 || batch > std::numeric_limits<int>::max() - (int)server::packet_size || times < 0) {
+        std::cerr << "Invalid batch size or submission count." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // Only the last batch then needs to be padded by the server
+    batch = (batch + server::packet_size - 1) / server::packet_size * server::packet_size;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(sockaddr_un));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0 || connect(sock, (struct sockaddr*)&addr, sizeof(sockaddr_un)) != 0) {
+        std::cerr << "Cannot connect to the server." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    server::Request request;
+    memset(&request, 0, sizeof(server::Request));
+    server::Response response;
+
+    if (parser.arguments().size() >= 1) {
+        std::ifstream in(parser.arguments()[0], std::ifstream::binary);
+        rays::Header header;
+        if (!in || !rays::read_header(in, file_size(in), header)) {
+            std::cerr << "Cannot load ray distribution file." << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        // The buffer holds all the rays, followed by all the hits
+        const size_t ray_count = header.ray_count;
+        const size_t hit_offset = (ray_count * server::ray_size + 63) / 64 * 64;
+        const size_t buffer_size = hit_offset + ray_count * server::hit_size;
+
+        // The shared memory object is unlinked right away, it only lives as long as the mappings
+        const std::string shm_name = "/traversal_client." + std::to_string(getpid());
+        int fd = shm_open(shm_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0) {
+            std::cerr << "Cannot create shared memory buffer." << std::endl;
+            return EXIT_FAILURE;
+        }
+        shm_unlink(shm_name.c_str());
+
+        void* ptr = MAP_FAILED;
+        if (ftruncate(fd, buffer_size) == 0)
+            ptr = mmap(nullptr, buffer_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (ptr == MAP_FAILED) {
+            std::cerr << "Cannot map shared memory buffer." << std::endl;
+            return EXIT_FAILURE;
+        }
+        char* buffer = (char*)ptr;
+
+        in.read(buffer, rays::ray_size((rays::Layout)header.layout) * ray_count);
+        if (!in) {
+            std::cerr << "Cannot load ray distribution file." << std::endl;
+            return EXIT_FAILURE;
+        }
+        rays::expand_rays(header, (float*)buffer, ray_count, tmin, tmax);
+
+        std::cout << ray_count << " ray(s) in the distribution file." << std::endl;
+
+        request.command = (uint32_t)server::Command::ATTACH;
+        request.buffer_size = buffer_size;
+        if (!send_request(sock, request, fd) || !recv_response(sock, response)) {
+            std::cerr << "Cannot attach the buffer to the server." << std::endl;
+            return EXIT_FAILURE;
+        }
+        close(fd);
+
+        std::vector<int64_t> round_trips, queue_times, traversal_times;
+        uint64_t intr = 0;
+        const int64_t start = server::now();
+        for (int i = 0; i < times; i++) {
+            intr = 0;
+            for (size_t first = 0; first < ray_count; first += batch) {
+                request.command = (uint32_t)server::Command::TRAVERSE;
+                request.flags = any ? (uint32_t)server::ANY_HIT : 0u;
+                request.id++;
+                request.ray_offset = first * server::ray_size;
+                request.hit_offset = hit_offset + first * server::hit_size;
+                request.ray_count = std::min(ray_count - first, (size_t)batch);
+                request.submit_time = server::now();
+                if (!send_request(sock, request) || !recv_response(sock, response)) {
+                    std::cerr << "Request " << request.id << " failed." << std::endl;
+                    return EXIT_FAILURE;
+                }
+                round_trips.push_back(server::now() - request.submit_time);
+                queue_times.push_back(response.queue_time);
+                traversal_times.push_back(response.traversal_time);
+                intr += response.intersections;
+            }
+        }
+        const double total_time = server::now() - start;
+
+        if (!round_trips.empty()) {
+            std::cout << total_time / 1000.0 << "ms for " << round_trips.size() << " request(s)." << std::endl;
+            std::cout << ray_count * times * 1000000.0 / total_time << " rays/sec." << std::endl;
+            std::cout << "# Median round trip: " << median_ms(round_trips) << " ms" << std::endl;
+            std::cout << "# Median queueing: " << median_ms(queue_times) << " ms" << std::endl;
+            std::cout << "# Median traversal: " << median_ms(traversal_times) << " ms" << std::endl;
+            std::cout << intr << " intersection(s)." << std::endl;
+        }
+
+        if (!output.empty()) {
+            // Same output as the fbuf format of the frontend
+            std::ofstream out(output, std::ofstream::binary);
+            const char* hits = buffer + hit_offset;
+            for (size_t i = 0; i < ray_count; i++)
+                out.write(hits + i * server::hit_size + sizeof(int32_t) * 2, sizeof(float));
+            if (!out) {
+                std::cerr << "Cannot write output file." << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+
+        munmap(buffer, buffer_size);
+    }
+
+    if (quit) {
+        request.command = (uint32_t)server::Command::QUIT;
+        request.id++;
+        if (!send_request(sock, request) || !recv_response(sock, response)) {
+            std::cerr << "Cannot stop the server." << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    close(sock);
+    return EXIT_SUCCESS;
+}
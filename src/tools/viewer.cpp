@@ -365,11 +365,6 @@ int main(int argc, char** argv) {
 
     anydsl::Array<Node> nodes;
     anydsl::Array<Vec4> tris;
-    if (!load_accel(accel_file, nodes, tris)) {
-        std::cerr << "Cannot load acceleration structure file." << std::endl;
-        return EXIT_FAILURE;
-    }
-
     Camera cam = gen_camera(eye, center, up, cfg.fov, (float)cfg.width / (float)cfg.height);
 
     // Generate a local coordinate system for each triangle
@@ -377,8 +372,8 @@ int main(int argc, char** argv) {
     {
         std::vector<float> vertices;
         std::vector<int> indices;
-        if (!load_mesh(accel_file, indices, vertices)) {
-            std::cerr << "Cannot load geometry." << std::endl;
+        if (!load_scene(accel_file, nodes, tris, indices, vertices)) {
+            std::cerr << "Cannot load acceleration structure or geometry." << std::endl;
             return EXIT_FAILURE;
         }
         gen_local_coords(indices, vertices, local_coords);